@@ -5,8 +5,14 @@
 #include "RayTracer.h"
 #include "scene/light.h"
 #include "scene/material.h"
+#include "scene/kdTree.h"
 #include "scene/ray.h"
+#include "scene/timeline.h"
 
+#include "fileio/costmap.h"
+#include "fileio/images.h"
+#include "fileio/mappedfile.h"
+#include "parser/BinaryScene.h"
 #include "parser/JsonParser.h"
 #include "parser/Parser.h"
 #include "parser/Tokenizer.h"
@@ -14,6 +20,7 @@
 
 #include "ui/TraceUI.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
@@ -21,6 +28,8 @@
 
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <set>
 
 using namespace std;
 extern TraceUI *traceUI;
@@ -29,6 +38,39 @@ extern TraceUI *traceUI;
 // set in the "trace single ray" mode in TraceGLWindow, for example.
 bool debugMode = false;
 
+namespace {
+// Move the differentials of r to the point where it hits a surface with
+// normal N at distance t: the offset origins travel along their own
+// directions until they meet the tangent plane of the hit.
+void transferDifferentials(const ray &r, double t, const glm::dvec3 &N,
+                           ray::Differentials &diff) {
+  const glm::dvec3 D = r.getDirection();
+  double DdotN = glm::dot(D, N);
+  if (DdotN == 0.0)
+    DdotN = RAY_EPSILON;
+  diff.dPdx += t * diff.dDdx;
+  diff.dPdy += t * diff.dDdy;
+  diff.dPdx -= (glm::dot(diff.dPdx, N) / DdotN) * D;
+  diff.dPdy -= (glm::dot(diff.dPdy, N) / DdotN) * D;
+}
+
+// Differentials of the mirror direction R = D - 2 (D . N) N, treating the
+// normal as constant across the footprint.
+glm::dvec3 reflectDifferential(const glm::dvec3 &dD, const glm::dvec3 &N) {
+  return dD - 2.0 * glm::dot(dD, N) * N;
+}
+
+// Differentials of the refracted direction T = eta D + mu n, where n faces
+// the incoming ray, cosi = -D . n and mu = eta cosi - sqrt(k). Again the
+// normal is treated as constant.
+glm::dvec3 refractDifferential(const glm::dvec3 &dD, const glm::dvec3 &n,
+                               double eta, double cosi, double k) {
+  double dcosi = -glm::dot(dD, n);
+  double dmu = (eta - eta * eta * cosi / std::sqrt(k)) * dcosi;
+  return eta * dD + dmu * n;
+}
+} // namespace
+
 // Trace a top-level ray through pixel(i,j), i.e. normalized window coordinates
 // (x,y), through the projection plane, and out into the scene. All we do is
 // enter the main ray-tracing method, getting things started by plugging in an
@@ -42,12 +84,12 @@ glm::dvec3 RayTracer::trace(double x, double y) {
 
   ray r(glm::dvec3(0, 0, 0), glm::dvec3(0, 0, 0), glm::dvec3(1, 1, 1),
         ray::VISIBILITY);
-  scene->getCamera().rayThrough(x, y, r);
+  scene->getCamera().rayThrough(x, y, 1.0 / buffer_width,
+                                1.0 / buffer_height, r);
   double dummy;
-  glm::dvec3 ret =
-      traceRay(r, glm::dvec3(1.0, 1.0, 1.0), traceUI->getDepth(), dummy);
-  ret = glm::clamp(ret, 0.0, 1.0);
-  return ret;
+  // Left unclamped: the framebuffer keeps linear radiance, and clamping is
+  // up to the tone map that resolves it.
+  return traceRay(r, glm::dvec3(1.0, 1.0, 1.0), traceUI->getDepth(), dummy);
 }
 
 glm::dvec3 RayTracer::tracePixel(int i, int j) {
@@ -59,12 +101,17 @@ glm::dvec3 RayTracer::tracePixel(int i, int j) {
   double x = double(i) / double(buffer_width);
   double y = double(j) / double(buffer_height);
 
-  unsigned char *pixel = buffer.data() + (i + j * buffer_width) * 3;
-  col = trace(x, y);
-
-  pixel[0] = (int)(255.0 * col[0]);
-  pixel[1] = (int)(255.0 * col[1]);
-  pixel[2] = (int)(255.0 * col[2]);
+  seedSamples(i, j);
+  if (!recordCosts) {
+    col = trace(x, y);
+  } else {
+    RayStats before = rayStats;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    col = trace(x, y);
+    addCost(i, j, before, start);
+  }
+  setPixel(i, j, col);
   return col;
 }
 
@@ -82,6 +129,18 @@ glm::dvec3 RayTracer::traceRay(ray &r, const glm::dvec3 &thresh, int depth,
         t = i.getT();
         const Material &m = i.getMaterial();
 
+        // Footprint of the pixel on the surface, for texture filtering
+        ray::Differentials diff;
+        if (r.hasDifferentials()) {
+            diff = r.getDifferentials();
+            transferDifferentials(r, t, glm::normalize(i.getN()), diff);
+            const glm::dvec3 &du = i.getUGradient();
+            const glm::dvec3 &dv = i.getVGradient();
+            i.setUVFootprint(
+                glm::dvec2(glm::dot(du, diff.dPdx), glm::dot(dv, diff.dPdx)),
+                glm::dvec2(glm::dot(du, diff.dPdy), glm::dot(dv, diff.dPdy)));
+        }
+
         // ---- Local Phong shading ----
         colorC = m.shade(scene.get(), r, i);
         // Stop recursion
@@ -112,6 +171,12 @@ glm::dvec3 RayTracer::traceRay(ray &r, const glm::dvec3 &thresh, int depth,
                 glm::dvec3(1.0),
                 ray::REFLECTION
             );
+            if (r.hasDifferentials()) {
+                ray::Differentials rd = diff;
+                rd.dDdx = reflectDifferential(diff.dDdx, N);
+                rd.dDdy = reflectDifferential(diff.dDdy, N);
+                reflectedRay.setDifferentials(rd);
+            }
 
             double t_reflect;
             glm::dvec3 reflectedColor =
@@ -154,6 +219,12 @@ glm::dvec3 RayTracer::traceRay(ray &r, const glm::dvec3 &thresh, int depth,
                     glm::dvec3(1.0),
                     ray::REFRACTION
                 );
+                if (r.hasDifferentials()) {
+                    ray::Differentials rd = diff;
+                    rd.dDdx = refractDifferential(diff.dDdx, n, eta, cosi, k);
+                    rd.dDdy = refractDifferential(diff.dDdy, n, eta, cosi, k);
+                    refractedRay.setDifferentials(rd);
+                }
 
                 double t_refract;
                 glm::dvec3 refractedColor =
@@ -166,7 +237,11 @@ glm::dvec3 RayTracer::traceRay(ray &r, const glm::dvec3 &thresh, int depth,
         return colorC;
     } else {
         if (traceUI->cubeMap()) {
-          return traceUI->getCubeMap()->getColor(r);
+          const CubeMap *cubemap = traceUI->getCubeMap();
+          if (!r.hasDifferentials())
+            return cubemap->getColor(r.getDirection());
+          const ray::Differentials &diff = r.getDifferentials();
+          return cubemap->getColor(r.getDirection(), diff.dDdx, diff.dDdy);
         }
 
 
@@ -192,6 +267,15 @@ RayTracer::RayTracer()
 RayTracer::~RayTracer() {}
 
 void RayTracer::getBuffer(unsigned char *&buf, int &w, int &h) {
+  display.resize(buffer.size());
+  resolve(buffer.data(), display.data(), buffer.size(),
+          traceUI->getToneMap());
+  buf = display.data();
+  w = buffer_width;
+  h = buffer_height;
+}
+
+void RayTracer::getHDRBuffer(const float *&buf, int &w, int &h) {
   buf = buffer.data();
   w = buffer_width;
   h = buffer_height;
@@ -202,8 +286,15 @@ double RayTracer::aspectRatio() {
 }
 
 bool RayTracer::loadScene(const char *fn) {
-  ifstream ifs(fn);
-  if (!ifs) {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+  loadTimes = LoadTimes();
+  meshSizes = MeshSizes();
+  TimelineSpan span("load scene", "load", [fn]() { return string(fn); });
+
+  // The parsers scan the mapped file in place.
+  MappedFile source;
+  if (!source.open(fn)) {
     string msg("Error: couldn't read scene file ");
     msg.append(fn);
     traceUI->alert(msg);
@@ -223,10 +314,21 @@ bool RayTracer::loadScene(const char *fn) {
   else
     path = path.substr(0, path.find_last_of("\\/"));
 
-  if (isRay) {
+  if (BinaryScene::isBinaryScene(fn)) {
+    // Compiled scene: no parsing, just copy the arrays out of the mapping
+    TimelineSpan parse("read binary scene", "load");
+    try {
+      scene.reset(BinaryScene::read(source.data()));
+    } catch (ParserException &pe) {
+      traceUI->alert(pe.message());
+      return false;
+    }
+  } else if (isRay) {
     // .ray Parsing Path
-    // Call this with 'true' for debug output from the tokenizer
-    Tokenizer tokenizer(ifs, false);
+    // Call this with 'true' for debug output from the tokenizer. Tokens are
+    // read as the parser asks for them, so one span covers both.
+    TimelineSpan parse("tokenize and parse", "load");
+    Tokenizer tokenizer(source.data(), false);
     Parser parser(tokenizer, path);
     try {
       scene.reset(parser.parseScene());
@@ -246,8 +348,9 @@ bool RayTracer::loadScene(const char *fn) {
     }
   } else {
     // JSON Parsing Path
+    TimelineSpan parse("parse json", "load");
     try {
-      JsonParser parser(path, ifs);
+      JsonParser parser(path, source.data());
       scene.reset(parser.parseScene());
     } catch (ParserException &pe) {
       string msg("Parser: fatal exception ");
@@ -265,19 +368,152 @@ bool RayTracer::loadScene(const char *fn) {
   if (!sceneLoaded())
     return false;
 
+  Clock::time_point parsed = Clock::now();
+  loadTimes.parse = std::chrono::duration<double>(parsed - start).count();
+
+  try {
+    TimelineSpan finalize("finalize", "build");
+    scene->finalize();
+  } catch (TextureMapException &e) {
+    string msg("Texture mapping exception: ");
+    msg.append(e.message());
+    traceUI->alert(msg);
+    scene.reset();
+    return false;
+  }
+  if (traceUI->compressMeshes())
+    compressMeshes();
+  if (traceUI->kdSwitch())
+    buildKdTree();
+
+  loadTimes.build =
+      std::chrono::duration<double>(Clock::now() - parsed).count();
   return true;
 }
 
+// Quantize every trimesh in the scene and report how much memory it saved.
+void RayTracer::compressMeshes() {
+  TimelineSpan span("compress meshes", "build");
+  for (Geometry *g : scene->getAllObjects()) {
+    Trimesh *t = dynamic_cast<Trimesh *>(g);
+    if (!t)
+      continue;
+    meshSizes.before += t->byteSize();
+    t->compress();
+    meshSizes.after += t->byteSize();
+    ++meshSizes.meshes;
+  }
+  if (meshSizes.meshes > 0)
+    std::cerr << "Compressed " << meshSizes.meshes << " mesh(es): "
+              << meshSizes.before << " -> " << meshSizes.after
+              << " bytes (ratio "
+              << double(meshSizes.before) / double(meshSizes.after) << ")"
+              << std::endl;
+}
+
+namespace {
+
+// Camera rays through a grid over the image, and from wherever one of them
+// hits, a shadow ray towards every light: a sparse sample of what a render
+// traces, for comparing trees on.
+std::vector<ray> sampleRays(const Scene &scene, int grid) {
+  Camera camera = scene.getCamera();
+  std::vector<ray> rays;
+  for (int y = 0; y < grid; ++y) {
+    for (int x = 0; x < grid; ++x) {
+      ray r(glm::dvec3(0.0), glm::dvec3(0.0), glm::dvec3(1.0),
+            ray::VISIBILITY);
+      camera.rayThrough((x + 0.5) / grid, (y + 0.5) / grid, r);
+      rays.push_back(r);
+      isect i;
+      if (!scene.intersect(r, i))
+        continue;
+      glm::dvec3 p = r.at(i);
+      for (const auto &light : scene.getAllLights()) {
+        glm::dvec3 l = light->getDirection(p);
+        rays.emplace_back(p + 1e-6 * l, l, glm::dvec3(1.0), ray::SHADOW);
+      }
+    }
+  }
+  return rays;
+}
+
+// Best of a few passes of intersecting every ray, in seconds.
+double timeKdTree(const KdTree<Geometry> &tree, std::vector<ray> &rays) {
+  using Clock = std::chrono::steady_clock;
+  double best = std::numeric_limits<double>::infinity();
+  for (int pass = 0; pass < 3; ++pass) {
+    Clock::time_point start = Clock::now();
+    for (ray &r : rays) {
+      isect i;
+      tree.intersect(r, i);
+    }
+    best = std::min(
+        best, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  return best;
+}
+
+} // namespace
+
+// Index the scene's objects with tree_depth and leaf_size, or, with
+// kd_autotune, with whichever of a few candidate settings traces a sample
+// of the scene's rays fastest.
+void RayTracer::buildKdTree() {
+  TimelineSpan span("build kd-tree", "build");
+  using Tree = KdTree<Geometry>;
+  const auto &objects = scene->getAllObjects();
+  int depth = traceUI->getMaxDepth(), leafSize = traceUI->getLeafSize();
+  std::unique_ptr<Tree> tree(new Tree(objects, depth, leafSize));
+
+  if (traceUI->kdAutoTune() && objects.size() > 1) {
+    std::vector<ray> rays = sampleRays(*scene, 32);
+    double configured = timeKdTree(*tree, rays), fastest = configured;
+    std::set<int> depths{8, 12, 16, 20, 24, depth};
+    std::set<int> leafSizes{1, 2, 4, 8, 16, leafSize};
+    for (int d : depths) {
+      for (int l : leafSizes) {
+        if (d == depth && l == leafSize)
+          continue;
+        std::unique_ptr<Tree> candidate(new Tree(objects, d, l));
+        double time = timeKdTree(*candidate, rays);
+        if (time < fastest) {
+          fastest = time;
+          tree = std::move(candidate);
+        }
+      }
+    }
+    std::cerr << "kd-tree auto-tune: tree_depth "
+              << tree->getStats().maxDepth << ", leaf_size "
+              << tree->getStats().leafSize << " traced " << rays.size()
+              << " sample rays in " << fastest * 1e6 << " us ("
+              << configured * 1e6 << " us with tree_depth " << depth
+              << ", leaf_size " << leafSize << ")" << std::endl;
+  }
+
+  if (traceUI->kdReport())
+    tree->getStats().print(std::cerr);
+  scene->setKdTree(std::move(tree));
+}
+
 void RayTracer::traceSetup(int w, int h) {
   size_t newBufferSize = w * h * 3;
   if (newBufferSize != buffer.size()) {
     bufferSize = newBufferSize;
     buffer.resize(bufferSize);
   }
-  buffer_width = w;
-  buffer_height = h;
   std::fill(buffer.begin(), buffer.end(), 0);
   m_bBufferReady = true;
+  syncSettings(w, h);
+  costs.assign(recordCosts ? size_t(w) * h * COST_CHANNELS : 0, 0.0f);
+
+  // YOUR CODE HERE
+  // FIXME: Additional initializations
+}
+
+void RayTracer::syncSettings(int w, int h) {
+  buffer_width = w;
+  buffer_height = h;
 
   /*
    * Sync with TraceUI
@@ -288,9 +524,7 @@ void RayTracer::traceSetup(int w, int h) {
   thresh = traceUI->getThreshold();
   samples = traceUI->getSuperSamples();
   aaThresh = traceUI->getAaThreshold();
-
-  // YOUR CODE HERE
-  // FIXME: Additional initializations
+  recordCosts = traceUI->costMaps();
 }
 
 /*
@@ -308,7 +542,9 @@ void RayTracer::traceImage(int w, int h) {
   traceSetup(w, h);
 
   // Simple single-threaded rendering
+  TimelineSpan span("trace image", "render");
   for (int j = 0; j < h; j++) {
+    TimelineSpan row("row", "render", [j]() { return std::to_string(j); });
     for (int i = 0; i < w; i++) {
       tracePixel(i, j);
     }
@@ -316,6 +552,64 @@ void RayTracer::traceImage(int w, int h) {
 }
 
 
+void RayTracer::traceImage(int w, int h, ImageSink &sink) {
+  syncSettings(w, h);
+  bool antialias = traceUI->aaSwitch() && samples > 0;
+
+  ToneMap toneMap = traceUI->getToneMap();
+  std::vector<float> row(size_t(w) * 3);
+  std::vector<unsigned char> resolved(row.size());
+  TimelineSpan span("trace image", "render");
+  for (int j = h - 1; j >= 0; j--) {
+    TimelineSpan rowSpan("row", "render", [j]() { return std::to_string(j); });
+    for (int i = 0; i < w; i++) {
+      glm::dvec3 col;
+      if (antialias) {
+        col = aaPixel(i, j);
+      } else {
+        seedSamples(i, j);
+        col = trace(double(i) / double(buffer_width),
+                    double(j) / double(buffer_height));
+      }
+      float *pixel = row.data() + i * 3;
+      pixel[0] = float(col[0]);
+      pixel[1] = float(col[1]);
+      pixel[2] = float(col[2]);
+    }
+    resolve(row.data(), resolved.data(), row.size(), toneMap);
+    sink.addRow(j, resolved.data());
+  }
+}
+
+// Every path that traces pixels calls this first: the streaming and the
+// buffered traceImage go through the image in different orders, and this
+// way they still trace the same rays for each pixel.
+void RayTracer::seedSamples(int i, int j) {
+  sampleRng.seed(unsigned(j) * unsigned(buffer_width) + unsigned(i) + 1);
+}
+
+// The average of `samples` rays through random points of pixel (i, j).
+glm::dvec3 RayTracer::aaPixel(int i, int j) {
+    glm::dvec3 color(0.0); // Initialize cumulative color for the pixel
+    seedSamples(i, j);
+    std::uniform_real_distribution<double> offset(-0.5, 0.5);
+
+    // Loop for each sample within the pixel
+    for (int s = 0; s < samples; ++s) {
+        // Generate a random offset for sub-pixel sampling
+        double xOffset = offset(sampleRng);
+        double yOffset = offset(sampleRng);
+
+        // Compute the color for the ray with the offset
+        glm::dvec3 sampleColor = trace((i + xOffset) / buffer_width,
+                                       (j + yOffset) / buffer_height);
+        color += sampleColor; // Accumulate sample color
+    }
+
+    // Average the color by the number of samples
+    return color / static_cast<double>(samples);
+}
+
 int RayTracer::aaImage() {
     // Check if the required parameters are initialized
     if (samples <= 0) {
@@ -323,27 +617,21 @@ int RayTracer::aaImage() {
     }
 
     // Loop through each pixel
+    TimelineSpan span("anti-alias", "render");
     for (int j = 0; j < buffer_height; ++j) {
+        TimelineSpan row("anti-alias row", "render",
+                         [j]() { return std::to_string(j); });
         for (int i = 0; i < buffer_width; ++i) {
-            glm::dvec3 color(0.0); // Initialize cumulative color for the pixel
-
-            // Loop for each sample within the pixel
-            for (int s = 0; s < samples; ++s) {
-                // Generate a random offset for sub-pixel sampling
-                double xOffset = ((double)rand() / RAND_MAX - 0.5) * 1.0;
-                double yOffset = ((double)rand() / RAND_MAX - 0.5) * 1.0;
-
-
-                // Compute the color for the ray with the offset
-                glm::dvec3 sampleColor = trace((i + xOffset) / buffer_width, (j + yOffset) / buffer_height);
-                color += sampleColor; // Accumulate sample color
-            }
-
-            // Average the color by the number of samples
-            color /= static_cast<double>(samples);
-
             // Store the averaged color into the pixel buffer
-            setPixel(i, j, color);
+            if (!recordCosts) {
+                setPixel(i, j, aaPixel(i, j));
+                continue;
+            }
+            RayStats before = rayStats;
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            setPixel(i, j, aaPixel(i, j));
+            addCost(i, j, before, start);
         }
     }
 
@@ -361,16 +649,34 @@ void RayTracer::waitRender() {
 }
 
 
+void RayTracer::getCostBuffer(const float *&buf, int &w, int &h) {
+  buf = costs.empty() ? nullptr : costs.data();
+  w = buffer_width;
+  h = buffer_height;
+}
+
+// Add the work done since `before` was taken at `start` to pixel (i, j).
+void RayTracer::addCost(int i, int j, const RayStats &before,
+                        std::chrono::steady_clock::time_point start) {
+  float *cost = costs.data() + (i + j * buffer_width) * COST_CHANNELS;
+  cost[COST_RAYS] += float(rayStats.rays - before.rays);
+  cost[COST_BOX_TESTS] += float(rayStats.boxTests - before.boxTests);
+  cost[COST_PRIMITIVE_TESTS] +=
+      float(rayStats.primitiveTests - before.primitiveTests);
+  cost[COST_SECONDS] += float(std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count());
+}
+
 glm::dvec3 RayTracer::getPixel(int i, int j) {
-  unsigned char *pixel = buffer.data() + (i + j * buffer_width) * 3;
-  return glm::dvec3((double)pixel[0] / 255.0, (double)pixel[1] / 255.0,
-                    (double)pixel[2] / 255.0);
+  float *pixel = buffer.data() + (i + j * buffer_width) * 3;
+  return glm::dvec3(pixel[0], pixel[1], pixel[2]);
 }
 
 void RayTracer::setPixel(int i, int j, glm::dvec3 color) {
-  unsigned char *pixel = buffer.data() + (i + j * buffer_width) * 3;
+  float *pixel = buffer.data() + (i + j * buffer_width) * 3;
 
-  pixel[0] = (int)(255.0 * color[0]);
-  pixel[1] = (int)(255.0 * color[1]);
-  pixel[2] = (int)(255.0 * color[2]);
+  pixel[0] = float(color[0]);
+  pixel[1] = float(color[1]);
+  pixel[2] = float(color[2]);
 }
@@ -7,12 +7,14 @@
 
 #include "scene/cubeMap.h"
 #include "scene/ray.h"
+#include <chrono>
 #include <glm/vec3.hpp>
 #include <mutex>
 #include <queue>
 #include <thread>
 #include <time.h>
 
+class ImageSink;
 class Scene;
 class Pixel {
 public:
@@ -35,10 +37,20 @@ public:
 
   glm::dvec3 getPixel(int i, int j);
   void setPixel(int i, int j, glm::dvec3 color);
+  // The image resolved to 8-bit RGB with the current tone map.
   void getBuffer(unsigned char *&buf, int &w, int &h);
+  // The linear float RGB framebuffer the image is traced into.
+  void getHDRBuffer(const float *&buf, int &w, int &h);
+  // What each pixel cost to trace (see CostChannel), or null unless
+  // "cost_maps" was on for the last traceSetup.
+  void getCostBuffer(const float *&buf, int &w, int &h);
   double aspectRatio();
 
   void traceImage(int w, int h);
+  // Trace the image (antialiased if that is switched on) from the top row
+  // down, handing each row to sink as soon as it is done instead of
+  // keeping the whole frame in the buffer.
+  void traceImage(int w, int h, ImageSink &sink);
   int aaImage();
   bool checkRender();
   void waitRender();
@@ -53,17 +65,49 @@ public:
 
   const Scene &getScene() { return *scene; }
 
+  // Wall time the last loadScene spent reading the file into a Scene, and
+  // preparing that for rendering (Scene::finalize, mesh compression and the
+  // kd-tree).
+  struct LoadTimes {
+    double parse = 0;
+    double build = 0;
+  };
+  const LoadTimes &getLoadTimes() const { return loadTimes; }
+
+  // What compressMeshes did to the trimeshes of the last scene loaded:
+  // their total size in bytes before and after. All zero when meshes
+  // weren't compressed or there were none.
+  struct MeshSizes {
+    int meshes = 0;
+    size_t before = 0;
+    size_t after = 0;
+  };
+  const MeshSizes &getMeshSizes() const { return meshSizes; }
+
   bool stopTrace;
 
 private:
   glm::dvec3 trace(double x, double y);
+  glm::dvec3 aaPixel(int i, int j);
+  void seedSamples(int i, int j);
+  void syncSettings(int w, int h);
+  void addCost(int i, int j, const RayStats &before,
+               std::chrono::steady_clock::time_point start);
+  void compressMeshes();
+  void buildKdTree();
 
   std::unique_ptr<Scene> scene;
-  std::vector<unsigned char> buffer;
+  std::vector<float> buffer;          // linear RGB, as traced
+  std::vector<unsigned char> display; // buffer resolved by getBuffer
+  std::vector<float> costs;           // per pixel, when recordCosts
+  bool recordCosts = false;
   double thresh;
   int buffer_width, buffer_height;
   bool m_bBufferReady;
 
+  LoadTimes loadTimes;
+  MeshSizes meshSizes;
+
   int bufferSize;
   unsigned int threads;
   int block_size;
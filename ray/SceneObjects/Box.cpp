@@ -51,24 +51,29 @@ bool Box::intersectLocal(ray &r, isect &i) const {
 
   i.setT(bestT);
   i.setObject(this);
-  i.setMaterial(this->getMaterial());
+  i.setMaterialRef(&this->getMaterial());
 
   // glm::dvec3 intersect_point = r.at((float)i.t);
   glm::dvec3 intersect_point = r.at(i);
 
   int i1 = (bestIndex + 1) % 3;
   int i2 = (bestIndex + 2) % 3;
+  glm::dvec3 du(0.0), dv(0.0);
+  dv[max(i1, i2)] = 1.0;
 
   if (bestIndex < 3) {
     i.setN(glm::dvec3(-double(bestIndex == 0), -double(bestIndex == 1),
                       -double(bestIndex == 2)));
     i.setUVCoordinates(glm::dvec2(0.5 - intersect_point[min(i1, i2)],
                                   0.5 + intersect_point[max(i1, i2)]));
+    du[min(i1, i2)] = -1.0;
   } else {
     i.setN(glm::dvec3(double(bestIndex == 3), double(bestIndex == 4),
                       double(bestIndex == 5)));
     i.setUVCoordinates(glm::dvec2(0.5 + intersect_point[min(i1, i2)],
                                   0.5 + intersect_point[max(i1, i2)]));
+    du[min(i1, i2)] = 1.0;
   }
+  i.setUVGradients(du, dv);
   return true;
 }
@@ -5,7 +5,7 @@
 
 class Box : public SceneObject {
 public:
-  Box(Scene *scene, Material *mat) : SceneObject(scene, mat) {}
+  Box(Scene *scene, const Material *mat) : SceneObject(scene, mat) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
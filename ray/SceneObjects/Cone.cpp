@@ -100,7 +100,7 @@ bool Cone::intersectLocal(ray &r, isect &i) const {
   i.setT(theRoot);
   i.setN(glm::normalize(normal));
   i.setObject(this);
-  i.setMaterial(this->getMaterial());
+  i.setMaterialRef(&this->getMaterial());
   return true;
 
   return ret;
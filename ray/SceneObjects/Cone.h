@@ -4,8 +4,10 @@
 #include "../scene/scene.h"
 
 class Cone : public SceneObject {
+  friend class BinaryScene;
+
 public:
-  Cone(Scene *scene, Material *mat, double h = 1.0, double br = 1.0,
+  Cone(Scene *scene, const Material *mat, double h = 1.0, double br = 1.0,
        double tr = 0.0, bool cap = false)
       : SceneObject(scene, mat) {
     height = h;
@@ -4,8 +4,10 @@
 #include "../scene/scene.h"
 
 class Cylinder : public SceneObject {
+  friend class BinaryScene;
+
 public:
-  Cylinder(Scene *scene, Material *mat)
+  Cylinder(Scene *scene, const Material *mat)
       : SceneObject(scene, mat), capped(true) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
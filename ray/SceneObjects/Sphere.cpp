@@ -6,6 +6,15 @@
 
 using namespace std;
 
+// The unit sphere stays a sphere as long as the transform scales all axes
+// alike.
+bool Sphere::worldSphere(glm::dvec3 &centre, double &radius) const {
+  if (!transform.uniformScale(radius))
+    return false;
+  centre = glm::dvec3(transform.transform()[3]);
+  return true;
+}
+
 bool Sphere::intersectLocal(ray &r, isect &i) const {
   r.setDirection(glm::normalize(r.getDirection()));
   glm::dvec3 v = -r.getPosition();
@@ -24,7 +33,7 @@ bool Sphere::intersectLocal(ray &r, isect &i) const {
   }
 
   i.setObject(this);
-  i.setMaterial(this->getMaterial());
+  i.setMaterialRef(&this->getMaterial());
 
   double t1 = b - discriminant;
 
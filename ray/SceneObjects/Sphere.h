@@ -5,10 +5,11 @@
 
 class Sphere : public SceneObject {
 public:
-  Sphere(Scene *scene, Material *mat) : SceneObject(scene, mat) {}
+  Sphere(Scene *scene, const Material *mat) : SceneObject(scene, mat) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
+  virtual bool worldSphere(glm::dvec3 &centre, double &radius) const;
 
   virtual BoundingBox ComputeLocalBoundingBox() {
     BoundingBox localbounds;
@@ -30,7 +30,7 @@ bool Square::intersectLocal(ray &r, isect &i) const {
   }
 
   i.setObject(this);
-  i.setMaterial(this->getMaterial());
+  i.setMaterialRef(&this->getMaterial());
   i.setT(t);
   if (d[2] > 0.0) {
     i.setN(glm::dvec3(0.0, 0.0, -1.0));
@@ -39,5 +39,6 @@ bool Square::intersectLocal(ray &r, isect &i) const {
   }
 
   i.setUVCoordinates(glm::dvec2(P[0] + 0.5, P[1] + 0.5));
+  i.setUVGradients(glm::dvec3(1.0, 0.0, 0.0), glm::dvec3(0.0, 1.0, 0.0));
   return true;
 }
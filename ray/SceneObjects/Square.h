@@ -5,7 +5,7 @@
 
 class Square : public SceneObject {
 public:
-  Square(Scene *scene, Material *mat) : SceneObject(scene, mat) {}
+  Square(Scene *scene, const Material *mat) : SceneObject(scene, mat) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
@@ -0,0 +1,103 @@
+#include "meshCompression.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+uint16_t floatToHalf(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int32_t exp = int32_t((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff) // Inf / NaN
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if (exp >= 0x1f) // overflow: clamp to infinity
+    return sign | 0x7c00;
+  if (exp <= 0) {
+    // subnormal half (or zero)
+    if (exp < -10)
+      return sign;
+    mant |= 0x800000;
+    uint32_t shift = 14 - exp;
+    uint16_t h = uint16_t(mant >> shift);
+    // round to nearest
+    if ((mant >> (shift - 1)) & 1)
+      ++h;
+    return sign | h;
+  }
+  uint16_t h = sign | uint16_t(exp << 10) | uint16_t(mant >> 13);
+  // round to nearest; a carry into the exponent is still correct
+  if (mant & 0x1000)
+    ++h;
+  return h;
+}
+
+uint32_t encodeOctNormal(const glm::dvec3 &n) {
+  double l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (l1 == 0.0)
+    return 0;
+  double x = n.x / l1;
+  double y = n.y / l1;
+  if (n.z < 0.0) {
+    double ox = x;
+    x = (1.0 - std::abs(y)) * (ox >= 0.0 ? 1.0 : -1.0);
+    y = (1.0 - std::abs(ox)) * (y >= 0.0 ? 1.0 : -1.0);
+  }
+  x = std::max(-1.0, std::min(1.0, x));
+  y = std::max(-1.0, std::min(1.0, y));
+  int16_t qx = int16_t(std::lround(x * 32767.0));
+  int16_t qy = int16_t(std::lround(y * 32767.0));
+  return uint32_t(uint16_t(qx)) | (uint32_t(uint16_t(qy)) << 16);
+}
+
+CompressedMesh::CompressedMesh(const std::vector<glm::dvec3> &vertices,
+                               const std::vector<glm::dvec3> &normals,
+                               const std::vector<glm::dvec2> &uvs,
+                               const std::vector<glm::dvec3> &colors,
+                               const std::vector<int> &indices,
+                               const BoundingBox &bounds) {
+  origin = bounds.getMin();
+  glm::dvec3 extent = bounds.getMax() - bounds.getMin();
+  step = extent / 65535.0;
+
+  positions.reserve(3 * vertices.size());
+  for (const auto &v : vertices) {
+    for (int axis = 0; axis < 3; ++axis) {
+      double q =
+          step[axis] > 0.0 ? (v[axis] - origin[axis]) / step[axis] : 0.0;
+      q = std::max(0.0, std::min(65535.0, q));
+      positions.push_back(uint16_t(std::lround(q)));
+    }
+  }
+
+  this->normals.reserve(normals.size());
+  for (const auto &n : normals)
+    this->normals.push_back(encodeOctNormal(n));
+
+  this->uvs.reserve(2 * uvs.size());
+  for (const auto &uv : uvs) {
+    this->uvs.push_back(floatToHalf(float(uv[0])));
+    this->uvs.push_back(floatToHalf(float(uv[1])));
+  }
+
+  this->colors.reserve(3 * colors.size());
+  for (const auto &c : colors)
+    for (int k = 0; k < 3; ++k)
+      this->colors.push_back(floatToHalf(float(c[k])));
+
+  if (vertices.size() <= 65536)
+    narrowIndices.assign(indices.begin(), indices.end());
+  else
+    wideIndices.assign(indices.begin(), indices.end());
+}
+
+size_t CompressedMesh::byteSize() const {
+  return sizeof(*this) + positions.capacity() * sizeof(uint16_t) +
+         normals.capacity() * sizeof(uint32_t) +
+         uvs.capacity() * sizeof(uint16_t) +
+         colors.capacity() * sizeof(uint16_t) +
+         narrowIndices.capacity() * sizeof(uint16_t) +
+         wideIndices.capacity() * sizeof(uint32_t);
+}
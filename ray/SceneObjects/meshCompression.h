@@ -0,0 +1,119 @@
+#ifndef MESHCOMPRESSION_H__
+#define MESHCOMPRESSION_H__
+
+#include <cmath>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "../scene/bbox.h"
+
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+/* Compact attribute encodings used by CompressedMesh. Decoding happens for
+every triangle a ray visits, so the decoders are kept inline and branch-light.
+
+  - positions: 3 x 16-bit unorm, relative to the mesh's local bounding box
+  - normals:   32-bit octahedral (2 x 16-bit snorm)
+  - UVs:       2 x IEEE 754 half float
+  - colors:    3 x IEEE 754 half float
+  - indices:   16-bit when the mesh has at most 65536 vertices, else 32-bit */
+
+uint16_t floatToHalf(float f);
+
+inline float halfToFloat(uint16_t h) {
+  uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t bits;
+  if (exp == 0) {
+    if (mant == 0) {
+      bits = sign;
+    } else {
+      // subnormal half: renormalize into a normal float
+      exp = 127 - 15 + 1;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        --exp;
+      }
+      bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else if (exp == 0x1f) {
+    bits = sign | 0x7f800000 | (mant << 13);
+  } else {
+    bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  }
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+uint32_t encodeOctNormal(const glm::dvec3 &n);
+
+inline glm::dvec3 decodeOctNormal(uint32_t e) {
+  double x = int16_t(e & 0xffff) / 32767.0;
+  double y = int16_t(e >> 16) / 32767.0;
+  double z = 1.0 - std::abs(x) - std::abs(y);
+  if (z < 0.0) {
+    double ox = x;
+    x = (1.0 - std::abs(y)) * (ox >= 0.0 ? 1.0 : -1.0);
+    y = (1.0 - std::abs(ox)) * (y >= 0.0 ? 1.0 : -1.0);
+  }
+  return glm::normalize(glm::dvec3(x, y, z));
+}
+
+/* Read-only, quantized copy of a Trimesh's geometry. Built once from the
+full-precision arrays after parsing; see Trimesh::compress(). */
+class CompressedMesh {
+public:
+  CompressedMesh(const std::vector<glm::dvec3> &vertices,
+                 const std::vector<glm::dvec3> &normals,
+                 const std::vector<glm::dvec2> &uvs,
+                 const std::vector<glm::dvec3> &colors,
+                 const std::vector<int> &indices, const BoundingBox &bounds);
+
+  size_t faceCount() const {
+    return (wideIndices.empty() ? narrowIndices.size() : wideIndices.size()) /
+           3;
+  }
+  int index(size_t face, int corner) const {
+    return wideIndices.empty() ? narrowIndices[3 * face + corner]
+                               : int(wideIndices[3 * face + corner]);
+  }
+
+  glm::dvec3 position(int v) const {
+    return origin + step * glm::dvec3(positions[3 * v], positions[3 * v + 1],
+                                      positions[3 * v + 2]);
+  }
+  glm::dvec3 normal(int v) const { return decodeOctNormal(normals[v]); }
+  glm::dvec2 uv(int v) const {
+    return glm::dvec2(halfToFloat(uvs[2 * v]), halfToFloat(uvs[2 * v + 1]));
+  }
+  glm::dvec3 color(int v) const {
+    return glm::dvec3(halfToFloat(colors[3 * v]),
+                      halfToFloat(colors[3 * v + 1]),
+                      halfToFloat(colors[3 * v + 2]));
+  }
+
+  bool hasNormals() const { return !normals.empty(); }
+  bool hasUVs() const { return !uvs.empty(); }
+  bool hasColors() const { return !colors.empty(); }
+
+  // Bytes held by the attribute and index arrays.
+  size_t byteSize() const;
+
+private:
+  glm::dvec3 origin;
+  glm::dvec3 step; // local-space size of one quantization step per axis
+
+  std::vector<uint16_t> positions;
+  std::vector<uint32_t> normals;
+  std::vector<uint16_t> uvs;
+  std::vector<uint16_t> colors;
+  std::vector<uint16_t> narrowIndices;
+  std::vector<uint32_t> wideIndices;
+};
+
+#endif // MESHCOMPRESSION_H__
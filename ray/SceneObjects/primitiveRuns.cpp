@@ -0,0 +1,82 @@
+#include "primitiveRuns.h"
+
+#include <type_traits>
+#include <typeinfo>
+
+#include "Box.h"
+#include "Cone.h"
+#include "Cylinder.h"
+#include "Sphere.h"
+#include "Square.h"
+#include "trimesh.h"
+
+// Subclasses of these types may override intersectLocal, so only objects of
+// exactly the type count.
+PrimitiveType primitiveType(const Geometry *object) {
+  const std::type_info &type = typeid(*object);
+  if (type == typeid(Sphere))
+    return PrimitiveType::SPHERE;
+  if (type == typeid(Box))
+    return PrimitiveType::BOX;
+  if (type == typeid(Square))
+    return PrimitiveType::SQUARE;
+  if (type == typeid(Cylinder))
+    return PrimitiveType::CYLINDER;
+  if (type == typeid(Cone))
+    return PrimitiveType::CONE;
+  if (type == typeid(Trimesh))
+    return PrimitiveType::TRIMESH;
+  return PrimitiveType::OTHER;
+}
+
+const char *primitiveTypeName(PrimitiveType type) {
+  static const char *names[PRIMITIVE_TYPES] = {
+      "sphere", "box", "square", "cylinder", "cone", "trimesh", "other"};
+  return names[int(type)];
+}
+
+namespace {
+
+template <typename T>
+void intersectAll(const Geometry *const *objects, const uint32_t *ids,
+                  uint32_t count, ray &r, isect &i, bool &have,
+                  uint32_t &best) {
+  for (uint32_t k = 0; k < count; ++k) {
+    uint32_t id = ids[k];
+    isect cur;
+    bool hit;
+    if constexpr (std::is_same_v<T, Geometry>)
+      hit = objects[id]->intersect(r, cur);
+    else
+      hit = objects[id]->intersectAs<T>(r, cur);
+    if (hit && (!have || cur.getT() < i.getT() ||
+                (cur.getT() == i.getT() && id < best))) {
+      i = cur;
+      have = true;
+      best = id;
+    }
+  }
+}
+
+} // namespace
+
+void intersectRun(PrimitiveType type, const Geometry *const *objects,
+                  const uint32_t *ids, uint32_t count, ray &r, isect &i,
+                  bool &have, uint32_t &best) {
+  switch (type) {
+  case PrimitiveType::SPHERE:
+    return intersectAll<Sphere>(objects, ids, count, r, i, have, best);
+  case PrimitiveType::BOX:
+    return intersectAll<Box>(objects, ids, count, r, i, have, best);
+  case PrimitiveType::SQUARE:
+    return intersectAll<Square>(objects, ids, count, r, i, have, best);
+  case PrimitiveType::CYLINDER:
+    return intersectAll<Cylinder>(objects, ids, count, r, i, have, best);
+  case PrimitiveType::CONE:
+    return intersectAll<Cone>(objects, ids, count, r, i, have, best);
+  case PrimitiveType::TRIMESH:
+    return intersectAll<Trimesh>(objects, ids, count, r, i, have, best);
+  default:
+    return intersectAll<Geometry>(objects, ids, count, r, i, have, best);
+  }
+}
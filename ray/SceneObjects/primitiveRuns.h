@@ -0,0 +1,37 @@
+#ifndef PRIMITIVERUNS_H__
+#define PRIMITIVERUNS_H__
+
+#include <stdint.h>
+
+class Geometry;
+class isect;
+class ray;
+
+/* The concrete types of scene objects. A kd-tree leaf keeps its objects
+sorted by type, and intersects each run of one type with intersectRun(),
+so that the type is decided once per run instead of through two virtual
+calls (hasBoundingBoxCapability and intersectLocal) per object. */
+enum class PrimitiveType : uint8_t {
+  SPHERE,
+  BOX,
+  SQUARE,
+  CYLINDER,
+  CONE,
+  TRIMESH,
+  OTHER // anything else, which is tested through Geometry::intersect
+};
+
+constexpr int PRIMITIVE_TYPES = int(PrimitiveType::OTHER) + 1;
+
+PrimitiveType primitiveType(const Geometry *object);
+const char *primitiveTypeName(PrimitiveType type);
+
+/* Intersect r with objects[ids[k]] for k < count, which are all of `type`
+and have bounds. The nearest hit so far is in i, and `have` and `best`
+say whether there is one and the id of its object; a hit replaces it if
+it is nearer, or as near and has a lower id. */
+void intersectRun(PrimitiveType type, const Geometry *const *objects,
+                  const uint32_t *ids, uint32_t count, ray &r, isect &i,
+                  bool &have, uint32_t &best);
+
+#endif // PRIMITIVERUNS_H__
@@ -10,10 +10,8 @@ extern TraceUI *traceUI;
 
 using namespace std;
 
-Trimesh::~Trimesh() {
-  for (auto f : faces)
-    delete f;
-}
+// Faces live in faceArena and are freed with it.
+Trimesh::~Trimesh() {}
 
 // must add vertices, normals, and materials IN ORDER
 void Trimesh::addVertex(const glm::dvec3 &v) { vertices.emplace_back(v); }
@@ -25,23 +23,30 @@ void Trimesh::addColor(const glm::dvec3 &c) { vertColors.emplace_back(c); }
 void Trimesh::addUV(const glm::dvec2 &uv) { uvCoords.emplace_back(uv); }
 
 // Returns false if the vertices a,b,c don't all exist
-bool Trimesh::addFace(int a, int b, int c) {
+bool Trimesh::addFace(int a, int b, int c, int material) {
   int vcnt = vertices.size();
 
   if (a >= vcnt || b >= vcnt || c >= vcnt)
     return false;
+  if (material < 0 || (material > 0 && size_t(material) >= palette.size()))
+    return false;
 
-  TrimeshFace *newFace = new TrimeshFace(this, a, b, c);
-  if (!newFace->degen)
-    faces.push_back(newFace);
-  else
-    delete newFace;
+  TrimeshFace newFace(this, a, b, c, material);
+  if (!newFace.degen)
+    faces.push_back(faceArena.create<TrimeshFace>(newFace));
 
   // Don't add faces to the scene's object list so we can cull by bounding
   // box
   return true;
 }
 
+int Trimesh::addMaterial(const Material &m) {
+  if (palette.size() >= MAX_MATERIALS)
+    return -1;
+  palette.push_back(m);
+  return int(palette.size() - 1);
+}
+
 // Check to make sure that if we have per-vertex materials or normals
 // they are the right number.
 const char *Trimesh::doubleCheck() {
@@ -56,7 +61,12 @@ const char *Trimesh::doubleCheck() {
 }
 
 bool Trimesh::intersectLocal(ray &r, isect &i) const {
+  if (packed)
+    return intersectPacked(r, i);
+
   bool have_one = false;
+  // The mesh itself was counted by Geometry::intersect.
+  rayStats.primitiveTests += faces.size();
   for (auto face : faces) {
     isect cur;
     if (face->intersectLocal(r, cur)) {
@@ -76,16 +86,12 @@ bool TrimeshFace::intersect(ray &r, isect &i) const {
 }
 
 
-// Intersect ray r with the triangle abc.  If it hits returns true,
-// and put the parameter in t and the barycentric coordinates of the
-// intersection in u (alpha) and v (beta).
-bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
-  // Triangle vertices
-  const glm::dvec3 &A = parent->vertices[ids[0]];
-  const glm::dvec3 &B = parent->vertices[ids[1]];
-  const glm::dvec3 &C = parent->vertices[ids[2]];
-
-  // Möller–Trumbore intersection
+namespace {
+// Möller–Trumbore intersection of ray r with the triangle ABC. On a hit,
+// returns the ray parameter in t and the barycentric weights of B and C in
+// u and v.
+bool intersectTriangle(const ray &r, const glm::dvec3 &A, const glm::dvec3 &B,
+                       const glm::dvec3 &C, double &t, double &u, double &v) {
   glm::dvec3 e1 = B - A;
   glm::dvec3 e2 = C - A;
 
@@ -98,17 +104,51 @@ bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
   double invDet = 1.0 / det;
 
   glm::dvec3 tvec = r.getPosition() - A;
-  double u = glm::dot(tvec, pvec) * invDet;
+  u = glm::dot(tvec, pvec) * invDet;
   if (u < 0.0 || u > 1.0) return false;
 
   glm::dvec3 qvec = glm::cross(tvec, e1);
-  double v = glm::dot(r.getDirection(), qvec) * invDet;
+  v = glm::dot(r.getDirection(), qvec) * invDet;
   if (v < 0.0 || (u + v) > 1.0) return false;
 
-  double tHit = glm::dot(e2, qvec) * invDet;
+  t = glm::dot(e2, qvec) * invDet;
 
   // Reject hits behind the ray start or too close
-  if (tHit <= RAY_EPSILON) return false;
+  return t > RAY_EPSILON;
+}
+
+// The gradients of u and v over the plane of triangle ABC: the vectors g in
+// that plane with g . (B - A) and g . (C - A) equal to the change in the
+// coordinate along each edge.
+void setUVGradients(isect &i, const glm::dvec3 &A, const glm::dvec3 &B,
+                    const glm::dvec3 &C, const glm::dvec2 &uvA,
+                    const glm::dvec2 &uvB, const glm::dvec2 &uvC) {
+  glm::dvec3 e1 = B - A, e2 = C - A;
+  double a = glm::dot(e1, e1), b = glm::dot(e1, e2), c = glm::dot(e2, e2);
+  double det = a * c - b * b;
+  if (std::abs(det) < RAY_EPSILON * RAY_EPSILON) {
+    i.setUVGradients(glm::dvec3(0.0), glm::dvec3(0.0));
+    return;
+  }
+  glm::dvec2 d1 = uvB - uvA, d2 = uvC - uvA;
+  // Solve the 2x2 Gram system for the edge weights of each gradient.
+  glm::dvec2 w1 = (c * d1 - b * d2) / det;
+  glm::dvec2 w2 = (a * d2 - b * d1) / det;
+  i.setUVGradients(w1.x * e1 + w2.x * e2, w1.y * e1 + w2.y * e2);
+}
+} // namespace
+
+// Intersect ray r with the triangle abc.  If it hits returns true,
+// and put the parameter in t and the barycentric coordinates of the
+// intersection in u (alpha) and v (beta).
+bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
+  // Triangle vertices
+  const glm::dvec3 &A = parent->vertices[ids[0]];
+  const glm::dvec3 &B = parent->vertices[ids[1]];
+  const glm::dvec3 &C = parent->vertices[ids[2]];
+
+  double tHit, u, v;
+  if (!intersectTriangle(r, A, B, C, tHit, u, v)) return false;
 
   // Barycentric weights
   double w = 1.0 - u - v; // weight for A
@@ -125,7 +165,7 @@ bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
     const glm::dvec3 &nC = parent->normals[ids[2]];
     N = w * nA + u * nB + v * nC;
   } else {
-    N = glm::normalize(glm::cross(e1, e2));
+    N = glm::normalize(glm::cross(B - A, C - A));
   }
   i.setN(N);
 
@@ -137,9 +177,10 @@ bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
 
     glm::dvec2 uv = w * uvA + u * uvB + v * uvC;
     i.setUVCoordinates(uv);
+    setUVGradients(i, A, B, C, uvA, uvB, uvC);
 
-    // Material is parent's (texture lookup happens via MaterialParameter)
-    i.setMaterial(parent->getMaterial());
+    // Texture lookup happens via MaterialParameter
+    i.setMaterialRef(&parent->faceMaterial(material));
   }
   // Otherwise vertex colors if present
   else if (!parent->vertColors.empty()) {
@@ -148,24 +189,153 @@ bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
     const glm::dvec3 &cC = parent->vertColors[ids[2]];
     glm::dvec3 c = w * cA + u * cB + v * cC;
 
-    Material m = parent->getMaterial();   // copy the material
-    m.setDiffuse(MaterialParameter(c));
-           // override diffuse color
-    i.setMaterial(m);                      // pass by const reference
-
+    Material m = parent->faceMaterial(material); // copy the material
+    m.setDiffuse(MaterialParameter(c));           // override diffuse color
+    i.setMaterial(m);
   }
-  // Otherwise: just use parent's material
+  // Otherwise: just use the face's material
   else {
-    i.setMaterial(parent->getMaterial());
+    i.setMaterialRef(&parent->faceMaterial(material));
+  }
+
+  return true;
+}
+
+// Same as the face loop in intersectLocal, but decoding the quantized
+// geometry on the fly. Only the closest hit has its attributes decoded.
+bool Trimesh::intersectPacked(ray &r, isect &i) const {
+  const CompressedMesh &m = *packed;
+  size_t best = 0;
+  double bestT = 0.0, bestU = 0.0, bestV = 0.0;
+  bool have_one = false;
+
+  rayStats.primitiveTests += m.faceCount();
+  for (size_t f = 0; f < m.faceCount(); ++f) {
+    double t, u, v;
+    if (intersectTriangle(r, m.position(m.index(f, 0)),
+                          m.position(m.index(f, 1)),
+                          m.position(m.index(f, 2)), t, u, v) &&
+        (!have_one || t < bestT)) {
+      best = f;
+      bestT = t;
+      bestU = u;
+      bestV = v;
+      have_one = true;
+    }
+  }
+  if (!have_one) {
+    i.setT(1000.0);
+    return false;
+  }
+
+  int a = m.index(best, 0), b = m.index(best, 1), c = m.index(best, 2);
+  double w = 1.0 - bestU - bestV;
+  const Material &faceMat =
+      faceMaterial(packedMaterials.empty() ? 0 : packedMaterials[best]);
+
+  i.setT(bestT);
+  i.setObject(this);
+
+  if (vertNorms && m.hasNormals()) {
+    i.setN(w * m.normal(a) + bestU * m.normal(b) + bestV * m.normal(c));
+  } else {
+    glm::dvec3 A = m.position(a);
+    i.setN(glm::normalize(glm::cross(m.position(b) - A, m.position(c) - A)));
   }
 
+  if (m.hasUVs()) {
+    i.setUVCoordinates(w * m.uv(a) + bestU * m.uv(b) + bestV * m.uv(c));
+    setUVGradients(i, m.position(a), m.position(b), m.position(c), m.uv(a),
+                   m.uv(b), m.uv(c));
+    i.setMaterialRef(&faceMat);
+  } else if (m.hasColors()) {
+    Material mat = faceMat;
+    mat.setDiffuse(
+        MaterialParameter(w * m.color(a) + bestU * m.color(b) +
+                          bestV * m.color(c)));
+    i.setMaterial(mat);
+  } else {
+    i.setMaterialRef(&faceMat);
+  }
+  return true;
+}
+
+bool Trimesh::bakeTransform() {
+  // Only rigid transforms are baked: intersectTriangle's epsilons are in
+  // the units of the space it runs in, so a scaled mesh would stop
+  // rendering exactly as it did with the transform applied per ray.
+  double scale;
+  if (packed || !transform.uniformScale(scale) ||
+      std::abs(scale - 1) > 1e-9)
+    return false;
+  // A mirroring transform turns the winding of every face around, which
+  // would flip the face normals computed from it below.
+  bool mirrored =
+      glm::determinant(glm::dmat3(transform.transform())) < 0;
+  for (auto &v : vertices)
+    v = transform.localToGlobalCoords(v);
+  for (auto &n : normals)
+    n = transform.localToGlobalCoordsNormal(n);
+  transform = MatrixTransform();
+
+  // Face normals and bounds were computed from the old vertex positions.
+  Faces kept;
+  kept.reserve(faces.size());
+  for (auto f : faces) {
+    int b = mirrored ? 2 : 1, c = mirrored ? 1 : 2;
+    *f = TrimeshFace(this, (*f)[0], (*f)[b], (*f)[c], f->materialIndex());
+    if (!f->degen)
+      kept.push_back(f);
+  }
+  faces.swap(kept);
+  ComputeLocalBoundingBox();
   return true;
 }
 
+void Trimesh::compress() {
+  if (packed)
+    return;
+  ComputeLocalBoundingBox();
+
+  std::vector<int> indices;
+  indices.reserve(3 * faces.size());
+  for (auto face : faces) {
+    for (int k = 0; k < 3; ++k)
+      indices.push_back((*face)[k]);
+    if (!palette.empty())
+      packedMaterials.push_back(uint16_t(face->materialIndex()));
+  }
+
+  packed.reset(new CompressedMesh(vertices, vertNorms ? normals : Normals(),
+                                  uvCoords, vertColors, indices,
+                                  localBounds));
+
+  Faces().swap(faces);
+  faceArena.release();
+  Vertices().swap(vertices);
+  Normals().swap(normals);
+  UVCoords().swap(uvCoords);
+  VertColors().swap(vertColors);
+}
+
+size_t Trimesh::byteSize() const {
+  size_t materials = palette.capacity() * sizeof(Material) +
+                     packedMaterials.capacity() * sizeof(uint16_t);
+  if (packed)
+    return sizeof(*this) + materials + packed->byteSize();
+  return sizeof(*this) + materials + vertices.capacity() * sizeof(glm::dvec3) +
+         normals.capacity() * sizeof(glm::dvec3) +
+         vertColors.capacity() * sizeof(glm::dvec3) +
+         uvCoords.capacity() * sizeof(glm::dvec2) +
+         faces.capacity() * sizeof(TrimeshFace *) +
+         faceArena.bytesUsed();
+}
 
 // Once all the verts and faces are loaded, per vertex normals can be
 // generated by averaging the normals of the neighboring faces.
 void Trimesh::generateNormals() {
+  if (packed)
+    return;
   int cnt = vertices.size();
   normals.resize(cnt);
   std::vector<int> numFaces(cnt, 0);
@@ -3,12 +3,14 @@
 
 #include <list>
 #include <memory>
+#include <stdint.h>
 #include <vector>
 
 #include "../scene/kdTree.h"
 #include "../scene/material.h"
 #include "../scene/ray.h"
 #include "../scene/scene.h"
+#include "meshCompression.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/vec3.hpp>
@@ -17,6 +19,7 @@ class TrimeshFace;
 
 class Trimesh : public SceneObject {
   friend class TrimeshFace;
+  friend class BinaryScene;
   typedef std::vector<glm::dvec3> Normals;
   typedef std::vector<glm::dvec3> Vertices;
   typedef std::vector<TrimeshFace *> Faces;
@@ -30,8 +33,23 @@ class Trimesh : public SceneObject {
   UVCoords uvCoords;
   BoundingBox localBounds;
 
+  // Storage for the faces. Kept per mesh rather than in the scene's arena so
+  // that compress() can give the memory back.
+  Arena faceArena{4096};
+
+  // Per-face materials. While the palette is empty every face uses the
+  // mesh's own material; otherwise each face holds an index into it.
+  std::vector<Material> palette;
+
+  // Quantized copy of the geometry; when set, the arrays above are empty.
+  std::unique_ptr<CompressedMesh> packed;
+  // Palette index of each packed face, if there is a palette.
+  std::vector<uint16_t> packedMaterials;
+
+  bool intersectPacked(ray &r, isect &i) const;
+
 public:
-  Trimesh(Scene *scene, Material *mat, MatrixTransform transform)
+  Trimesh(Scene *scene, const Material *mat, MatrixTransform transform)
       : SceneObject(scene, mat), displayListWithMaterials(0),
         displayListWithoutMaterials(0) {
     this->transform = transform;
@@ -49,15 +67,47 @@ public:
   void addNormal(const glm::dvec3 &);
   void addColor(const glm::dvec3 &);
   void addUV(const glm::dvec2 &);
-  bool addFace(int a, int b, int c);
+  bool addFace(int a, int b, int c, int material = 0);
+
+  // Add a material to the palette and return the index to pass to addFace().
+  // Add materials before the faces that use them.
+  static constexpr size_t MAX_MATERIALS = 65536;
+  int addMaterial(const Material &m);
+  size_t materialCount() const { return palette.size(); }
+
+  // The material of a face with the given palette index.
+  const Material &faceMaterial(int index) const {
+    return palette.empty() ? getMaterial() : palette[index];
+  }
+
+  // Bulk versions of the add* methods above for loaders that already hold the
+  // whole array. The data is moved in, not copied.
+  void setVertices(std::vector<glm::dvec3> &&v) { vertices = std::move(v); }
+  void setNormals(std::vector<glm::dvec3> &&n) { normals = std::move(n); }
+  void setColors(std::vector<glm::dvec3> &&c) { vertColors = std::move(c); }
+  void setUVs(std::vector<glm::dvec2> &&uv) { uvCoords = std::move(uv); }
+  void reserveFaces(size_t n) { faces.reserve(n); }
 
   const char *doubleCheck();
 
   void generateNormals();
 
+  // Move the vertices and normals into world space (see Geometry).
+  bool bakeTransform();
+
+  // Replace the full-precision vertex data and faces with a CompressedMesh.
+  // Must be called after the mesh is complete and its bounds are computed.
+  void compress();
+  bool isCompressed() const { return packed != nullptr; }
+
+  // Approximate number of bytes used by this mesh's geometry.
+  size_t byteSize() const;
+
   bool hasBoundingBoxCapability() const { return true; }
 
   BoundingBox ComputeLocalBoundingBox() {
+    if (packed)
+      return localBounds;
     BoundingBox localbounds;
     if (vertices.size() == 0)
       return localbounds;
@@ -93,16 +143,18 @@ Trimesh object. */
 class TrimeshFace {
   Trimesh *parent;
   int ids[3];
+  uint16_t material; // index into the parent's palette
   glm::dvec3 normal;
   double dist;
   BoundingBox bounds;
 
 public:
-  TrimeshFace(Trimesh *parent, int a, int b, int c) {
+  TrimeshFace(Trimesh *parent, int a, int b, int c, int material = 0) {
     this->parent = parent;
     ids[0] = a;
     ids[1] = b;
     ids[2] = c;
+    this->material = uint16_t(material);
 
     // Compute the face normal here, not on the fly
     glm::dvec3 a_coords = parent->vertices[a];
@@ -130,6 +182,7 @@ public:
   bool degen;
 
   int operator[](int i) const { return ids[i]; }
+  int materialIndex() const { return material; }
 
   glm::dvec3 getNormal() { return normal; }
 
@@ -0,0 +1,35 @@
+#include "corpus.h"
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+std::vector<CorpusScene> findScenes(const std::vector<fs::path> &roots,
+                                    const fs::path &sceneDir) {
+  std::vector<fs::path> search = roots;
+  if (search.empty()) {
+    search.push_back(sceneDir / "ray_scenes");
+    search.push_back(sceneDir / "json_scenes");
+  }
+
+  std::vector<CorpusScene> scenes;
+  for (const fs::path &root : search) {
+    if (!fs::is_directory(root)) {
+      scenes.push_back(CorpusScene{root, root.generic_string()});
+      continue;
+    }
+    fs::path base = root.parent_path();
+    std::vector<CorpusScene> found;
+    for (const auto &entry : fs::recursive_directory_iterator(root)) {
+      std::string ext = entry.path().extension().string();
+      if (entry.is_regular_file() && (ext == ".ray" || ext == ".json"))
+        found.push_back(CorpusScene{
+            entry.path(), fs::relative(entry.path(), base).generic_string()});
+    }
+    std::sort(found.begin(), found.end(),
+              [](const CorpusScene &a, const CorpusScene &b) {
+                return a.name < b.name;
+              });
+    scenes.insert(scenes.end(), found.begin(), found.end());
+  }
+  return scenes;
+}
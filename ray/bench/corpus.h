@@ -0,0 +1,23 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// A scene file and the name it goes by in reports.
+struct CorpusScene {
+  std::filesystem::path path;
+  std::string name;
+};
+
+// Every .ray and .json file under the given files or directories, sorted by
+// name within each root. With no roots, the bundled scenes/ray_scenes and
+// scenes/json_scenes under sceneDir. A scene found under a directory is
+// named relative to that directory's parent, e.g. "ray_scenes/simple/box.ray",
+// so that reports from different checkouts line up.
+std::vector<CorpusScene>
+findScenes(const std::vector<std::filesystem::path> &roots,
+           const std::filesystem::path &sceneDir);
+
+#endif
@@ -0,0 +1,109 @@
+#include "imagediff.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// The per-channel kernel. It works on blocks small enough that the squared
+// differences fit a 32-bit sum, and keeps the loop free of branches, so that
+// the compiler runs it on packed integer SIMD registers.
+uint64_t diffChannels(const uint8_t *a, const uint8_t *b, uint8_t *diff,
+                      size_t count) {
+  constexpr size_t BLOCK = 32768; // 32768 * 255^2 < 2^32
+  uint64_t total = 0;
+  for (size_t start = 0; start < count; start += BLOCK) {
+    size_t end = std::min(start + BLOCK, count);
+    uint32_t sum = 0;
+    for (size_t i = start; i < end; ++i) {
+      int d = int(a[i]) - int(b[i]);
+      int m = d < 0 ? -d : d;
+      diff[i] = uint8_t(m);
+      sum += uint32_t(m * m);
+    }
+    total += sum;
+  }
+  return total;
+}
+
+std::vector<float> luma(const uint8_t *rgb, size_t pixels) {
+  std::vector<float> y(pixels);
+  for (size_t i = 0; i < pixels; ++i)
+    y[i] = 0.299f * rgb[3 * i] + 0.587f * rgb[3 * i + 1] +
+           0.114f * rgb[3 * i + 2];
+  return y;
+}
+
+// SSIM (Wang et al. 2004) over 8x8 windows, 4 pixels apart, of the luma.
+double meanSSIM(const uint8_t *a, const uint8_t *b, int width, int height) {
+  constexpr int WINDOW = 8, STEP = 4;
+  const double C1 = (0.01 * 255) * (0.01 * 255);
+  const double C2 = (0.03 * 255) * (0.03 * 255);
+
+  std::vector<float> ya = luma(a, size_t(width) * height);
+  std::vector<float> yb = luma(b, size_t(width) * height);
+  int w = std::min(WINDOW, width), h = std::min(WINDOW, height);
+  double total = 0;
+  int windows = 0;
+  for (int y0 = 0; y0 + h <= height; y0 += STEP) {
+    for (int x0 = 0; x0 + w <= width; x0 += STEP) {
+      double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+      for (int y = y0; y < y0 + h; ++y) {
+        for (int x = x0; x < x0 + w; ++x) {
+          double pa = ya[size_t(y) * width + x], pb = yb[size_t(y) * width + x];
+          sa += pa;
+          sb += pb;
+          saa += pa * pa;
+          sbb += pb * pb;
+          sab += pa * pb;
+        }
+      }
+      double n = w * h;
+      double ma = sa / n, mb = sb / n;
+      double va = saa / n - ma * ma, vb = sbb / n - mb * mb;
+      double cov = sab / n - ma * mb;
+      total += ((2 * ma * mb + C1) * (2 * cov + C2)) /
+               ((ma * ma + mb * mb + C1) * (va + vb + C2));
+      ++windows;
+    }
+  }
+  return windows ? total / windows : 1.0;
+}
+
+} // namespace
+
+ImageDiff compareImages(const uint8_t *a, const uint8_t *b, int width,
+                        int height) {
+  size_t pixels = size_t(width) * height;
+  std::vector<uint8_t> diff(pixels * 3);
+  uint64_t squares = diffChannels(a, b, diff.data(), diff.size());
+
+  ImageDiff result;
+  result.heat.resize(pixels);
+  result.changed = 0;
+  result.maxDiff = 0;
+  for (size_t i = 0; i < pixels; ++i) {
+    uint8_t m = std::max({diff[3 * i], diff[3 * i + 1], diff[3 * i + 2]});
+    result.heat[i] = m;
+    result.changed += m != 0;
+    result.maxDiff = std::max(result.maxDiff, int(m));
+  }
+
+  double mse = double(squares) / double(std::max<size_t>(diff.size(), 1));
+  result.psnr = mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse)
+                        : std::numeric_limits<double>::infinity();
+  result.ssim = meanSSIM(a, b, width, height);
+  return result;
+}
+
+std::vector<uint8_t> heatmap(const std::vector<uint8_t> &heat, int scale) {
+  std::vector<uint8_t> rgb(heat.size() * 3);
+  for (size_t i = 0; i < heat.size(); ++i) {
+    // 0..3 across black -> red -> yellow -> white
+    float t = std::min(3.0f * heat[i] / float(std::max(scale, 1)), 3.0f);
+    rgb[3 * i] = uint8_t(255 * std::min(t, 1.0f));
+    rgb[3 * i + 1] = uint8_t(255 * std::clamp(t - 1, 0.0f, 1.0f));
+    rgb[3 * i + 2] = uint8_t(255 * std::clamp(t - 2, 0.0f, 1.0f));
+  }
+  return rgb;
+}
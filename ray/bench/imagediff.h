@@ -0,0 +1,26 @@
+#ifndef BENCH_IMAGEDIFF_H
+#define BENCH_IMAGEDIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// How far apart two 8-bit RGB images of the same size are.
+struct ImageDiff {
+  double psnr;     // over all channels, in dB; infinite for equal images
+  double ssim;     // mean SSIM of the luma, 1 for equal images
+  int maxDiff;     // the largest difference of any channel
+  size_t changed;  // pixels with any channel different
+  // Per pixel, the largest difference of its channels
+  std::vector<uint8_t> heat;
+};
+
+ImageDiff compareImages(const uint8_t *a, const uint8_t *b, int width,
+                        int height);
+
+// heat as an RGB image: black where the pixels agree, through red and
+// yellow to white at `scale` levels apart or more.
+std::vector<uint8_t> heatmap(const std::vector<uint8_t> &heat,
+                             int scale = 32);
+
+#endif
@@ -0,0 +1,316 @@
+//
+// ray_bench.cpp
+//
+// Renders every scene of the bundled corpus at fixed settings and reports
+// how long each took as JSON, so that two builds can be compared:
+//
+//   ray_bench [options] [scene files or directories...]
+//
+// With no scenes given it walks scenes/ray_scenes and scenes/json_scenes.
+// Each scene is rendered `warmup` times untimed and then `runs` times; the
+// report has the min, median and mean of every phase over the timed runs:
+//
+//   parse   reading the file into a Scene
+//   build   Scene::finalize (textures, transforms, bounds) and compression
+//   render  traceImage, plus aaImage when antialiasing is on
+//   wall    all of the above
+//
+// and the number of rays of each type one render creates. Scenes that fail
+// to load are listed with the error instead of timings.
+//
+// With -z every scene is benchmarked a second time with compress_meshes on,
+// and its entry gets a "compressed" object: the timings of those runs, the
+// mesh bytes before and after, their ratio, and the slowdown (compressed
+// render median over uncompressed render median).
+//
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+extern char *optarg;
+extern int optind;
+extern int getopt(int argc, char **argv, const char *optstring);
+#endif
+
+#include <json.hpp>
+
+#include "../RayTracer.h"
+#include "../scene/ray.h"
+#include "../ui/TraceUI.h"
+#include "corpus.h"
+
+using Json = nlohmann::json;
+using std::string;
+namespace fs = std::filesystem;
+
+RayTracer *theRayTracer;
+TraceUI *traceUI;
+int TraceUI::m_threads = std::max(std::thread::hardware_concurrency(), 1u);
+int TraceUI::rayCount[MAX_THREADS];
+unsigned long long TraceUI::rayTypeCount[MAX_THREADS][TraceUI::RAY_TYPES];
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char *rayTypeNames[TraceUI::RAY_TYPES] = {"visibility", "reflection",
+                                                "refraction", "shadow"};
+
+double seconds(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double>(to - from).count();
+}
+
+Json summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (double s : samples)
+    sum += s;
+  size_t n = samples.size();
+  double median = n % 2 ? samples[n / 2]
+                        : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+  return Json{{"min", samples.front()},
+              {"median", median},
+              {"mean", sum / n}};
+}
+
+class BenchUI : public TraceUI {
+public:
+  BenchUI(int argc, char **argv);
+  int run();
+  void alert(const string &msg) { lastError = msg; }
+
+private:
+  void usage();
+  Json benchScene(const fs::path &file, const string &name, bool compress);
+
+  const char *progName;
+  const char *outName = nullptr;
+  int runs = 3;
+  int warmup = 1;
+  bool compareCompression = false;
+  std::vector<CorpusScene> scenes;
+  string lastError;
+};
+
+BenchUI::BenchUI(int argc, char **argv) : TraceUI() {
+  progName = argv[0];
+  // Small enough that the whole corpus finishes in minutes.
+  m_nSize = 128;
+  m_nDepth = 3;
+
+  const char *jsonfile = nullptr;
+  int i;
+  while ((i = getopt(argc, argv, "w:r:n:u:j:o:zh")) != EOF) {
+    switch (i) {
+    case 'w':
+      m_nSize = atoi(optarg);
+      break;
+    case 'r':
+      m_nDepth = atoi(optarg);
+      break;
+    case 'n':
+      runs = std::max(atoi(optarg), 1);
+      break;
+    case 'u':
+      warmup = std::max(atoi(optarg), 0);
+      break;
+    case 'j':
+      jsonfile = optarg;
+      break;
+    case 'o':
+      outName = optarg;
+      break;
+    case 'z':
+      compareCompression = true;
+      break;
+    case 'h':
+      usage();
+      exit(0);
+    default:
+      usage();
+      exit(1);
+    }
+  }
+  if (jsonfile)
+    loadFromJson(jsonfile);
+
+  std::vector<fs::path> roots;
+  for (int a = optind; a < argc; ++a)
+    roots.push_back(argv[a]);
+  scenes = findScenes(roots, RAY_BENCH_SCENES);
+}
+
+void BenchUI::usage() {
+  using namespace std;
+  cerr << "usage: " << progName << " [options] [scene files or directories]"
+       << endl
+       << "  -w <#>      image width (default " << m_nSize << ")" << endl
+       << "  -r <#>      recursion depth (default " << m_nDepth << ")" << endl
+       << "  -n <#>      timed runs per scene (default " << runs << ")" << endl
+       << "  -u <#>      untimed warm-up runs per scene (default " << warmup
+       << ")" << endl
+       << "  -j <FILE>   set render parameters from JSON file" << endl
+       << "  -o <FILE>   write the report there instead of to stdout" << endl
+       << "  -z          also run with compressed meshes and compare" << endl;
+}
+
+Json BenchUI::benchScene(const fs::path &file, const string &name,
+                         bool compress) {
+  std::vector<double> parse, build, render, wall;
+  Json rays;
+  int width = 0, height = 0;
+  RayTracer::MeshSizes meshSizes;
+  m_compressMeshes = compress;
+
+  for (int r = 0; r < warmup + runs; ++r) {
+    RayTracer tracer;
+    theRayTracer = &tracer;
+    setRayTracer(&tracer);
+
+    Clock::time_point start = Clock::now();
+    lastError.clear();
+    if (!tracer.loadScene(file.string().c_str()))
+      return Json{{"scene", name},
+                  {"error", lastError.empty() ? "unable to load" : lastError}};
+
+    width = m_nSize;
+    height = (int)(width / tracer.aspectRatio() + 0.5);
+    resetTypeCounts();
+    Clock::time_point loaded = Clock::now();
+    tracer.traceSetup(width, height);
+    tracer.traceImage(width, height);
+    tracer.waitRender();
+    if (aaSwitch()) {
+      tracer.aaImage();
+      tracer.waitRender();
+    }
+    Clock::time_point end = Clock::now();
+
+    if (r < warmup)
+      continue;
+    parse.push_back(tracer.getLoadTimes().parse);
+    build.push_back(tracer.getLoadTimes().build);
+    render.push_back(seconds(loaded, end));
+    wall.push_back(seconds(start, end));
+    meshSizes = tracer.getMeshSizes();
+
+    // Every run traces the same rays; keep the counts of the last one.
+    rays = Json::object();
+    unsigned long long total = 0;
+    for (int t = 0; t < RAY_TYPES; ++t) {
+      rays[rayTypeNames[t]] = getTypeCount(t);
+      total += getTypeCount(t);
+    }
+    rays["total"] = total;
+  }
+  setRayTracer(nullptr);
+  theRayTracer = nullptr;
+
+  Json result{{"scene", name},
+              {"width", width},
+              {"height", height},
+              {"parse", summarize(parse)},
+              {"build", summarize(build)},
+              {"render", summarize(render)},
+              {"wall", summarize(wall)},
+              {"rays", rays}};
+  double renderTime = result["render"]["median"];
+  Json rate = Json::object();
+  for (auto it = rays.begin(); it != rays.end(); ++it)
+    rate[it.key()] = renderTime > 0 ? it.value().get<double>() / renderTime
+                                    : 0.0;
+  result["rays_per_second"] = rate;
+  if (compress)
+    result["meshes"] = Json{{"count", meshSizes.meshes},
+                            {"bytes_before", meshSizes.before},
+                            {"bytes_after", meshSizes.after}};
+  return result;
+}
+
+int BenchUI::run() {
+  Json report;
+  report["settings"] = Json{{"width", m_nSize},
+                            {"depth", m_nDepth},
+                            {"runs", runs},
+                            {"warmup", warmup},
+                            {"compare_compression", compareCompression},
+                            {"anti_alias", aaSwitch()},
+                            {"supersamples", getSuperSamples()},
+                            {"threads", getThreads()}};
+
+  Clock::time_point start = Clock::now();
+  Json results = Json::array();
+  int failed = 0;
+  // -j may have turned compression on; without -z it stays as given.
+  bool compress = compressMeshes() && !compareCompression;
+  for (const CorpusScene &scene : scenes) {
+    Json result = benchScene(scene.path, scene.name, compress);
+    if (compareCompression && !result.contains("error")) {
+      Json packed = benchScene(scene.path, scene.name, true);
+      if (packed.contains("error")) {
+        result["compressed"] = Json{{"error", packed["error"]}};
+      } else {
+        Json compressed{{"parse", packed["parse"]},
+                        {"build", packed["build"]},
+                        {"render", packed["render"]},
+                        {"wall", packed["wall"]},
+                        {"meshes", packed["meshes"]}};
+        // Without meshes the two runs are the same render; their ratio
+        // would only be noise.
+        double before = packed["meshes"]["bytes_before"];
+        double after = packed["meshes"]["bytes_after"];
+        double plain = result["render"]["median"];
+        double slow = packed["render"]["median"];
+        if (after > 0 && plain > 0) {
+          compressed["size_ratio"] = before / after;
+          compressed["slowdown"] = slow / plain;
+        }
+        result["compressed"] = compressed;
+      }
+    }
+    if (result.contains("error")) {
+      ++failed;
+      std::cerr << scene.name << ": " << result["error"].get<string>()
+                << std::endl;
+    } else {
+      std::cerr << scene.name << ": "
+                << result["wall"]["median"].get<double>() << " s";
+      if (result.contains("compressed") &&
+          result["compressed"].contains("slowdown"))
+        std::cerr << ", compressed x"
+                  << result["compressed"]["slowdown"].get<double>();
+      std::cerr << std::endl;
+    }
+    results.push_back(result);
+  }
+  report["scenes"] = results;
+  report["failed"] = failed;
+  report["total_seconds"] = seconds(start, Clock::now());
+
+  if (outName) {
+    std::ofstream out(outName);
+    if (!(out << report.dump(2) << std::endl)) {
+      std::cerr << "Unable to write " << outName << std::endl;
+      return 1;
+    }
+  } else {
+    std::cout << report.dump(2) << std::endl;
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  BenchUI ui(argc, argv);
+  traceUI = &ui;
+  return ui.run();
+}
@@ -0,0 +1,249 @@
+//
+// ray_microbench.cpp
+//
+// Times each intersection kernel on its own:
+//
+//   ray_microbench [-n rays] [-r rounds] [-s seed] [-o report.json]
+//
+// For every primitive (in its local space, so no transforms are involved)
+// two batches of rays are generated from a fixed seed: "hit", aimed at the
+// middle of the primitive's bounds, and "miss", aimed across a region four
+// times their size. Each batch is intersected `rounds` times; the report has
+// the median nanoseconds per test and the fraction of rays that hit.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+extern char *optarg;
+extern int optind;
+extern int getopt(int argc, char **argv, const char *optstring);
+#endif
+
+#include <json.hpp>
+
+#include "../RayTracer.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+#include "../scene/bbox.h"
+#include "../scene/material.h"
+#include "../scene/ray.h"
+#include "../ui/TraceUI.h"
+
+using Json = nlohmann::json;
+using std::string;
+
+RayTracer *theRayTracer;
+TraceUI *traceUI;
+int TraceUI::m_threads = 1;
+int TraceUI::rayCount[MAX_THREADS];
+unsigned long long TraceUI::rayTypeCount[MAX_THREADS][TraceUI::RAY_TYPES];
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The kernels read a few settings (e.g. smooth shading) through traceUI;
+// the defaults are what a render would use.
+class MicroUI : public TraceUI {
+public:
+  int run() { return 0; }
+  void alert(const string &msg) { std::cerr << msg << std::endl; }
+};
+
+struct Kernel {
+  string name;
+  BoundingBox bounds;
+  // Returns whether r hits; the t of the hit goes to t.
+  std::function<bool(ray &r, double &t)> test;
+};
+
+// Rays from a sphere of radius 4 around the bounds towards points spread
+// uniformly over the bounds scaled by `spread` about their centre.
+std::vector<ray> makeRays(const BoundingBox &bounds, double spread,
+                          size_t count, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> unit(-1.0, 1.0);
+  glm::dvec3 centre = (bounds.getMin() + bounds.getMax()) * 0.5;
+  glm::dvec3 half = (bounds.getMax() - bounds.getMin()) * 0.5 * spread;
+
+  std::vector<ray> rays;
+  rays.reserve(count);
+  while (rays.size() < count) {
+    glm::dvec3 from(unit(rng), unit(rng), unit(rng));
+    double length = glm::length(from);
+    if (length < 1e-3 || length > 1)
+      continue;
+    from = centre + from * (4.0 / length);
+    glm::dvec3 to = centre + half * glm::dvec3(unit(rng), unit(rng), unit(rng));
+    rays.emplace_back(from, glm::normalize(to - from), glm::dvec3(1.0),
+                      ray::VISIBILITY);
+  }
+  return rays;
+}
+
+struct Result {
+  double nsPerTest;
+  double hitRate;
+};
+
+Result measure(const Kernel &kernel, std::vector<ray> &rays, int rounds) {
+  std::vector<double> times;
+  size_t hits = 0;
+  double sink = 0;
+  for (int r = 0; r < rounds; ++r) {
+    hits = 0;
+    Clock::time_point start = Clock::now();
+    for (ray &each : rays) {
+      double t = 0;
+      if (kernel.test(each, t)) {
+        ++hits;
+        sink += t;
+      }
+    }
+    times.push_back(
+        std::chrono::duration<double, std::nano>(Clock::now() - start)
+            .count() /
+        rays.size());
+  }
+  // Keeps the compiler from dropping the loop; never true in practice.
+  if (sink < 0)
+    std::cerr << sink << std::endl;
+  std::sort(times.begin(), times.end());
+  return Result{times[times.size() / 2], double(hits) / rays.size()};
+}
+
+// intersectLocal of any primitive, as the scene would call it.
+template <typename Object> Kernel objectKernel(const string &name,
+                                               Object *object) {
+  return Kernel{name, object->ComputeLocalBoundingBox(),
+                [object](ray &r, double &t) {
+                  isect i;
+                  if (!object->intersectLocal(r, i))
+                    return false;
+                  t = i.getT();
+                  return true;
+                }};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t count = 1 << 16;
+  int rounds = 15;
+  unsigned seed = 1;
+  const char *outName = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:s:o:h")) != EOF) {
+    switch (opt) {
+    case 'n':
+      count = std::max(atoi(optarg), 1);
+      break;
+    case 'r':
+      rounds = std::max(atoi(optarg), 1);
+      break;
+    case 's':
+      seed = unsigned(atoi(optarg));
+      break;
+    case 'o':
+      outName = optarg;
+      break;
+    default:
+      std::cerr << "usage: " << argv[0]
+                << " [-n rays] [-r rounds] [-s seed] [-o report.json]"
+                << std::endl;
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  MicroUI ui;
+  traceUI = &ui;
+
+  Material material;
+  Sphere sphere(nullptr, &material);
+  Box box(nullptr, &material);
+  Square square(nullptr, &material);
+  Cylinder cylinder(nullptr, &material);
+  Cone cone(nullptr, &material, 1.0, 1.0, 0.0, true);
+
+  // A single triangle, both as stored and quantized by compress().
+  auto triangle = [&]() {
+    auto mesh = std::make_unique<Trimesh>(nullptr, &material,
+                                          MatrixTransform());
+    mesh->addVertex(glm::dvec3(-0.5, -0.5, 0.0));
+    mesh->addVertex(glm::dvec3(0.5, -0.5, 0.0));
+    mesh->addVertex(glm::dvec3(0.0, 0.5, 0.0));
+    mesh->addFace(0, 1, 2);
+    mesh->ComputeLocalBoundingBox();
+    return mesh;
+  };
+  std::unique_ptr<Trimesh> face = triangle();
+  std::unique_ptr<Trimesh> packedFace = triangle();
+  packedFace->compress();
+
+  BoundingBox unitBox(glm::dvec3(-0.5), glm::dvec3(0.5));
+
+  std::vector<Kernel> kernels = {
+      objectKernel("sphere", &sphere),
+      objectKernel("box", &box),
+      objectKernel("square", &square),
+      objectKernel("cylinder", &cylinder),
+      objectKernel("cone", &cone),
+      objectKernel("trimesh face", face.get()),
+      objectKernel("trimesh face (compressed)", packedFace.get()),
+      Kernel{"bounding box", unitBox,
+             [&unitBox](ray &r, double &t) {
+               double tMax;
+               return unitBox.intersect(r, t, tMax);
+             }},
+  };
+
+  Json results = Json::array();
+  std::cout << std::left << std::setw(28) << "kernel" << std::setw(7)
+            << "mix" << std::right << std::setw(10) << "ns/test"
+            << std::setw(10) << "hit rate" << std::endl;
+  for (const Kernel &kernel : kernels) {
+    for (const char *mix : {"hit", "miss"}) {
+      double spread = mix[0] == 'h' ? 0.5 : 4.0;
+      std::vector<ray> rays = makeRays(kernel.bounds, spread, count, seed);
+      Result result = measure(kernel, rays, rounds);
+      std::cout << std::left << std::setw(28) << kernel.name << std::setw(7)
+                << mix << std::right << std::fixed << std::setprecision(2)
+                << std::setw(10) << result.nsPerTest << std::setw(10)
+                << result.hitRate << std::endl;
+      results.push_back(Json{{"kernel", kernel.name},
+                             {"mix", mix},
+                             {"ns_per_test", result.nsPerTest},
+                             {"hit_rate", result.hitRate}});
+    }
+  }
+
+  if (outName) {
+    Json report{{"rays", count},
+                {"rounds", rounds},
+                {"seed", seed},
+                {"results", results}};
+    std::ofstream out(outName);
+    if (!(out << report.dump(2) << std::endl)) {
+      std::cerr << "Unable to write " << outName << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
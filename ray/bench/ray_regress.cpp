@@ -0,0 +1,258 @@
+//
+// ray_regress.cpp
+//
+// Renders every scene with our ray and with the reference solution at the
+// same settings, and reports how far apart the images are and how the
+// times compare:
+//
+//   ray_regress [options] [scene files or directories...]
+//
+// Scenes are found as in ray_bench. For each one the output directory gets
+// both renders and a heatmap of where they differ (ours/, reference/ and
+// heat/), and report.json gets:
+//
+//   psnr, ssim        of our image against the reference (psnr is null
+//                     when they are identical)
+//   max_diff,         the largest channel difference, and how many pixels
+//   changed_pixels    differ at all
+//   ours_seconds,     wall time of each binary, process start to exit
+//   reference_seconds
+//   speedup           reference_seconds / ours_seconds
+//
+// The exit status is 1, so that the driver can gate a change, if any scene
+// fails for us or falls below the PSNR threshold, if the reference fails on
+// a scene that we render (nothing was checked), or if no scene was
+// compared at all.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+extern char *optarg;
+extern int optind;
+extern int getopt(int argc, char **argv, const char *optstring);
+#endif
+
+#include <json.hpp>
+
+#include "../fileio/images.h"
+#include "corpus.h"
+#include "imagediff.h"
+
+using Json = nlohmann::json;
+using std::string;
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  string ours = RAY_REGRESS_OURS;
+  string reference = RAY_REGRESS_REFERENCE;
+  string config;
+  fs::path outDir = "regress";
+  int width = 150;
+  int depth = 3;
+  double minPSNR = 40;
+};
+
+string quote(const string &s) {
+  string q = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      q += '\\';
+    q += c;
+  }
+  return q + "\"";
+}
+
+// Run one binary on a scene; returns its wall time, or a negative number if
+// it failed or wrote no image.
+double render(const Options &opt, const string &binary, const fs::path &scene,
+              const fs::path &image, const fs::path &log) {
+  string command = quote(binary) + " -r " + std::to_string(opt.depth) +
+                   " -w " + std::to_string(opt.width);
+  if (!opt.config.empty())
+    command += " -j " + quote(opt.config);
+  command += " " + quote(scene.string()) + " " + quote(image.string()) +
+             " > " + quote(log.string()) + " 2>&1";
+
+  fs::remove(image);
+  Clock::time_point start = Clock::now();
+  int status = std::system(command.c_str());
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return status == 0 && fs::exists(image) ? seconds : -1;
+}
+
+void usage(const char *progName, const Options &opt) {
+  using namespace std;
+  cerr << "usage: " << progName << " [options] [scene files or directories]"
+       << endl
+       << "  -w <#>      image width (default " << opt.width << ")" << endl
+       << "  -r <#>      recursion depth (default " << opt.depth << ")" << endl
+       << "  -j <FILE>   JSON parameters passed to both binaries" << endl
+       << "  -b <FILE>   our ray binary (default " << opt.ours << ")" << endl
+       << "  -R <FILE>   the reference binary (default " << opt.reference
+       << ")" << endl
+       << "  -o <DIR>    where images and report.json go (default "
+       << opt.outDir << ")" << endl
+       << "  -t <dB>     lowest PSNR that passes (default " << opt.minPSNR
+       << ")" << endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  int i;
+  while ((i = getopt(argc, argv, "w:r:j:b:R:o:t:h")) != EOF) {
+    switch (i) {
+    case 'w':
+      opt.width = atoi(optarg);
+      break;
+    case 'r':
+      opt.depth = atoi(optarg);
+      break;
+    case 'j':
+      opt.config = optarg;
+      break;
+    case 'b':
+      opt.ours = optarg;
+      break;
+    case 'R':
+      opt.reference = optarg;
+      break;
+    case 'o':
+      opt.outDir = optarg;
+      break;
+    case 't':
+      opt.minPSNR = atof(optarg);
+      break;
+    case 'h':
+      usage(argv[0], opt);
+      return 0;
+    default:
+      usage(argv[0], opt);
+      return 1;
+    }
+  }
+
+  std::vector<fs::path> roots;
+  for (int a = optind; a < argc; ++a)
+    roots.push_back(argv[a]);
+  std::vector<CorpusScene> scenes = findScenes(roots, RAY_BENCH_SCENES);
+
+  for (const char *dir : {"ours", "reference", "heat"})
+    fs::create_directories(opt.outDir / dir);
+
+  Json results = Json::array();
+  int failed = 0, compared = 0, referenceFailed = 0;
+  double logSpeedup = 0, worstPSNR = INFINITY, worstSSIM = 1;
+  for (const CorpusScene &scene : scenes) {
+    string file = scene.name;
+    std::replace(file.begin(), file.end(), '/', '_');
+    fs::path ours = opt.outDir / "ours" / (file + ".png");
+    fs::path reference = opt.outDir / "reference" / (file + ".png");
+    fs::path heat = opt.outDir / "heat" / (file + ".png");
+    Json result{{"scene", scene.name}};
+
+    double refTime = render(opt, opt.reference, scene.path, reference,
+                            opt.outDir / "reference" / (file + ".log"));
+    double ourTime = render(opt, opt.ours, scene.path, ours,
+                            opt.outDir / "ours" / (file + ".log"));
+    int w1, h1, w2, h2;
+    std::vector<uint8_t> a, b;
+    if (refTime >= 0)
+      b = readImage(reference.string().c_str(), w2, h2);
+    if (ourTime >= 0)
+      a = readImage(ours.string().c_str(), w1, h1);
+
+    if (b.empty() && a.empty()) {
+      result["error"] = "both failed";
+      ++failed;
+    } else if (b.empty()) {
+      // Nothing to hold us to.
+      result["error"] = "reference failed";
+      ++referenceFailed;
+    } else if (a.empty()) {
+      result["error"] = "ours failed";
+      ++failed;
+    } else if (w1 != w2 || h1 != h2) {
+      result["error"] = "image sizes differ";
+      ++failed;
+    } else {
+      ImageDiff diff = compareImages(a.data(), b.data(), w1, h1);
+      std::vector<uint8_t> map = heatmap(diff.heat);
+      writeImage(heat.string().c_str(), w1, h1, map.data());
+
+      result["psnr"] = diff.psnr; // inf is written as null
+      result["ssim"] = diff.ssim;
+      result["max_diff"] = diff.maxDiff;
+      result["changed_pixels"] = diff.changed;
+      result["ours_seconds"] = ourTime;
+      result["reference_seconds"] = refTime;
+      result["speedup"] = refTime / ourTime;
+      result["heatmap"] = heat.generic_string();
+      ++compared;
+      logSpeedup += std::log(refTime / ourTime);
+      worstPSNR = std::min(worstPSNR, diff.psnr);
+      worstSSIM = std::min(worstSSIM, diff.ssim);
+      if (diff.psnr < opt.minPSNR) {
+        result["error"] = "below PSNR threshold";
+        ++failed;
+      }
+    }
+
+    std::cerr << scene.name << ": ";
+    if (result.contains("psnr"))
+      std::cerr << "PSNR " << result["psnr"].get<double>() << " dB, SSIM "
+                << result["ssim"].get<double>() << ", speedup "
+                << result["speedup"].get<double>();
+    if (result.contains("error"))
+      std::cerr << (result.contains("psnr") ? " " : "")
+                << result["error"].get<string>();
+    std::cerr << std::endl;
+    results.push_back(result);
+  }
+
+  Json report;
+  report["settings"] = Json{{"width", opt.width},
+                            {"depth", opt.depth},
+                            {"config", opt.config},
+                            {"ours", opt.ours},
+                            {"reference", opt.reference},
+                            {"min_psnr", opt.minPSNR}};
+  report["scenes"] = results;
+  report["compared"] = compared;
+  report["failed"] = failed;
+  report["reference_failed"] = referenceFailed;
+  if (compared) {
+    report["worst_psnr"] = worstPSNR;
+    report["worst_ssim"] = worstSSIM;
+    report["geomean_speedup"] = std::exp(logSpeedup / compared);
+  }
+
+  std::ofstream out(opt.outDir / "report.json");
+  out << report.dump(2) << std::endl;
+  std::cerr << compared << " compared, " << failed << " failed";
+  if (referenceFailed)
+    std::cerr << ", reference failed on " << referenceFailed;
+  if (compared)
+    std::cerr << ", speedup " << report["geomean_speedup"].get<double>();
+  std::cerr << std::endl;
+  if (!compared)
+    std::cerr << "Nothing was compared; is the reference binary runnable?"
+              << std::endl;
+  return failed || referenceFailed || !compared ? 1 : 0;
+}
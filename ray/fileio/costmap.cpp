@@ -0,0 +1,65 @@
+#include "costmap.h"
+#include "hdrimage.h"
+#include "images.h"
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+
+namespace {
+
+const char *suffixes[COST_CHANNELS] = {".rays.png", ".boxes.png",
+                                       ".prims.png", ".time.png"};
+const char *channelNames[COST_CHANNELS] = {"rays", "box_tests",
+                                           "primitive_tests", "seconds"};
+
+// Dark blue, blue, cyan, yellow, red, evenly spaced over [0, 1].
+void falseColour(float v, uint8_t *rgb) {
+  static const float stops[][3] = {{0, 0, 0.3f},
+                                   {0, 0, 1},
+                                   {0, 1, 1},
+                                   {1, 1, 0},
+                                   {1, 0, 0}};
+  constexpr int last = sizeof(stops) / sizeof(stops[0]) - 1;
+  float x = std::min(std::max(v, 0.0f), 1.0f) * last;
+  int s = std::min(int(x), last - 1);
+  float f = x - s;
+  for (int c = 0; c < 3; ++c)
+    rgb[c] = uint8_t(255 * (stops[s][c] * (1 - f) + stops[s + 1][c] * f));
+}
+
+} // namespace
+
+void writeCostMaps(const char *imgName, int width, int height,
+                   const float *costs) {
+  string base(imgName);
+  size_t dot = base.find_last_of('.');
+  size_t slash = base.find_last_of("\\/");
+  if (dot != string::npos && (slash == string::npos || dot > slash))
+    base.erase(dot);
+
+  size_t pixels = size_t(width) * height;
+  std::vector<float> values(pixels);
+  std::vector<uint8_t> rgb(pixels * 3);
+  for (int c = 0; c < COST_CHANNELS; ++c) {
+    for (size_t p = 0; p < pixels; ++p)
+      values[p] = costs[p * COST_CHANNELS + c];
+    float top = 0;
+    if (pixels > 0) {
+      std::vector<float> sorted(values);
+      auto nth = sorted.begin() + (pixels - 1) * 99 / 100;
+      std::nth_element(sorted.begin(), nth, sorted.end());
+      top = *nth;
+    }
+    for (size_t p = 0; p < pixels; ++p)
+      falseColour(top > 0 ? values[p] / top : 0, &rgb[p * 3]);
+    writeImage((base + suffixes[c]).c_str(), width, height, rgb.data());
+  }
+
+  std::vector<EXRChannel> channels;
+  for (int c = 0; c < COST_CHANNELS; ++c)
+    channels.push_back(EXRChannel{channelNames[c], costs + c, COST_CHANNELS});
+  writeEXR((base + ".cost.exr").c_str(), width, height, channels);
+}
@@ -0,0 +1,28 @@
+#ifndef FILEIO_COSTMAP_H
+#define FILEIO_COSTMAP_H
+
+/*
+ * The per-pixel cost of a render, as RayTracer records it when "cost_maps"
+ * is on: COST_CHANNELS floats per pixel, rows bottom to top.
+ */
+enum CostChannel {
+  COST_RAYS,            // rays cast through Scene::intersect
+  COST_BOX_TESTS,       // bounding box tests
+  COST_PRIMITIVE_TESTS, // object and triangle tests
+  COST_SECONDS,         // wall time spent on the pixel
+  COST_CHANNELS
+};
+
+/*
+ * Write the maps next to the image imgName: a false colour PNG per channel
+ * (<base>.rays.png, .boxes.png, .prims.png and .time.png, where base is
+ * imgName without its extension), and the raw values of all of them as
+ * float channels of <base>.cost.exr. Each PNG runs from dark blue for no
+ * cost through cyan and yellow to red at the 99th percentile of its channel,
+ * so that a few very expensive pixels don't wash out the rest. Throws a
+ * string if a file can't be written.
+ */
+void writeCostMaps(const char *imgName, int width, int height,
+                   const float *costs);
+
+#endif
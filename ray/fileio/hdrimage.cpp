@@ -0,0 +1,341 @@
+#include "hdrimage.h"
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+using std::string;
+
+namespace {
+
+bool littleEndian() {
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t *>(&one) == 1;
+}
+
+uint32_t swap32(uint32_t v) {
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+// Closes the file on every way out of a reader or writer.
+struct File {
+  FILE *fp;
+  File(const char *fname, const char *mode) : fp(fopen(fname, mode)) {}
+  ~File() {
+    if (fp)
+      fclose(fp);
+  }
+};
+
+/*
+ * EXR
+ *
+ * All numbers in the file are little-endian. The writer assembles the whole
+ * file in memory and the reader takes it in whole, which keeps both simple;
+ * these images are the size of a framebuffer.
+ */
+
+const uint32_t EXR_MAGIC = 20000630;
+enum { EXR_HALF = 1, EXR_FLOAT = 2 };
+
+class Out {
+public:
+  std::vector<uint8_t> bytes;
+
+  void u8(uint8_t v) { bytes.push_back(v); }
+  void u32(uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+      u8(uint8_t(v >> (8 * i)));
+  }
+  void u64(uint64_t v) {
+    u32(uint32_t(v));
+    u32(uint32_t(v >> 32));
+  }
+  void f32(float f) {
+    uint32_t v;
+    memcpy(&v, &f, 4);
+    u32(v);
+  }
+  void str(const char *s) { bytes.insert(bytes.end(), s, s + strlen(s) + 1); }
+  void attribute(const char *name, const char *type, uint32_t size) {
+    str(name);
+    str(type);
+    u32(size);
+  }
+};
+
+class In {
+public:
+  In(const std::vector<uint8_t> &bytes) : bytes(bytes) {}
+
+  bool ok() const { return good; }
+  size_t tell() const { return pos; }
+  void seek(size_t to) {
+    pos = to;
+    check(0);
+  }
+
+  uint8_t u8() { return check(1) ? bytes[pos++] : 0; }
+  uint32_t u32() {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+      v |= uint32_t(u8()) << (8 * i);
+    return v;
+  }
+  uint64_t u64() {
+    uint64_t lo = u32();
+    return lo | uint64_t(u32()) << 32;
+  }
+  float f32() {
+    uint32_t v = u32();
+    float f;
+    memcpy(&f, &v, 4);
+    return f;
+  }
+  float f16() {
+    uint16_t h = uint16_t(u8());
+    h |= uint16_t(u8()) << 8;
+    int exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+    float v;
+    if (exponent == 0)
+      v = std::ldexp(float(mantissa), -24);
+    else if (exponent == 31)
+      v = mantissa ? NAN : INFINITY;
+    else
+      v = std::ldexp(float(mantissa | 0x400), exponent - 25);
+    return (h & 0x8000) ? -v : v;
+  }
+  string str() {
+    string s;
+    while (good && pos < bytes.size() && bytes[pos])
+      s += char(bytes[pos++]);
+    u8(); // the terminator
+    return s;
+  }
+
+private:
+  bool check(size_t n) {
+    if (pos + n > bytes.size())
+      good = false;
+    return good;
+  }
+
+  const std::vector<uint8_t> &bytes;
+  size_t pos = 0;
+  bool good = true;
+};
+
+} // namespace
+
+std::vector<float> readPFM(const char *fname, int &width, int &height) {
+  File file(fname, "rb");
+  if (!file.fp)
+    return std::vector<float>();
+
+  char kind[3] = {};
+  double scale;
+  if (fscanf(file.fp, "%2s %d %d %lf", kind, &width, &height, &scale) != 4 ||
+      (strcmp(kind, "PF") && strcmp(kind, "Pf")) || width <= 0 ||
+      height <= 0 || fgetc(file.fp) == EOF)
+    return std::vector<float>();
+
+  // A negative scale means little-endian data; "Pf" is greyscale.
+  int channels = kind[1] == 'F' ? 3 : 1;
+  bool swap = (scale < 0) != littleEndian();
+  std::vector<float> data(size_t(width) * height * channels);
+  if (fread(data.data(), sizeof(float), data.size(), file.fp) != data.size())
+    return std::vector<float>();
+
+  if (swap) {
+    for (float &f : data) {
+      uint32_t v;
+      memcpy(&v, &f, 4);
+      v = swap32(v);
+      memcpy(&f, &v, 4);
+    }
+  }
+  if (channels == 3)
+    return data;
+
+  std::vector<float> rgb(data.size() * 3);
+  for (size_t i = 0; i < data.size(); ++i)
+    rgb[3 * i] = rgb[3 * i + 1] = rgb[3 * i + 2] = data[i];
+  return rgb;
+}
+
+void writePFM(const char *fname, int width, int height, const float *rgb) {
+  File file(fname, "wb");
+  if (!file.fp)
+    throw string("[writePFM] File could not be opened for writing: ") + fname;
+
+  size_t count = size_t(width) * height * 3;
+  fprintf(file.fp, "PF\n%d %d\n%s\n", width, height,
+          littleEndian() ? "-1.0" : "1.0");
+  if (fwrite(rgb, sizeof(float), count, file.fp) != count)
+    throw string("[writePFM] Error writing ") + fname;
+}
+
+std::vector<float> readEXR(const char *fname, int &width, int &height) {
+  std::vector<uint8_t> bytes;
+  {
+    File file(fname, "rb");
+    if (!file.fp)
+      return std::vector<float>();
+    uint8_t chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file.fp)) > 0)
+      bytes.insert(bytes.end(), chunk, chunk + n);
+  }
+
+  In in(bytes);
+  // Version 2, single-part scanline, no long names or deep data.
+  if (in.u32() != EXR_MAGIC || in.u32() != 2)
+    return std::vector<float>();
+
+  struct Channel {
+    string name;
+    int type;
+  };
+  std::vector<Channel> channels;
+  int compression = -1, lineOrder = 0;
+  int xMin = 0, yMin = 0, xMax = -1, yMax = -1;
+  for (string name; in.ok() && !(name = in.str()).empty();) {
+    string type = in.str();
+    uint32_t size = in.u32();
+    size_t end = in.tell() + size;
+    if (name == "channels" && type == "chlist") {
+      for (string channel; in.ok() && !(channel = in.str()).empty();) {
+        int pixelType = int(in.u32());
+        in.u32(); // pLinear and reserved
+        if (in.u32() != 1 || in.u32() != 1)
+          return std::vector<float>(); // subsampled
+        channels.push_back(Channel{channel, pixelType});
+      }
+    } else if (name == "compression") {
+      compression = in.u8();
+    } else if (name == "lineOrder") {
+      lineOrder = in.u8();
+    } else if (name == "dataWindow") {
+      xMin = int(in.u32());
+      yMin = int(in.u32());
+      xMax = int(in.u32());
+      yMax = int(in.u32());
+    }
+    in.seek(end);
+  }
+
+  width = xMax - xMin + 1;
+  height = yMax - yMin + 1;
+  if (!in.ok() || compression != 0 || width <= 0 || height <= 0 ||
+      lineOrder > 1)
+    return std::vector<float>();
+
+  // Where each channel goes in an RGB pixel, or -1 to skip it.
+  std::vector<int> target;
+  int found = 0;
+  for (const Channel &c : channels) {
+    if (c.type != EXR_HALF && c.type != EXR_FLOAT)
+      return std::vector<float>();
+    int t = c.name == "R" ? 0 : c.name == "G" ? 1 : c.name == "B" ? 2 : -1;
+    if (t >= 0)
+      found |= 1 << t;
+    target.push_back(t);
+  }
+  if (found != 7)
+    return std::vector<float>();
+
+  std::vector<float> rgb(size_t(width) * height * 3);
+  size_t table = in.tell();
+  for (int block = 0; block < height; ++block) {
+    in.seek(table + 8 * size_t(block));
+    in.seek(size_t(in.u64()));
+    int y = int(in.u32()) - yMin;
+    in.u32(); // data size
+    if (!in.ok() || y < 0 || y >= height)
+      return std::vector<float>();
+    // EXR counts lines from the top.
+    float *row = rgb.data() + size_t(height - 1 - y) * width * 3;
+    for (size_t c = 0; c < channels.size(); ++c) {
+      for (int x = 0; x < width; ++x) {
+        float v = channels[c].type == EXR_FLOAT ? in.f32() : in.f16();
+        if (target[c] >= 0)
+          row[3 * x + target[c]] = v;
+      }
+    }
+  }
+  if (!in.ok())
+    return std::vector<float>();
+  return rgb;
+}
+
+void writeEXR(const char *fname, int width, int height, const float *rgb) {
+  writeEXR(fname, width, height,
+           {{"R", rgb, 3}, {"G", rgb + 1, 3}, {"B", rgb + 2, 3}});
+}
+
+void writeEXR(const char *fname, int width, int height,
+              std::vector<EXRChannel> channels) {
+  // Channels are listed, and stored, in alphabetical order.
+  std::sort(channels.begin(), channels.end(),
+            [](const EXRChannel &a, const EXRChannel &b) {
+              return a.name < b.name;
+            });
+
+  Out out;
+  out.u32(EXR_MAGIC);
+  out.u32(2);
+
+  uint32_t listSize = 1;
+  for (const EXRChannel &c : channels)
+    listSize += uint32_t(c.name.size()) + 1 + 16;
+  out.attribute("channels", "chlist", listSize);
+  for (const EXRChannel &c : channels) {
+    out.str(c.name.c_str());
+    out.u32(EXR_FLOAT);
+    out.u32(0); // pLinear and reserved
+    out.u32(1); // x sampling
+    out.u32(1); // y sampling
+  }
+  out.u8(0);
+  out.attribute("compression", "compression", 1);
+  out.u8(0); // NO_COMPRESSION
+  for (const char *window : {"dataWindow", "displayWindow"}) {
+    out.attribute(window, "box2i", 16);
+    out.u32(0);
+    out.u32(0);
+    out.u32(uint32_t(width - 1));
+    out.u32(uint32_t(height - 1));
+  }
+  out.attribute("lineOrder", "lineOrder", 1);
+  out.u8(0); // INCREASING_Y
+  out.attribute("pixelAspectRatio", "float", 4);
+  out.f32(1);
+  out.attribute("screenWindowCenter", "v2f", 8);
+  out.f32(0);
+  out.f32(0);
+  out.attribute("screenWindowWidth", "float", 4);
+  out.f32(1);
+  out.u8(0); // end of header
+
+  // One scanline per block, top line first.
+  uint32_t blockBytes = uint32_t(width) * uint32_t(channels.size()) * 4;
+  uint64_t first = out.bytes.size() + 8 * uint64_t(height);
+  for (int y = 0; y < height; ++y)
+    out.u64(first + uint64_t(y) * (8 + blockBytes));
+  for (int y = 0; y < height; ++y) {
+    out.u32(uint32_t(y));
+    out.u32(blockBytes);
+    size_t row = size_t(height - 1 - y) * width;
+    for (const EXRChannel &c : channels)
+      for (int x = 0; x < width; ++x)
+        out.f32(c.data[(row + x) * c.stride]);
+  }
+
+  File file(fname, "wb");
+  if (!file.fp)
+    throw string("[writeEXR] File could not be opened for writing: ") + fname;
+  if (fwrite(out.bytes.data(), 1, out.bytes.size(), file.fp) !=
+      out.bytes.size())
+    throw string("[writeEXR] Error writing ") + fname;
+}
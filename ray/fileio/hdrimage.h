@@ -0,0 +1,36 @@
+#ifndef FILEIO_HDRIMAGE_H
+#define FILEIO_HDRIMAGE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Linear float RGB images. Pixels are 3 floats, rows run bottom to top as
+ * in every other buffer here. Readers return an empty vector if the file
+ * can't be read; writers throw a string.
+ *
+ * PFM is the portable float map: a short text header and raw floats.
+ *
+ * EXR is written as a plain OpenEXR scanline file, uncompressed, with
+ * FLOAT R, G and B channels, so other tools open it. The reader only
+ * takes that layout back (uncompressed FLOAT or HALF, R, G and B among
+ * the channels); anything else is treated as unreadable.
+ */
+std::vector<float> readPFM(const char *fname, int &width, int &height);
+void writePFM(const char *fname, int width, int height, const float *rgb);
+
+std::vector<float> readEXR(const char *fname, int &width, int &height);
+void writeEXR(const char *fname, int width, int height, const float *rgb);
+
+// One FLOAT channel of an EXR: the value of pixel n is data[n * stride].
+struct EXRChannel {
+  std::string name;
+  const float *data;
+  int stride;
+};
+// Write any set of channels, e.g. data that isn't a colour.
+void writeEXR(const char *fname, int width, int height,
+              std::vector<EXRChannel> channels);
+
+#endif
@@ -1,6 +1,8 @@
 #include "images.h"
 #include "bitmap.h"
+#include "hdrimage.h"
 #include "pngimage.h"
+#include "../scene/timeline.h"
 #include <string>
 #if defined(_MSC_VER)
 #define strncasecmp _strnicmp
@@ -21,11 +23,20 @@ struct Backend {
   const char *ext;
   std::vector<uint8_t> (*reader)(const char *fname, int &width, int &height);
   void (*writer)(const char *iname, int width, int height, const void *data);
+  // null if the format is only written whole
+  std::unique_ptr<ImageSink> (*streamer)(const char *fname, int width,
+                                         int height);
+  // float formats have these instead of reader and writer
+  std::vector<float> (*hdrReader)(const char *fname, int &width, int &height);
+  void (*hdrWriter)(const char *fname, int width, int height,
+                    const float *rgb);
 };
 
 Backend backends[] = {
-    {".bmp", readBMP, writeBMP},
-    {".png", readPNG, writePNG},
+    {".bmp", readBMP, writeBMP, nullptr, nullptr, nullptr},
+    {".png", readPNG, writePNG, openPNGSink, nullptr, nullptr},
+    {".pfm", nullptr, nullptr, nullptr, readPFM, writePFM},
+    {".exr", nullptr, nullptr, nullptr, readEXR, writeEXR},
 };
 
 const Backend *bmp_handler = &backends[0];
@@ -50,15 +61,71 @@ std::vector<uint8_t> readImage(const char *fname, int &width, int &height) {
   auto handler = find_handler(fname);
   if (!handler)
     return std::vector<uint8_t>();
-  return handler->reader(fname, width, height);
+  if (handler->reader)
+    return handler->reader(fname, width, height);
+
+  std::vector<float> rgb = handler->hdrReader(fname, width, height);
+  std::vector<uint8_t> data(rgb.size());
+  resolve(rgb.data(), data.data(), rgb.size());
+  return data;
 }
 
 void writeImage(const char *fname, int width, int height, const void *data) {
+  TimelineSpan span("write image", "write",
+                    [fname]() { return std::string(fname); });
   auto handler = find_handler(fname);
   if (!handler) {
     std::cerr << "Unrecognized extension for file " << fname
               << ", writing bmp format" << std::endl;
     handler = bmp_handler;
   }
-  handler->writer(fname, width, height, data);
+  if (handler->writer) {
+    handler->writer(fname, width, height, data);
+    return;
+  }
+
+  std::vector<float> rgb(size_t(width) * height * 3);
+  expand(static_cast<const uint8_t *>(data), rgb.data(), rgb.size());
+  handler->hdrWriter(fname, width, height, rgb.data());
+}
+
+std::vector<float> readHDRImage(const char *fname, int &width, int &height) {
+  auto handler = find_handler(fname);
+  if (!handler)
+    return std::vector<float>();
+  if (handler->hdrReader)
+    return handler->hdrReader(fname, width, height);
+
+  std::vector<uint8_t> data = handler->reader(fname, width, height);
+  std::vector<float> rgb(data.size());
+  expand(data.data(), rgb.data(), data.size());
+  return rgb;
+}
+
+void writeHDRImage(const char *fname, int width, int height, const float *rgb,
+                   const ToneMap &tm) {
+  auto handler = find_handler(fname);
+  if (handler && handler->hdrWriter) {
+    TimelineSpan span("write image", "write",
+                      [fname]() { return std::string(fname); });
+    handler->hdrWriter(fname, width, height, rgb);
+    return;
+  }
+
+  std::vector<uint8_t> data(size_t(width) * height * 3);
+  resolve(rgb, data.data(), data.size(), tm);
+  writeImage(fname, width, height, data.data());
+}
+
+bool isHDRImage(const char *fname) {
+  auto handler = find_handler(fname);
+  return handler && handler->hdrWriter;
+}
+
+std::unique_ptr<ImageSink> openImageSink(const char *fname, int width,
+                                         int height) {
+  auto handler = find_handler(fname);
+  if (!handler || !handler->streamer)
+    return nullptr;
+  return handler->streamer(fname, width, height);
 }
@@ -1,18 +1,58 @@
 #ifndef FILEIO_IMAGES_H
 #define FILEIO_IMAGES_H
 
+#include "tonemap.h"
+#include <memory>
 #include <stdint.h>
 #include <vector>
 
 /*
  * Improved readBMP/writeBMP.
  * Automatically detects extensions and read/write the data.
- * Currently supports: bmp, png
+ * Currently supports: bmp, png, and the float formats pfm and exr
  *
+ * readImage and writeImage deal in 8-bit RGB; a float format is resolved
+ * with the default ToneMap on the way in and stored as the same values on
+ * the way out.
  */
 extern std::vector<uint8_t> readImage(const char *fname, int &width,
                                       int &height);
 extern void writeImage(const char *iname, int width, int height,
                        const void *data);
 
+/*
+ * The same in linear float RGB. A float format keeps the values as they
+ * are; an 8-bit one is read as c / 255 and written through resolve(tm).
+ */
+extern std::vector<float> readHDRImage(const char *fname, int &width,
+                                       int &height);
+extern void writeHDRImage(const char *fname, int width, int height,
+                          const float *rgb, const ToneMap &tm = ToneMap());
+
+// Does fname name a format that stores floats?
+extern bool isHDRImage(const char *fname);
+
+/*
+ * Receives an image a row at a time, for writing it out while the rest is
+ * still being rendered. Rows are numbered as in the buffer writeImage
+ * takes, i.e. row 0 is the bottom of the picture, and hold 3 bytes (RGB)
+ * per pixel. They may arrive in any order; each is encoded once the rows
+ * it depends on are in, on a thread of the sink's own, and addRow() blocks
+ * while too many are waiting so that memory stays bounded.
+ */
+class ImageSink {
+public:
+  virtual ~ImageSink() {}
+  virtual void addRow(int row, const uint8_t *rgb) = 0;
+  // Wait until everything is written and close the file. Throws a string
+  // describing the problem if writing failed.
+  virtual void finish() = 0;
+};
+
+// A sink for the format given by the extension of fname, or null if that
+// format can only be written whole (use writeImage then). Throws a string
+// if the file can't be created.
+extern std::unique_ptr<ImageSink> openImageSink(const char *fname, int width,
+                                                int height);
+
 #endif
@@ -0,0 +1,99 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char *fname) {
+  close();
+  HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  fileHandle = file;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    close();
+    return false;
+  }
+  if (size.QuadPart == 0)
+    return true;
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    close();
+    return false;
+  }
+  mappingHandle = mapping;
+
+  base = static_cast<const char *>(
+      MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!base) {
+    close();
+    return false;
+  }
+  length = size_t(size.QuadPart);
+  return true;
+}
+
+void MappedFile::close() {
+  if (base)
+    UnmapViewOfFile(base);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  base = nullptr;
+  length = 0;
+  mappingHandle = fileHandle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const char *fname) {
+  close();
+  int fd = ::open(fname, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    ::close(fd);
+    return true;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file.
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  // Parsers read front to back.
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  base = static_cast<const char *>(p);
+  length = size_t(st.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (base)
+    munmap(const_cast<char *>(base), length);
+  base = nullptr;
+  length = 0;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FILEIO_MAPPEDFILE_H
+#define FILEIO_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <string_view>
+
+/*
+ * Read-only view of a whole file, mapped into memory so that parsers can scan
+ * it in place without copying it into strings first. The view stays valid for
+ * the lifetime of the MappedFile.
+ *
+ * Empty files are fine: open() succeeds and data() is an empty view.
+ */
+class MappedFile {
+public:
+  MappedFile() {}
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Returns false if the file can't be opened or mapped.
+  bool open(const char *fname);
+  void close();
+
+  std::string_view data() const { return std::string_view(base, length); }
+  size_t size() const { return length; }
+
+private:
+  const char *base = nullptr;
+  size_t length = 0;
+
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#endif
+};
+
+#endif
@@ -1,8 +1,13 @@
 #include "pngimage.h"
+#include "../scene/timeline.h"
 #include <png.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <vector>
 #include <zlib.h>
 
@@ -292,3 +297,154 @@ void writePNG(const char *fname, int width, int height, const void *data) {
   fclose(fp);
   png_destroy_write_struct(&png_ptr, &info_ptr);
 }
+
+namespace {
+
+/* PNG stores rows top to bottom, so rows are encoded from height - 1 down to
+0. Rows that arrive early wait in `pending`; at most MAX_PENDING of them,
+plus the one the encoder needs next, which is always accepted so that the
+producer can't deadlock. */
+class PNGSink : public ImageSink {
+public:
+  static constexpr size_t MAX_PENDING = 64;
+
+  PNGSink(const char *fname, int width, int height)
+      : width(width), height(height), next(height - 1) {
+    fp = fopen(fname, "wb");
+    if (!fp)
+      throw string("[write_png_file] File could not be opened for "
+                   "writing: ") +
+          fname;
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png_ptr)
+      info_ptr = png_create_info_struct(png_ptr);
+    if (!png_ptr || !info_ptr) {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      fclose(fp);
+      throw string("[write_png_file] png_create_write_struct failed");
+    }
+    encoder = std::thread([this]() { encode(); });
+  }
+
+  ~PNGSink() {
+    try {
+      finish();
+    } catch (string &) {
+    }
+  }
+
+  void addRow(int row, const uint8_t *rgb) override {
+    std::unique_lock<std::mutex> guard(lock);
+    space.wait(guard, [&]() {
+      return failed || row == next || pending.size() < MAX_PENDING;
+    });
+    if (failed)
+      return;
+    pending[row].assign(rgb, rgb + size_t(width) * 3);
+    ready.notify_one();
+  }
+
+  void finish() override {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      closed = true;
+    }
+    ready.notify_one();
+    if (encoder.joinable())
+      encoder.join();
+    if (failed)
+      throw error;
+  }
+
+private:
+  // Runs on the encoder thread. libpng reports errors by longjmp, which
+  // lands back here; nothing between here and the libpng calls may need
+  // destroying, hence `current` being a member, and the timeline event
+  // being recorded by hand rather than by a TimelineSpan.
+  void encode() {
+    Timeline::nameThread("png encoder");
+    Timeline::Clock::time_point start = Timeline::Clock::now();
+    if (setjmp(png_jmpbuf(png_ptr))) {
+      close();
+      fail("[write_png_file] Error during writing");
+      return;
+    }
+    png_init_io(png_ptr, fp);
+    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+                 PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+
+    while (next >= 0) {
+      if (!takeNext()) {
+        close();
+        fail("[write_png_file] Image closed before all rows were written");
+        return;
+      }
+      png_write_row(png_ptr, current.data());
+    }
+    png_write_end(png_ptr, NULL);
+    if (!close())
+      fail("[write_png_file] Error during end of write");
+    if (Timeline::enabled())
+      Timeline::record("encode png", "write", start, Timeline::Clock::now(),
+                       std::string());
+  }
+
+  // Move row `next` into `current` once it has arrived, and count it off.
+  // Returns false if the sink was finished without it.
+  bool takeNext() {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      ready.wait(guard, [&]() { return closed || pending.count(next); });
+      auto found = pending.find(next);
+      if (found == pending.end())
+        return false;
+      current.swap(found->second);
+      pending.erase(found);
+      --next;
+    }
+    space.notify_all();
+    return true;
+  }
+
+  bool close() {
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    bool ok = fclose(fp) == 0;
+    fp = nullptr;
+    return ok;
+  }
+
+  void fail(const char *message) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      failed = true;
+      error = message;
+      pending.clear();
+    }
+    space.notify_all();
+  }
+
+  int width, height;
+  FILE *fp = nullptr;
+  png_structp png_ptr = nullptr;
+  png_infop info_ptr = nullptr;
+
+  std::mutex lock;
+  std::condition_variable ready; // a row was added
+  std::condition_variable space; // a row was taken, or writing failed
+  std::map<int, std::vector<uint8_t>> pending;
+  int next; // the row the encoder is waiting for
+  std::vector<uint8_t> current;
+  bool closed = false; // finish() was called
+  bool failed = false;
+  string error;
+  std::thread encoder;
+};
+
+} // namespace
+
+std::unique_ptr<ImageSink> openPNGSink(const char *fname, int width,
+                                       int height) {
+  return std::unique_ptr<ImageSink>(new PNGSink(fname, width, height));
+}
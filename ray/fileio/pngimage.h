@@ -1,6 +1,8 @@
 #ifndef FILEIO_PNGIMAGE_H
 #define FILEIO_PNGIMAGE_H
 
+#include "images.h"
+#include <memory>
 #include <stdint.h>
 #include <vector>
 
@@ -8,5 +10,8 @@ void png_version_info(void);
 
 std::vector<uint8_t> readPNG(const char *fname, int &width, int &height);
 void writePNG(const char *iname, int width, int height, const void *data);
+// Encodes rows top to bottom as they come in; see ImageSink.
+std::unique_ptr<ImageSink> openPNGSink(const char *fname, int width,
+                                       int height);
 
 #endif
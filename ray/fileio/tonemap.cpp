@@ -0,0 +1,48 @@
+#include "tonemap.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// The loops below are kept free of branches and calls so that the compiler
+// turns them into packed SIMD code (GCC only does with -fno-trapping-math,
+// which CMakeLists.txt sets for this file); each handles one operator. They
+// are written so that NaN fails the `> 0` test and comes out black, since
+// converting NaN to an integer is undefined.
+
+void resolveClamp(const float *in, uint8_t *out, size_t count, float scale) {
+  for (size_t i = 0; i < count; ++i) {
+    float c = in[i] * scale;
+    c = c > 0.0f ? std::min(c, 1.0f) : 0.0f;
+    out[i] = uint8_t(int(255.0f * c));
+  }
+}
+
+void resolveReinhard(const float *in, uint8_t *out, size_t count,
+                     float scale) {
+  for (size_t i = 0; i < count; ++i) {
+    // Capped so that infinity maps to white rather than inf / inf.
+    float c = in[i] * scale;
+    c = c > 0.0f ? std::min(c, 1e30f) : 0.0f;
+    out[i] = uint8_t(int(255.0f * (c / (1.0f + c))));
+  }
+}
+
+} // namespace
+
+void resolve(const float *in, uint8_t *out, size_t count, const ToneMap &tm) {
+  float scale = float(std::exp2(tm.exposure));
+  switch (tm.op) {
+  case ToneMap::REINHARD:
+    resolveReinhard(in, out, count, scale);
+    break;
+  default:
+    resolveClamp(in, out, count, scale);
+    break;
+  }
+}
+
+void expand(const uint8_t *in, float *out, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    out[i] = float(in[i]) * (1.0f / 255.0f);
+}
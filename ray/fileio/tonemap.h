@@ -0,0 +1,30 @@
+#ifndef FILEIO_TONEMAP_H
+#define FILEIO_TONEMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Turning the linear float framebuffer into 8-bit pixels. This is the only
+ * place renders are clamped and quantized, so that an HDR image written to
+ * .pfm or .exr can be re-exposed and resolved again without re-tracing it.
+ */
+struct ToneMap {
+  enum Operator {
+    CLAMP,    // clip to [0, 1]
+    REINHARD, // c / (1 + c), rolls highlights off instead of clipping
+  };
+
+  double exposure = 0; // in stops; every value is scaled by 2^exposure
+  Operator op = CLAMP;
+};
+
+// Resolve count floats (any number of channels) to bytes. The default
+// ToneMap is the renderer's old (int)(255 * clamp(c)).
+void resolve(const float *in, uint8_t *out, size_t count,
+             const ToneMap &tm = ToneMap());
+
+// The inverse of the default resolve, for HDR files written from 8-bit data.
+void expand(const uint8_t *in, float *out, size_t count);
+
+#endif
@@ -11,6 +11,7 @@ RayTracer *theRayTracer;
 TraceUI *traceUI;
 int TraceUI::m_threads = max(std::thread::hardware_concurrency(), (unsigned)1);
 int TraceUI::rayCount[MAX_THREADS];
+unsigned long long TraceUI::rayTypeCount[MAX_THREADS][TraceUI::RAY_TYPES];
 
 // usage : ray [option] in.ray out.bmp
 // Simply keying in ray will invoke a graphics mode version.
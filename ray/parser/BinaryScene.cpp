@@ -0,0 +1,534 @@
+#include "BinaryScene.h"
+#include "ParserException.h"
+
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+#include "../scene/light.h"
+#include "../scene/scene.h"
+
+#include <fstream>
+#include <map>
+#include <string.h>
+#include <vector>
+
+#include <glm/gtc/type_ptr.hpp>
+
+static_assert(sizeof(glm::dvec3) == 3 * sizeof(double),
+              "mesh arrays are copied as packed doubles");
+static_assert(sizeof(glm::dvec2) == 2 * sizeof(double),
+              "mesh arrays are copied as packed doubles");
+
+namespace {
+
+const char MAGIC[8] = {'R', 'A', 'Y', 'B', 'I', 'N', '\r', '\n'};
+const uint32_t ENDIAN_TAG = 0x01020304;
+const size_t ALIGNMENT = 16;
+
+// A run of `count` items (of the type given where the Span is declared)
+// starting `offset` bytes into the file.
+struct Span {
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint64_t fileSize;
+
+  double ambient[3];
+  Span camera; // 1 CameraRecord
+  Span textures;
+  Span materials;
+  Span lights;
+  Span objects;
+};
+
+struct CameraRecord {
+  double m[9];
+  double normalizedHeight;
+  double aspectRatio;
+  double eye[3];
+  double look[3];
+  double u[3];
+  double v[3];
+};
+
+struct TextureRecord {
+  int32_t width;
+  int32_t height;
+  Span name;   // chars
+  Span pixels; // bytes, 3 per pixel
+};
+
+struct ParameterRecord {
+  double value[3];
+  int32_t texture; // index into the texture table, or -1
+  uint32_t unused;
+};
+
+struct MaterialRecord {
+  ParameterRecord ke, ka, ks, kd, kr, kt, shininess, index;
+  uint8_t refl, trans, recur, spec, both;
+  uint8_t unused[3];
+};
+
+enum LightKind : uint32_t { DIRECTIONAL_LIGHT, POINT_LIGHT };
+
+struct LightRecord {
+  uint32_t kind;
+  float attenuation[3]; // point lights: constant, linear, quadratic
+  double color[3];
+  double vector[3]; // orientation or position
+};
+
+enum ObjectKind : uint32_t { SPHERE, BOX, SQUARE, CYLINDER, CONE, TRIMESH };
+
+struct ObjectRecord {
+  uint32_t kind;
+  uint32_t material; // index into the material table
+  double transform[16];
+
+  // Cylinders and cones
+  uint32_t capped;
+  uint32_t unused;
+  double height, bottomRadius, topRadius;
+
+  // Trimeshes
+  uint32_t vertNorms;
+  uint32_t unused2;
+  Span vertices;  // dvec3
+  Span normals;   // dvec3
+  Span colors;    // dvec3
+  Span uvs;       // dvec2
+  Span faces;     // int32, 3 per face
+  Span faceMaterials; // uint16 per face, or empty
+  Span palette;   // uint32 material indices
+};
+
+} // namespace
+
+/* Accumulates the file in memory; records are appended as they are built and
+the header is filled in last. */
+class BinaryScene::Writer {
+public:
+  explicit Writer(const Scene &scene) : scene(scene) {
+    bytes.resize(sizeof(Header));
+  }
+
+  std::vector<char> build() {
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.byteOrder = ENDIAN_TAG;
+    memcpy(h.ambient, glm::value_ptr(scene.ambientIntensity),
+           sizeof(h.ambient));
+
+    // Textures first, so that materials can refer to them by index.
+    std::vector<TextureRecord> textures;
+    for (const auto &entry : scene.textureCache)
+      textures.push_back(texture(entry.first, *entry.second));
+
+    CameraRecord cam = camera(scene.camera);
+    h.camera = put(&cam, 1);
+
+    std::vector<LightRecord> lights;
+    for (const Light *l : scene.lights)
+      lights.push_back(light(*l));
+
+    std::vector<ObjectRecord> objects;
+    for (const Geometry *g : scene.objects)
+      objects.push_back(object(*g));
+
+    h.textures = put(textures.data(), textures.size());
+    h.materials = put(materials.data(), materials.size());
+    h.lights = put(lights.data(), lights.size());
+    h.objects = put(objects.data(), objects.size());
+
+    h.fileSize = bytes.size();
+    memcpy(bytes.data(), &h, sizeof(h));
+    return std::move(bytes);
+  }
+
+private:
+  template <typename T> Span put(const T *items, size_t count) {
+    bytes.resize((bytes.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+    Span s{bytes.size(), count};
+    if (count > 0) {
+      const char *p = reinterpret_cast<const char *>(items);
+      bytes.insert(bytes.end(), p, p + count * sizeof(T));
+    }
+    return s;
+  }
+
+  TextureRecord texture(const std::string &name, const TextureMap &t) {
+    textureIndex[&t] = int32_t(textureIndex.size());
+    TextureRecord r;
+    memset(&r, 0, sizeof(r));
+    r.width = t.width;
+    r.height = t.height;
+    r.name = put(name.data(), name.size());
+    std::vector<uint8_t> pixels = t.getPixels();
+    r.pixels = put(pixels.data(), pixels.size());
+    return r;
+  }
+
+  CameraRecord camera(const Camera &c) {
+    CameraRecord r;
+    memcpy(r.m, glm::value_ptr(c.m), sizeof(r.m));
+    r.normalizedHeight = c.normalizedHeight;
+    r.aspectRatio = c.aspectRatio;
+    memcpy(r.eye, glm::value_ptr(c.eye), sizeof(r.eye));
+    memcpy(r.look, glm::value_ptr(c.look), sizeof(r.look));
+    memcpy(r.u, glm::value_ptr(c.u), sizeof(r.u));
+    memcpy(r.v, glm::value_ptr(c.v), sizeof(r.v));
+    return r;
+  }
+
+  ParameterRecord parameter(const MaterialParameter &p) {
+    ParameterRecord r;
+    memset(&r, 0, sizeof(r));
+    memcpy(r.value, glm::value_ptr(p._value), sizeof(r.value));
+    r.texture = -1;
+    if (p._textureMap) {
+      auto it = textureIndex.find(p._textureMap);
+      if (it == textureIndex.end())
+        throw ParserException("Can't compile scene: a material uses a "
+                              "texture that isn't in the scene");
+      r.texture = it->second;
+    }
+    return r;
+  }
+
+  // Append m to the material table and return its index.
+  uint32_t material(const Material &m) {
+    MaterialRecord r;
+    memset(&r, 0, sizeof(r));
+    r.ke = parameter(m._ke);
+    r.ka = parameter(m._ka);
+    r.ks = parameter(m._ks);
+    r.kd = parameter(m._kd);
+    r.kr = parameter(m._kr);
+    r.kt = parameter(m._kt);
+    r.shininess = parameter(m._shininess);
+    r.index = parameter(m._index);
+    r.refl = m._refl;
+    r.trans = m._trans;
+    r.recur = m._recur;
+    r.spec = m._spec;
+    r.both = m._both;
+    materials.push_back(r);
+    return uint32_t(materials.size() - 1);
+  }
+
+  LightRecord light(const Light &l) {
+    LightRecord r;
+    memset(&r, 0, sizeof(r));
+    memcpy(r.color, glm::value_ptr(l.getColor()), sizeof(r.color));
+    if (auto *d = dynamic_cast<const DirectionalLight *>(&l)) {
+      r.kind = DIRECTIONAL_LIGHT;
+      memcpy(r.vector, glm::value_ptr(d->orientation), sizeof(r.vector));
+    } else if (auto *p = dynamic_cast<const PointLight *>(&l)) {
+      r.kind = POINT_LIGHT;
+      memcpy(r.vector, glm::value_ptr(p->position), sizeof(r.vector));
+      r.attenuation[0] = p->constantTerm;
+      r.attenuation[1] = p->linearTerm;
+      r.attenuation[2] = p->quadraticTerm;
+    } else {
+      throw ParserException("Can't compile scene: unknown kind of light");
+    }
+    return r;
+  }
+
+  ObjectRecord object(const Geometry &g) {
+    ObjectRecord r;
+    memset(&r, 0, sizeof(r));
+    memcpy(r.transform, glm::value_ptr(g.getTransform().transform()),
+           sizeof(r.transform));
+
+    auto *obj = dynamic_cast<const SceneObject *>(&g);
+    if (!obj)
+      throw ParserException("Can't compile scene: unknown kind of object");
+    r.material = material(obj->getMaterial());
+
+    if (dynamic_cast<const Sphere *>(obj)) {
+      r.kind = SPHERE;
+    } else if (dynamic_cast<const Box *>(obj)) {
+      r.kind = BOX;
+    } else if (dynamic_cast<const Square *>(obj)) {
+      r.kind = SQUARE;
+    } else if (auto *c = dynamic_cast<const Cylinder *>(obj)) {
+      r.kind = CYLINDER;
+      r.capped = c->capped;
+    } else if (auto *c = dynamic_cast<const Cone *>(obj)) {
+      r.kind = CONE;
+      r.capped = c->capped;
+      r.height = c->height;
+      r.bottomRadius = c->b_radius;
+      r.topRadius = c->t_radius;
+    } else if (auto *t = dynamic_cast<const Trimesh *>(obj)) {
+      r.kind = TRIMESH;
+      mesh(*t, r);
+    } else {
+      throw ParserException("Can't compile scene: unknown kind of object");
+    }
+    return r;
+  }
+
+  void mesh(const Trimesh &t, ObjectRecord &r) {
+    if (t.isCompressed())
+      throw ParserException("Can't compile scene: meshes must not be "
+                            "compressed");
+    r.vertNorms = t.vertNorms;
+    r.vertices = put(t.vertices.data(), t.vertices.size());
+    r.normals = put(t.normals.data(), t.normals.size());
+    r.colors = put(t.vertColors.data(), t.vertColors.size());
+    r.uvs = put(t.uvCoords.data(), t.uvCoords.size());
+
+    std::vector<int32_t> faces;
+    std::vector<uint16_t> faceMaterials;
+    faces.reserve(3 * t.faces.size());
+    for (const TrimeshFace *f : t.faces) {
+      for (int k = 0; k < 3; ++k)
+        faces.push_back((*f)[k]);
+      if (!t.palette.empty())
+        faceMaterials.push_back(uint16_t(f->materialIndex()));
+    }
+    r.faces = put(faces.data(), faces.size());
+    r.faceMaterials = put(faceMaterials.data(), faceMaterials.size());
+
+    std::vector<uint32_t> palette;
+    for (const Material &m : t.palette)
+      palette.push_back(material(m));
+    r.palette = put(palette.data(), palette.size());
+  }
+
+  const Scene &scene;
+  std::vector<char> bytes;
+  std::map<const TextureMap *, int32_t> textureIndex;
+  std::vector<MaterialRecord> materials;
+};
+
+/* Checks every offset against the size of the data before using it, so a
+truncated or corrupt file is an error rather than a crash. */
+class BinaryScene::Reader {
+public:
+  explicit Reader(std::string_view data) : data(data) {}
+
+  Scene *build() {
+    if (data.size() < sizeof(Header))
+      fail("file is too short");
+    Header h;
+    memcpy(&h, data.data(), sizeof(h));
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+      fail("not a compiled scene");
+    if (h.byteOrder != ENDIAN_TAG)
+      fail("compiled on a machine with a different byte order");
+    if (h.version != VERSION)
+      fail("compiled by version " + std::to_string(h.version) +
+           " of the format, expected " + std::to_string(VERSION) +
+           "; recompile the scene");
+    if (h.fileSize != data.size())
+      fail("file is truncated");
+
+    std::unique_ptr<Scene> s(new Scene);
+    scene = s.get();
+    scene->ambientIntensity = glm::make_vec3(h.ambient);
+
+    if (h.camera.count != 1)
+      fail("missing camera");
+    camera(records<CameraRecord>(h.camera)[0]);
+
+    for (const TextureRecord &r : records<TextureRecord>(h.textures))
+      texture(r);
+    materials = records<MaterialRecord>(h.materials);
+    for (const LightRecord &r : records<LightRecord>(h.lights))
+      light(r);
+    for (const ObjectRecord &r : records<ObjectRecord>(h.objects))
+      object(r);
+    return s.release();
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &why) const {
+    throw ParserException("Error reading compiled scene: " + why);
+  }
+
+  // Copy out a span of T, checking that it lies within the file.
+  template <typename T> std::vector<T> records(const Span &s) const {
+    if (s.offset > data.size() || s.count > (data.size() - s.offset) / sizeof(T))
+      fail("file is corrupt");
+    std::vector<T> out(s.count);
+    if (s.count > 0)
+      memcpy(out.data(), data.data() + s.offset, s.count * sizeof(T));
+    return out;
+  }
+
+  void camera(const CameraRecord &r) {
+    Camera &c = scene->camera;
+    c.m = glm::make_mat3(r.m);
+    c.normalizedHeight = r.normalizedHeight;
+    c.aspectRatio = r.aspectRatio;
+    c.eye = glm::make_vec3(r.eye);
+    c.look = glm::make_vec3(r.look);
+    c.u = glm::make_vec3(r.u);
+    c.v = glm::make_vec3(r.v);
+  }
+
+  void texture(const TextureRecord &r) {
+    std::vector<char> name = records<char>(r.name);
+    std::vector<uint8_t> pixels = records<uint8_t>(r.pixels);
+    if (r.width < 0 || r.height < 0 ||
+        pixels.size() != 3 * size_t(r.width) * size_t(r.height))
+      fail("bad texture");
+    auto &slot = scene->textureCache[std::string(name.begin(), name.end())];
+    slot.reset(new TextureMap(r.width, r.height, pixels));
+    textures.push_back(slot.get());
+  }
+
+  MaterialParameter parameter(const ParameterRecord &r) const {
+    MaterialParameter p(glm::make_vec3(r.value));
+    if (r.texture >= 0) {
+      if (size_t(r.texture) >= textures.size())
+        fail("bad texture index");
+      p._textureMap = textures[r.texture];
+    }
+    return p;
+  }
+
+  Material material(uint32_t index) const {
+    if (index >= materials.size())
+      fail("bad material index");
+    const MaterialRecord &r = materials[index];
+    Material m;
+    m._ke = parameter(r.ke);
+    m._ka = parameter(r.ka);
+    m._ks = parameter(r.ks);
+    m._kd = parameter(r.kd);
+    m._kr = parameter(r.kr);
+    m._kt = parameter(r.kt);
+    m._shininess = parameter(r.shininess);
+    m._index = parameter(r.index);
+    m._refl = r.refl;
+    m._trans = r.trans;
+    m._recur = r.recur;
+    m._spec = r.spec;
+    m._both = r.both;
+    return m;
+  }
+
+  void light(const LightRecord &r) {
+    Arena &arena = scene->arena();
+    glm::dvec3 color = glm::make_vec3(r.color);
+    glm::dvec3 v = glm::make_vec3(r.vector);
+    if (r.kind == DIRECTIONAL_LIGHT) {
+      DirectionalLight *l =
+          arena.create<DirectionalLight>(scene, glm::dvec3(0, 0, 1), color);
+      // Stored already normalized; don't normalize it a second time.
+      l->orientation = v;
+      scene->add(l);
+    } else if (r.kind == POINT_LIGHT) {
+      scene->add(arena.create<PointLight>(scene, v, color, r.attenuation[0],
+                                          r.attenuation[1],
+                                          r.attenuation[2]));
+    } else {
+      fail("unknown kind of light");
+    }
+  }
+
+  void object(const ObjectRecord &r) {
+    Arena &arena = scene->arena();
+    Material mat = material(r.material);
+    MatrixTransform xform(glm::make_mat4(r.transform));
+
+    SceneObject *obj = nullptr;
+    switch (r.kind) {
+    case SPHERE:
+      obj = arena.create<Sphere>(scene, &mat);
+      break;
+    case BOX:
+      obj = arena.create<Box>(scene, &mat);
+      break;
+    case SQUARE:
+      obj = arena.create<Square>(scene, &mat);
+      break;
+    case CYLINDER: {
+      Cylinder *c = arena.create<Cylinder>(scene, &mat);
+      c->setCapped(r.capped);
+      obj = c;
+      break;
+    }
+    case CONE:
+      obj = arena.create<Cone>(scene, &mat, r.height, r.bottomRadius,
+                               r.topRadius, r.capped != 0);
+      break;
+    case TRIMESH: {
+      Trimesh *t = arena.create<Trimesh>(scene, &mat, xform);
+      mesh(r, t);
+      obj = t;
+      break;
+    }
+    default:
+      fail("unknown kind of object");
+    }
+    obj->setTransform(xform);
+    scene->add(obj);
+  }
+
+  void mesh(const ObjectRecord &r, Trimesh *t) {
+    t->vertNorms = r.vertNorms != 0;
+    t->setVertices(records<glm::dvec3>(r.vertices));
+    t->setNormals(records<glm::dvec3>(r.normals));
+    t->setColors(records<glm::dvec3>(r.colors));
+    t->setUVs(records<glm::dvec2>(r.uvs));
+    if (t->doubleCheck())
+      fail("mesh attributes don't match its vertices");
+
+    for (uint32_t index : records<uint32_t>(r.palette))
+      t->addMaterial(material(index));
+
+    std::vector<int32_t> faces = records<int32_t>(r.faces);
+    std::vector<uint16_t> faceMaterials = records<uint16_t>(r.faceMaterials);
+    size_t faceCount = faces.size() / 3;
+    if (faces.size() % 3 != 0 ||
+        (!faceMaterials.empty() && faceMaterials.size() != faceCount))
+      fail("wrong number of face indices or materials");
+
+    t->reserveFaces(faceCount);
+    for (size_t f = 0; f < faceCount; ++f) {
+      int material = faceMaterials.empty() ? 0 : faceMaterials[f];
+      if (faces[3 * f] < 0 || faces[3 * f + 1] < 0 || faces[3 * f + 2] < 0 ||
+          !t->addFace(faces[3 * f], faces[3 * f + 1], faces[3 * f + 2],
+                      material))
+        fail("bad mesh face");
+    }
+  }
+
+  std::string_view data;
+  Scene *scene = nullptr;
+  std::vector<TextureMap *> textures;
+  std::vector<MaterialRecord> materials;
+};
+
+void BinaryScene::write(const Scene &scene, const std::string &path) {
+  std::vector<char> bytes = Writer(scene).build();
+  std::ofstream out(path, std::ios::binary);
+  out.write(bytes.data(), bytes.size());
+  if (!out)
+    throw ParserException("Can't write compiled scene to " + path);
+}
+
+Scene *BinaryScene::read(std::string_view data) {
+  return Reader(data).build();
+}
+
+bool BinaryScene::isBinaryScene(const char *fname) {
+  const char *ext = strrchr(fname, '.');
+  return ext && !strcmp(ext, ".rbin");
+}
@@ -0,0 +1,51 @@
+#ifndef __BINARYSCENE_H__
+#define __BINARYSCENE_H__
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+class Scene;
+
+/* A compiled scene (.rbin): everything the parsers produced for a Scene, in a
+form that can be loaded without parsing anything. Written by
+`ray --compile in.json out.rbin` and read back by RayTracer::loadScene.
+
+The file is one flat block of plain-old-data:
+
+  - a Header, at offset 0, holding the format version and the location of
+    every table below;
+  - tables of fixed-size records: camera, textures, materials, lights and
+    objects, in scene order;
+  - the bulk arrays they refer to (texture pixels, mesh vertices, faces...),
+    each aligned to 16 bytes.
+
+Every reference is an offset from the start of the file, never a pointer, so
+the file can be mapped at any address and its arrays copied out with one
+memcpy each. Meshes are stored after Scene::finalize(), i.e. with their
+transforms already baked in. Files are only read on machines with the same
+byte order and a matching version; anything else is rejected. */
+class BinaryScene {
+public:
+  // Bump whenever the layout of anything in the file changes.
+  static constexpr uint32_t VERSION = 1;
+
+  // Throws ParserException if the scene holds something the format can't
+  // store (e.g. a compressed mesh) or the file can't be written.
+  static void write(const Scene &scene, const std::string &path);
+
+  // Build a Scene from the contents of a compiled file. Throws
+  // ParserException if the data is not a valid .rbin of this version.
+  static Scene *read(std::string_view data);
+
+  // Does the file name end in ".rbin"?
+  static bool isBinaryScene(const char *fname);
+
+private:
+  // Scene, Camera, Material etc. name BinaryScene as a friend so that these
+  // can copy their private state without widening their interfaces.
+  class Writer;
+  class Reader;
+};
+
+#endif // __BINARYSCENE_H__
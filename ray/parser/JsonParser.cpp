@@ -1,4 +1,5 @@
 #include "JsonParser.h"
+#include "ObjLoader.h"
 #include "ParserException.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -6,13 +7,18 @@
 #include "tiny_obj_loader.h"
 #include <sstream>
 
+#include "../scene/parallel.h"
+#include "../ui/TraceUI.h"
+
+#include <algorithm>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
-#include <unordered_map>
 
 #include <json.hpp>
 using json = nlohmann::json;
 
+extern TraceUI *traceUI;
+
 // 1.5GB of memory at ~300B per Material
 constexpr size_t MAX_RECOMMENDED_VERTS = 5'000'000;
 
@@ -112,7 +118,7 @@ Material parseMaterial(const json &j, ParseData &pd) {
 DirectionalLight *parseDirectionalLight(const json &j, ParseData &pd) {
   glm::dvec3 color = j.at("color").get<glm::dvec3>();
   glm::dvec3 direction = j.at("direction").get<glm::dvec3>();
-  return new DirectionalLight(pd.s, direction, color);
+  return pd.s->arena().create<DirectionalLight>(pd.s, direction, color);
 }
 
 PointLight *parsePointLight(const json &j, ParseData &pd) {
@@ -124,8 +130,8 @@ PointLight *parsePointLight(const json &j, ParseData &pd) {
   IGNORE_MISSING(j.at("constant_attenuation_coeff").get_to(atten_pow_0));
   IGNORE_MISSING(j.at("linear_attenuation_coeff").get_to(atten_pow_1));
   IGNORE_MISSING(j.at("quadratic_attenuation_coeff").get_to(atten_pow_2));
-  return new PointLight(pd.s, position, color, atten_pow_0, atten_pow_1,
-                        atten_pow_2);
+  return pd.s->arena().create<PointLight>(pd.s, position, color, atten_pow_0,
+                                          atten_pow_1, atten_pow_2);
 }
 
 glm::dvec3 parseAmbientLight(const json &j) {
@@ -135,28 +141,28 @@ glm::dvec3 parseAmbientLight(const json &j) {
 
 Sphere *parseSphereBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto s = new Sphere(pd.s, &m);
+  auto s = pd.s->arena().create<Sphere>(pd.s, &m);
   s->setTransform(pd.getCurrentTransform());
   return s;
 }
 
 Box *parseBoxBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto b = new Box(pd.s, &m);
+  auto b = pd.s->arena().create<Box>(pd.s, &m);
   b->setTransform(pd.getCurrentTransform());
   return b;
 }
 
 Square *parseSquareBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto s = new Square(pd.s, &m);
+  auto s = pd.s->arena().create<Square>(pd.s, &m);
   s->setTransform(pd.getCurrentTransform());
   return s;
 }
 
 Cylinder *parseCylinderBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto c = new Cylinder(pd.s, &m);
+  auto c = pd.s->arena().create<Cylinder>(pd.s, &m);
   c->setTransform(pd.getCurrentTransform());
   IGNORE_MISSING(c->setCapped(j.at("capped").get<bool>()));
   return c;
@@ -175,48 +181,74 @@ Cone *parseConeBody(const json &j, ParseData &pd) {
   IGNORE_MISSING(j.at("height").get_to(height));
   IGNORE_MISSING(j.at("capped").get_to(capped));
 
-  auto c = new Cone(pd.s, &m, height, bottomRadius, topRadius, capped);
+  auto c = pd.s->arena().create<Cone>(pd.s, &m, height, bottomRadius,
+                                      topRadius, capped);
   c->setTransform(pd.getCurrentTransform());
   return c;
 }
 
 Trimesh *parseTrimeshBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto t = new Trimesh(pd.s, &m, pd.getCurrentTransform());
+  auto t = pd.s->arena().create<Trimesh>(pd.s, &m, pd.getCurrentTransform());
   bool genNormals = false;
 
-  glm::dvec3 point;
-  for (const json &pt_json : j.at("points")) {
-    pt_json.get_to(point);
-    t->addVertex(point);
+  // JsonSceneSax normally leaves placeholders for the big arrays; the data
+  // itself is moved into the mesh.
+  size_t index;
+  if (streamedMeshIndex(j.at("points"), index)) {
+    t->setVertices(std::move(pd.meshes.at(index).points));
+  } else {
+    glm::dvec3 point;
+    for (const json &pt_json : j.at("points")) {
+      pt_json.get_to(point);
+      t->addVertex(point);
+    }
   }
 
-  std::vector<int> face;
-  for (const json &f_json : j.at("faces")) {
-    bool success = false;
-    f_json.get_to(face);
-    if (face.size() == 3) {
-      success = t->addFace(face[0], face[1], face[2]);
-    } else if (face.size() == 4) {
-      success = t->addFace(face[0], face[1], face[2]);
-      success &= t->addFace(face[0], face[2], face[3]);
-    } else {
-      auto s = std::to_string(face.size());
-      throw ParserException("Got " + s +
-                            " indices in a face: must be 3 or 4 indices");
+  if (streamedMeshIndex(j.at("faces"), index)) {
+    std::vector<int> &tris = pd.meshes.at(index).triangles;
+    t->reserveFaces(tris.size() / 3);
+    for (size_t f = 0; f < tris.size(); f += 3) {
+      if (!t->addFace(tris[f], tris[f + 1], tris[f + 2])) {
+        std::ostringstream ss;
+        ss << "Error while adding face [" << tris[f] << "," << tris[f + 1]
+           << "," << tris[f + 2] << "]. Maybe the point doesn't exist?";
+        throw ParserException(ss.str());
+      }
     }
+    std::vector<int>().swap(tris);
+  } else {
+    std::vector<int> face;
+    for (const json &f_json : j.at("faces")) {
+      bool success = false;
+      f_json.get_to(face);
+      if (face.size() == 3) {
+        success = t->addFace(face[0], face[1], face[2]);
+      } else if (face.size() == 4) {
+        success = t->addFace(face[0], face[1], face[2]);
+        success &= t->addFace(face[0], face[2], face[3]);
+      } else {
+        auto s = std::to_string(face.size());
+        throw ParserException("Got " + s +
+                              " indices in a face: must be 3 or 4 indices");
+      }
 
-    if (!success) {
-      throw ParserException("Error while adding face " + to_string(f_json) +
-                            ". Maybe the point doesn't exist?");
+      if (!success) {
+        throw ParserException("Error while adding face " + to_string(f_json) +
+                              ". Maybe the point doesn't exist?");
+      }
     }
   }
 
   if (hasKey(j, "normals")) {
-    glm::dvec3 normal;
-    for (const json &n_json : j.at("normals")) {
-      n_json.get_to(normal);
-      t->addNormal(normal);
+    if (streamedMeshIndex(j.at("normals"), index)) {
+      t->setNormals(std::move(pd.meshes.at(index).normals));
+    } else {
+      glm::dvec3 normal;
+      for (const json &n_json : j.at("normals")) {
+        n_json.get_to(normal);
+        t->addNormal(normal);
+      }
     }
     t->vertNorms = true;
   }
@@ -340,11 +372,10 @@ std::vector<Geometry *> parseTransform(const json &j, ParseData &pd) {
 }
 
 Scene *JsonParser::parseScene() {
-  // Allow comments and exceptions while parsing
-  json j = json::parse(this->contents);
+  ParseData pd;
+  json j = parseSceneJson(this->contents, pd.meshes);
 
   Scene *scene = new Scene();
-  ParseData pd;
   pd.s = scene;
   pd.scene_dir = this->fileDirPath;
 
@@ -395,33 +426,100 @@ void MaterialFromTinyObj(Material *target, tinyobj::material_t mat) {
   target->setIndex(mat.ior);
 }
 
-// Cantor hash function. We need at least 64 bits in the computation, since the
-// 32-bit computation potentially overflows when a + b = 2**16 (way too small)
-size_t hash2(uint64_t a, uint64_t b) { return ((a + b) * (a + b + 1) / 2) + b; }
-size_t hash3(uint64_t a, uint64_t b, uint64_t c) {
-  return hash2(hash2(a, b), c);
-}
-struct TinyObjIndexHash {
-  std::size_t operator()(const tinyobj::index_t &i) const {
-    return hash3(i.vertex_index, i.normal_index, i.texcoord_index);
+/* Maps v/vt/vn combinations to linear vertex indices. Open addressing with
+linear probing: one flat array, no allocation per entry, and the keys are
+small enough to compare directly. */
+class ObjIndexMap {
+public:
+  explicit ObjIndexMap(size_t expected) {
+    size_t cap = 16;
+    while (cap < expected * 2)
+      cap *= 2;
+    slots.assign(cap, Slot{{-1, -1, -1}, -1});
   }
-};
-struct TinyObjIndexEq {
-  bool operator()(const tinyobj::index_t &a, const tinyobj::index_t &b) const {
-    return a.vertex_index == b.vertex_index &&
-           a.normal_index == b.normal_index &&
-           a.texcoord_index == b.texcoord_index;
+
+  size_t size() const { return count; }
+
+  // Return the index stored for c, or insert c with index `next` and
+  // return that. inserted says which happened.
+  int findOrInsert(const ObjCorner &c, int next, bool &inserted) {
+    if ((count + 1) * 2 > slots.size())
+      grow();
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash(c) & mask;; i = (i + 1) & mask) {
+      Slot &s = slots[i];
+      if (s.index < 0) {
+        s = Slot{c, next};
+        ++count;
+        inserted = true;
+        return next;
+      }
+      if (s.key.v == c.v && s.key.vt == c.vt && s.key.vn == c.vn) {
+        inserted = false;
+        return s.index;
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    ObjCorner key;
+    int index; // -1 for an empty slot
+  };
+
+  static size_t hash(const ObjCorner &c) {
+    uint64_t h = uint32_t(c.v);
+    h = h * 0x9E3779B97F4A7C15ull + uint32_t(c.vt);
+    h = h * 0x9E3779B97F4A7C15ull + uint32_t(c.vn);
+    return size_t(h ^ (h >> 29));
+  }
+
+  void grow() {
+    std::vector<Slot> old(slots.size() * 2, Slot{{-1, -1, -1}, -1});
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (const Slot &s : old) {
+      if (s.index < 0)
+        continue;
+      size_t i = hash(s.key) & mask;
+      while (slots[i].index >= 0)
+        i = (i + 1) & mask;
+      slots[i] = s;
+    }
   }
+
+  std::vector<Slot> slots;
+  size_t count = 0;
 };
 
 /* The full OBJ file format is chaotic neutral. To try to tame some of this, we
 only support certain features. See jsonformat.md for the limitations.
+
+materials holds one Material per OBJ material; faces without one use
+defaultMaterial. Only touches t, so shapes can be loaded into their meshes in
+parallel. Returns the number of vertices created.
 */
-Trimesh *loadObjToTrimesh(const tinyobj::ObjReader &rdr,
-                          const tinyobj::shape_t &s, Trimesh *t,
-                          ParseData &pd) {
-  auto &attrib = rdr.GetAttrib();
-  auto &materials = rdr.GetMaterials();
+size_t loadObjGeometry(const ObjData &obj, const ObjShape &s,
+                       const std::vector<Material> &materials,
+                       const Material &defaultMaterial, Trimesh *t) {
+  /* A shape that uses a single material just gets it as the mesh material.
+     Otherwise the mesh is given a palette of the materials its faces use,
+     in order of first use, and each face an index into it. */
+  std::vector<int> paletteIndex(materials.size() + 1, -1); // [id + 1]
+  bool uniform = std::all_of(
+      s.materialIds.begin(), s.materialIds.end(),
+      [&](int id) { return id == s.materialIds.front(); });
+  int first = s.materialIds.empty() ? -1 : s.materialIds.front();
+  Material meshMaterial =
+      uniform && first >= 0 ? materials[first] : defaultMaterial;
+  t->setMaterial(&meshMaterial);
+  if (!uniform) {
+    for (int id : s.materialIds) {
+      if (paletteIndex[id + 1] < 0)
+        paletteIndex[id + 1] =
+            t->addMaterial(id < 0 ? defaultMaterial : materials[id]);
+    }
+  }
 
   /* Faces in OBJ files can use different indices for
      UV/normals/positions. For example, naively you can specify a face as
@@ -435,109 +533,61 @@ Trimesh *loadObjToTrimesh(const tinyobj::ObjReader &rdr,
      in the Trimesh. This increases memory usage slightly, but most renderers
      (incl. OpenGL) need separate arrays of indices anyways.
   */
-
-  bool warned = false;
-  std::unordered_map<tinyobj::index_t, int, TinyObjIndexHash, TinyObjIndexEq>
-      indexMap;
-
-  // If this v/vt/vn combination has been seen before, return the linear
-  // index. Otherwise, create it by inserting the combination into the
-  // mesh.
-  auto getOrCreateLinearIndex = [&attrib, &indexMap, &warned,
-                                 t](tinyobj::index_t i) {
-    if (indexMap.find(i) == indexMap.end()) {
-      if (indexMap.size() > MAX_RECOMMENDED_VERTS && !warned) {
-        std::cerr << "WARN: Detected many vertices in OBJ input. This may "
-                     "cause memory problems. Consider decimating the mesh."
-                  << std::endl;
-        warned = true;
-      }
-
-      indexMap[i] = indexMap.size();
-      t->addVertex(glm::make_vec3(&attrib.vertices[3 * i.vertex_index]));
-      if (i.normal_index != -1) {
-        auto n = glm::make_vec3(&attrib.normals[3 * i.normal_index]);
-        // OBJ normals are not required to be normalized; ours are
-        t->addNormal(glm::normalize(n));
-      }
-
-      if (i.texcoord_index != -1) {
-        t->addUV(glm::make_vec2(&attrib.texcoords[2 * i.texcoord_index]));
-      }
-      if (attrib.colors.size() > 0) {
-        t->addColor(glm::make_vec3(&attrib.colors[3 * i.vertex_index]));
-      }
+  ObjIndexMap indexMap(s.corners.size() / 2);
+  std::vector<int> linear(s.corners.size());
+  std::vector<glm::dvec3> vertices, normals, colors;
+  std::vector<glm::dvec2> uvs;
+  vertices.reserve(s.corners.size() / 2);
+
+  for (size_t i = 0; i < s.corners.size(); ++i) {
+    const ObjCorner &c = s.corners[i];
+    bool inserted;
+    linear[i] = indexMap.findOrInsert(c, int(vertices.size()), inserted);
+    if (!inserted)
+      continue;
+
+    vertices.push_back(glm::make_vec3(&obj.vertices[3 * c.v]));
+    if (c.vn != -1) {
+      auto n = glm::make_vec3(&obj.normals[3 * c.vn]);
+      // OBJ normals are not required to be normalized; ours are
+      normals.push_back(glm::normalize(n));
     }
-    return indexMap[i];
-  };
-
-  // TinyOBJ triangulates for us, so we don't have to check for larger
-  // faces
-  for (long unsigned f = 0; f < s.mesh.indices.size(); f += 3) {
-    auto i0 = getOrCreateLinearIndex(s.mesh.indices[f]);
-    auto i1 = getOrCreateLinearIndex(s.mesh.indices[f + 1]);
-    auto i2 = getOrCreateLinearIndex(s.mesh.indices[f + 2]);
-    t->addFace(i0, i1, i2);
+    if (c.vt != -1)
+      uvs.push_back(glm::make_vec2(&obj.texcoords[2 * c.vt]));
+    if (!obj.colors.empty())
+      colors.push_back(glm::make_vec3(&obj.colors[3 * c.v]));
   }
 
-  /* Finished parsing geometry, now parse materials. The parser currently
-  only supports a single material per mesh, because to do otherwise
-  would require modification of the Trimesh class itself.
-
-  If you want to support multiple materials, you need to do the following:
-
-       1. Modify the Trimesh class to support multiple materials in an
-          array or vector
-       2. Loop over the `materials` array here and place each material in
-          the materials vector in the Trimesh
-       3. For each face with index f, access s.mesh.material_ids[f] to get
-          the index of the material for that face. Record this
-          information in the Trimesh somehow (perhaps modifying the
-          addFace method)
-       4. When rendering an intersection with a face, look up the
-          corresponding material in the Trimesh, then use that as the
-          material for the intersection phase (including barycentric
-          interpolation of the material if it is called for).
-
-// Face f should render using materials[k]
-auto k = s.mesh.material_ids[f];
-*/
-
-  // Take the first material associated with the mesh and use it.
-  Material *m = new Material();
-  if (materials.size() > 0) {
-    tinyobj::material_t mtl = materials[0];
-    m->setDiffuse(glm::make_vec3(mtl.diffuse));
-    m->setSpecular(glm::make_vec3(mtl.specular));
-    m->setAmbient(glm::make_vec3(mtl.ambient));
-    m->setTransmissive(glm::make_vec3(mtl.transmittance));
-    m->setEmissive(glm::make_vec3(mtl.emission));
-    m->setShininess(mtl.shininess);
-    m->setIndex(mtl.ior);
-
-    if (!mtl.diffuse_texname.empty()) {
-      std::string texPath = pd.scene_dir / mtl.diffuse_texname;
-      m->setDiffuse(MaterialParameter(pd.s->getTexture(texPath)));
-    }
-
-    if (!mtl.specular_texname.empty()) {
-      std::string texPath = pd.scene_dir / mtl.specular_texname;
-      m->setSpecular(MaterialParameter(pd.s->getTexture(texPath)));
-    }
+  size_t vertexCount = vertices.size();
+  t->setVertices(std::move(vertices));
+  t->setNormals(std::move(normals));
+  t->setUVs(std::move(uvs));
+  t->setColors(std::move(colors));
+
+  // Every shape from loadObj() is already triangulated
+  t->reserveFaces(linear.size() / 3);
+  for (size_t f = 0; f < linear.size(); f += 3) {
+    int material = uniform ? 0 : paletteIndex[s.materialIds[f / 3] + 1];
+    t->addFace(linear[f], linear[f + 1], linear[f + 2], material);
   }
+  return vertexCount;
+}
 
-  t->setMaterial(m);
+// Convert an OBJ material, loading any textures it refers to.
+Material loadObjMaterial(const tinyobj::material_t &mtl, ParseData &pd) {
+  Material m;
+  MaterialFromTinyObj(&m, mtl);
 
-  if (attrib.normals.size() > 0) {
-    t->vertNorms = true;
+  if (!mtl.diffuse_texname.empty()) {
+    std::string texPath = pd.scene_dir / mtl.diffuse_texname;
+    m.setDiffuse(MaterialParameter(pd.s->getTexture(texPath)));
   }
 
-  const char *err = t->doubleCheck();
-  if (err != nullptr) {
-    throw ParserException("Error while parsing OBJ file: " + std::string(err));
+  if (!mtl.specular_texname.empty()) {
+    std::string texPath = pd.scene_dir / mtl.specular_texname;
+    m.setSpecular(MaterialParameter(pd.s->getTexture(texPath)));
   }
-
-  return t;
+  return m;
 }
 
 std::vector<Trimesh *> parseObjmeshBody(const json &j, ParseData &pd) {
@@ -546,52 +596,65 @@ std::vector<Trimesh *> parseObjmeshBody(const json &j, ParseData &pd) {
   bool genNormals = false;
   IGNORE_MISSING(j.at("gennormals").get_to(genNormals));
 
-  std::vector<Trimesh *> results;
-
-  tinyobj::ObjReaderConfig reader_config;
-  reader_config.mtl_search_path = pd.scene_dir;
-  reader_config.triangulate = true;
-  reader_config.vertex_color = false; // Populate vertex colors only if
-                                      // *all* vertices have associated colors
-  tinyobj::ObjReader reader;
-  bool success = reader.ParseFromFile(path, reader_config);
-
-  if (!success) {
-    if (!reader.Error().empty()) {
-      throw ParserException("Error while parsing OBJ file: " + reader.Error());
-    } else {
-      throw ParserException("Error while parsing OBJ file: unknown "
-                            "(tinyobj returned an error with no message)");
-    }
-  }
-  if (!reader.Warning().empty()) {
-    std::cerr << "TinyObj warnings: " << reader.Warning();
+  // Throws ParserException on failure
+  ObjData obj = loadObj(path, pd.scene_dir, traceUI->getThreads());
+  if (!obj.warnings.empty()) {
+    std::cerr << "OBJ warnings: " << obj.warnings;
   }
 
-  auto &attrib = reader.GetAttrib();
-  auto &shapes = reader.GetShapes();
-
-  if (attrib.vertices.size() / 3 > MAX_RECOMMENDED_VERTS) {
+  if (obj.vertices.size() / 3 > MAX_RECOMMENDED_VERTS) {
     std::cerr << "Warning: OBJ file " << objFile << " has "
-              << attrib.vertices.size() / 3 << " vertices. "
+              << obj.vertices.size() / 3 << " vertices. "
               << "This may cause an out-of-memory condition. "
               << "Consider reducing the number of vertices in the "
                  "OBJ file."
               << std::endl;
   }
 
-  for (const tinyobj::shape_t &s : shapes) {
-    Trimesh *t = new Trimesh(pd.s, &pd.cur_mat, pd.getCurrentTransform());
+  // Faces without a material use the first one in the file, if any
+  if (obj.materials.size() >= Trimesh::MAX_MATERIALS) {
+    throw ParserException("Error while parsing OBJ file: too many materials");
+  }
+  std::vector<Material> materials;
+  for (const tinyobj::material_t &mtl : obj.materials) {
+    materials.push_back(loadObjMaterial(mtl, pd));
+  }
+  Material defaultMaterial = materials.empty() ? Material() : materials[0];
 
-    loadObjToTrimesh(reader, s, t, pd);
+  std::vector<Trimesh *> results;
+  for (size_t i = 0; i < obj.shapes.size(); ++i) {
+    results.push_back(pd.s->arena().create<Trimesh>(
+        pd.s, &pd.cur_mat, pd.getCurrentTransform()));
+  }
 
-    if (genNormals) {
-      t->generateNormals();
+  // The shapes are independent, so fill the meshes in parallel
+  std::vector<size_t> vertexCounts(results.size());
+  parallelFor(obj.shapes.size(), traceUI->getThreads(), [&](size_t i) {
+    vertexCounts[i] = loadObjGeometry(obj, obj.shapes[i], materials,
+                                      defaultMaterial, results[i]);
+  });
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    Trimesh *t = results[i];
+    if (vertexCounts[i] > MAX_RECOMMENDED_VERTS) {
+      std::cerr << "WARN: Detected many vertices in OBJ input. This may "
+                   "cause memory problems. Consider decimating the mesh."
+                << std::endl;
     }
 
+    if (!obj.normals.empty()) {
+      t->vertNorms = true;
+    }
 
+    const char *err = t->doubleCheck();
+    if (err != nullptr) {
+      throw ParserException("Error while parsing OBJ file: " +
+                            std::string(err));
+    }
 
-    results.push_back(t);
+    if (genNormals) {
+      t->generateNormals();
+    }
   }
   return results;
 }
@@ -37,6 +37,7 @@ using json = nlohmann::json;
 #include "../SceneObjects/trimesh.h"
 #include "../scene/light.h"
 #include "../scene/scene.h"
+#include "JsonSax.h"
 
 typedef std::map<string, Material> mmap;
 
@@ -53,6 +54,7 @@ struct ParseData {
   std::vector<glm::dmat4> transformStack;
   Scene *s;
   std::filesystem::path scene_dir;
+  std::vector<StreamedMesh> meshes; // tri_mesh arrays read by JsonSceneSax
 
   glm::dmat4 getCurrentTransform();
 };
@@ -61,10 +63,11 @@ Camera parseCamera(const json &j);
 MaterialParameter parseMaterialParameter(const json &j, ParseData &pd);
 Material parseMaterial(const json &j, ParseData &pd);
 
-/* Because the Scene manages Lights and Geometry lifetimes (calling delete when
-the Scene is dropped), we allocate our lights as raw pointers with new and
-pass those pointers into the Scene. AmbientLight is weird because it's not
-actually a light (see comments in scene.h for details) */
+/* Because the Scene manages Lights and Geometry lifetimes (they live in its
+arena and are destroyed along with it), we create our lights with
+Scene::arena() and pass the resulting raw pointers into the Scene.
+AmbientLight is weird because it's not actually a light (see comments in
+scene.h for details) */
 
 DirectionalLight *parseDirectionalLight(const json &j);
 PointLight *parsePointLight(const json &j);
@@ -82,18 +85,17 @@ std::vector<Geometry *> parseGeometry(const json &j, ParseData &pd);
 std::vector<Geometry *> parseTransform(const json &j, ParseData &pd);
 std::vector<Geometry *> parseGeometryOrTransform(const json &j, ParseData &pd);
 
+/* contents is the text of the scene file (usually a MappedFile) and must
+outlive the parser. It is read with JsonSceneSax, so big tri_mesh arrays go
+straight into mesh storage instead of through the json DOM. */
 class JsonParser {
 public:
-  JsonParser(std::string pathToJson, std::ifstream &ifs)
-      : fileDirPath(pathToJson) {
-    std::ostringstream sstr;
-    sstr << ifs.rdbuf();
-    this->contents = sstr.str();
-  };
+  JsonParser(std::string pathToJson, std::string_view contents)
+      : contents(contents), fileDirPath(pathToJson) {}
 
   Scene *parseScene();
 
 private:
-  std::string contents;
+  std::string_view contents;
   std::string fileDirPath;
 };
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "JsonSax.h"
+#include "ParserException.h"
+
+// Add a value at the current position in the DOM: appended to the innermost
+// array, or stored under the last key of the innermost object.
+template <typename Value> json *JsonSceneSax::addValue(Value &&v) {
+  if (stack.empty()) {
+    root = json(std::forward<Value>(v));
+    return &root;
+  }
+  if (stack.back()->is_array()) {
+    stack.back()->emplace_back(std::forward<Value>(v));
+    return &stack.back()->back();
+  }
+  *objectElement = json(std::forward<Value>(v));
+  return objectElement;
+}
+
+void JsonSceneSax::badMeshArray() const {
+  const char *name = capture == POINTS    ? "points"
+                     : capture == NORMALS ? "normals"
+                                          : "faces";
+  throw ParserException(std::string("tri_mesh \"") + name +
+                        "\" must be an array of arrays of numbers");
+}
+
+bool JsonSceneSax::addNumber(double v) {
+  if (captureDepth != 2)
+    badMeshArray();
+  if (tupleSize < 4)
+    tuple[tupleSize] = v;
+  ++tupleSize;
+  return true;
+}
+
+bool JsonSceneSax::null() {
+  if (capture != NONE)
+    badMeshArray();
+  addValue(nullptr);
+  return true;
+}
+
+bool JsonSceneSax::boolean(bool val) {
+  if (capture != NONE)
+    badMeshArray();
+  addValue(val);
+  return true;
+}
+
+bool JsonSceneSax::number_integer(number_integer_t val) {
+  if (capture != NONE)
+    return addNumber(double(val));
+  addValue(val);
+  return true;
+}
+
+bool JsonSceneSax::number_unsigned(number_unsigned_t val) {
+  if (capture != NONE)
+    return addNumber(double(val));
+  addValue(val);
+  return true;
+}
+
+bool JsonSceneSax::number_float(number_float_t val, const string_t &) {
+  if (capture != NONE)
+    return addNumber(val);
+  addValue(val);
+  return true;
+}
+
+bool JsonSceneSax::string(string_t &val) {
+  if (capture != NONE)
+    badMeshArray();
+  addValue(std::move(val));
+  return true;
+}
+
+bool JsonSceneSax::binary(binary_t &val) {
+  addValue(json::binary_t(std::move(val)));
+  return true;
+}
+
+bool JsonSceneSax::start_object(std::size_t) {
+  if (capture != NONE)
+    badMeshArray();
+  bool inArray = stack.empty() || stack.back()->is_array();
+  openedUnder.push_back(inArray ? std::string() : lastKey);
+  stack.push_back(addValue(json::object()));
+  if (openedUnder.back() == "tri_mesh")
+    meshes.emplace_back();
+  return true;
+}
+
+bool JsonSceneSax::key(string_t &val) {
+  lastKey = val;
+  objectElement = &(*stack.back())[val];
+  return true;
+}
+
+bool JsonSceneSax::end_object() {
+  stack.pop_back();
+  openedUnder.pop_back();
+  return true;
+}
+
+bool JsonSceneSax::start_array(std::size_t) {
+  if (capture != NONE) {
+    if (++captureDepth > 2)
+      badMeshArray();
+    tupleSize = 0;
+    return true;
+  }
+
+  // Is this one of the big arrays of a tri_mesh?
+  bool inObject = !stack.empty() && stack.back()->is_object();
+  if (inObject && openedUnder.back() == "tri_mesh") {
+    if (lastKey == "points")
+      capture = POINTS;
+    else if (lastKey == "normals")
+      capture = NORMALS;
+    else if (lastKey == "faces")
+      capture = FACES;
+    if (capture != NONE) {
+      captureDepth = 1;
+      addValue(json::binary({}, meshes.size() - 1));
+      return true;
+    }
+  }
+
+  bool inArray = stack.empty() || stack.back()->is_array();
+  openedUnder.push_back(inArray ? std::string() : lastKey);
+  stack.push_back(addValue(json::array()));
+  return true;
+}
+
+bool JsonSceneSax::end_array() {
+  if (capture == NONE) {
+    stack.pop_back();
+    openedUnder.pop_back();
+    return true;
+  }
+
+  if (--captureDepth == 0) {
+    capture = NONE;
+    return true;
+  }
+
+  StreamedMesh &mesh = meshes.back();
+  if (capture == FACES) {
+    if (tupleSize != 3 && tupleSize != 4)
+      throw ParserException("Got " + std::to_string(tupleSize) +
+                            " indices in a face: must be 3 or 4 indices");
+    int a = int(tuple[0]), b = int(tuple[1]), c = int(tuple[2]);
+    mesh.triangles.insert(mesh.triangles.end(), {a, b, c});
+    if (tupleSize == 4)
+      mesh.triangles.insert(mesh.triangles.end(), {a, c, int(tuple[3])});
+  } else {
+    if (tupleSize < 3)
+      throw ParserException("Expected 3 components in a tri_mesh point or "
+                            "normal, got " + std::to_string(tupleSize));
+    glm::dvec3 v(tuple[0], tuple[1], tuple[2]);
+    if (capture == POINTS)
+      mesh.points.push_back(v);
+    else
+      mesh.normals.push_back(v);
+  }
+  return true;
+}
+
+bool JsonSceneSax::parse_error(std::size_t, const std::string &,
+                               const nlohmann::detail::exception &ex) {
+  throw ex;
+}
+
+json parseSceneJson(std::string_view text, std::vector<StreamedMesh> &meshes) {
+  json root;
+  JsonSceneSax sax(root, meshes);
+  json::sax_parse(text.data(), text.data() + text.size(), &sax);
+  return root;
+}
@@ -0,0 +1,87 @@
+#ifndef __JSONSAX_H__
+#define __JSONSAX_H__
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include <json.hpp>
+using json = nlohmann::json;
+
+/* The bulk of a tri_mesh, captured while the scene file is being read. */
+struct StreamedMesh {
+  std::vector<glm::dvec3> points;
+  std::vector<glm::dvec3> normals;
+  std::vector<int> triangles; // 3 indices per face; quads are split in two
+};
+
+/* A SAX handler that builds the same DOM as json::parse(), except for the
+"points", "faces" and "normals" arrays of tri_mesh objects. Those are
+decoded straight into a StreamedMesh as their numbers arrive, so a mesh with
+millions of vertices never exists as millions of json nodes.
+
+In the DOM, each captured array is replaced by a binary value whose subtype
+is the index of its StreamedMesh; see streamedMeshIndex(). JSON text has no
+binary values, so the placeholder can't clash with anything in the file. */
+class JsonSceneSax : public nlohmann::json_sax<json> {
+public:
+  JsonSceneSax(json &root, std::vector<StreamedMesh> &meshes)
+      : root(root), meshes(meshes) {}
+
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &s) override;
+  bool string(string_t &val) override;
+  bool binary(binary_t &val) override;
+
+  bool start_object(std::size_t elements) override;
+  bool key(string_t &val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+
+  bool parse_error(std::size_t position, const std::string &last_token,
+                   const nlohmann::detail::exception &ex) override;
+
+private:
+  enum Capture { NONE, POINTS, NORMALS, FACES };
+
+  template <typename Value> json *addValue(Value &&v);
+  bool addNumber(double v);
+  [[noreturn]] void badMeshArray() const;
+
+  json &root;
+  std::vector<StreamedMesh> &meshes;
+
+  // Containers currently open in the DOM, and the key each was opened
+  // under ("" inside arrays).
+  std::vector<json *> stack;
+  std::vector<std::string> openedUnder;
+  json *objectElement = nullptr;
+  std::string lastKey;
+
+  // Which tri_mesh array, if any, is being captured, and how deep into it
+  // we are (1 for the array itself, 2 for a point or face).
+  Capture capture = NONE;
+  int captureDepth = 0;
+  double tuple[4];
+  int tupleSize = 0;
+};
+
+// Parse a whole scene file, streaming tri_mesh arrays into meshes.
+json parseSceneJson(std::string_view text, std::vector<StreamedMesh> &meshes);
+
+// If j is a placeholder left by JsonSceneSax, return its mesh index.
+inline bool streamedMeshIndex(const json &j, size_t &index) {
+  if (!j.is_binary() || !j.get_binary().has_subtype())
+    return false;
+  index = size_t(j.get_binary().subtype());
+  return true;
+}
+
+#endif // __JSONSAX_H__
@@ -0,0 +1,477 @@
+#include "ObjLoader.h"
+#include "../fileio/mappedfile.h"
+#include "../scene/parallel.h"
+#include "../scene/timeline.h"
+#include "ParserException.h"
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string.h>
+#include <string_view>
+
+namespace {
+
+// Chunks smaller than this aren't worth a thread of their own.
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+enum EventKind { GROUP, OBJECT, USEMTL, MTLLIB };
+
+// A line that changes the parser state rather than adding data.
+struct Event {
+  EventKind kind;
+  size_t face;     // faces in the chunk before this line
+  std::string arg; // group/object name, material name or mtllib line
+  int materialId;  // USEMTL only: resolved once the .mtl files are read
+};
+
+// A corner index that was negative, i.e. relative to the number of
+// attributes read so far. It is stored relative to the start of its chunk
+// and shifted once the chunk's place in the file is known.
+struct Fixup {
+  size_t corner;
+  int attribute; // 0 = v, 1 = vt, 2 = vn
+};
+
+// A run of triangles that belongs to one shape.
+struct Piece {
+  bool startsShape; // a "g" or "o" line came before it
+  std::string name;
+  std::vector<ObjCorner> corners;
+  std::vector<int> materialIds;
+};
+
+struct Chunk {
+  const char *begin;
+  const char *end;
+
+  std::vector<double> v, vn, vt, vc;
+  bool allColors = true;
+  std::vector<ObjCorner> corners;
+  std::vector<uint32_t> faceSizes;
+  std::vector<Fixup> fixups;
+  std::vector<Event> events;
+
+  const char *errorAt = nullptr;
+  std::string error;
+  std::string warnings;
+
+  // Set while merging.
+  size_t vBase = 0, vtBase = 0, vnBase = 0;
+  int startMaterial = -1;
+
+  std::vector<Piece> pieces;
+};
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+inline void skipSpace(const char *&p, const char *end) {
+  while (p < end && isSpace(*p))
+    ++p;
+}
+
+// Parse a number, leaving `out` alone if there isn't one.
+inline bool parseReal(const char *&p, const char *end, double &out) {
+  skipSpace(p, end);
+  if (p < end && *p == '+')
+    ++p;
+  auto res = std::from_chars(p, end, out);
+  if (res.ec != std::errc())
+    return false;
+  p = res.ptr;
+  return true;
+}
+
+inline std::string_view nextWord(const char *&p, const char *end) {
+  skipSpace(p, end);
+  const char *start = p;
+  while (p < end && !isSpace(*p))
+    ++p;
+  return std::string_view(start, p - start);
+}
+
+class ChunkParser {
+public:
+  explicit ChunkParser(Chunk &c) : c(c) {}
+
+  void run() {
+    const char *p = c.begin;
+    while (p < c.end && !c.errorAt) {
+      const char *eol =
+          static_cast<const char *>(memchr(p, '\n', c.end - p));
+      if (!eol)
+        eol = c.end;
+      const char *lineEnd = eol;
+      if (lineEnd > p && lineEnd[-1] == '\r')
+        --lineEnd;
+      parseLine(p, lineEnd);
+      p = eol + 1;
+    }
+  }
+
+private:
+  void fail(const char *at, const char *msg) {
+    c.errorAt = at;
+    c.error = msg;
+  }
+
+  void addEvent(EventKind kind, std::string arg) {
+    c.events.push_back({kind, c.faceSizes.size(), std::move(arg), -1});
+  }
+
+  // One v, v/vt, v//vn or v/vt/vn corner of a face.
+  bool parseCorner(const char *&p, const char *end) {
+    ObjCorner corner{-1, -1, -1};
+    int *slots[3] = {&corner.v, &corner.vt, &corner.vn};
+    size_t counts[3] = {c.v.size() / 3, c.vt.size() / 2, c.vn.size() / 3};
+
+    for (int a = 0; a < 3; ++a) {
+      if (a > 0) {
+        if (p >= end || *p != '/')
+          break;
+        ++p;
+        if (p < end && *p == '/') // v//vn
+          continue;
+      }
+      int idx;
+      auto res = std::from_chars(p, end, idx);
+      if (res.ec != std::errc() || idx == 0)
+        return false;
+      p = res.ptr;
+      if (idx > 0) {
+        *slots[a] = idx - 1;
+      } else {
+        *slots[a] = int(counts[a]) + idx;
+        c.fixups.push_back({c.corners.size(), a});
+      }
+    }
+    c.corners.push_back(corner);
+    return true;
+  }
+
+  void parseLine(const char *p, const char *end) {
+    skipSpace(p, end);
+    if (p >= end || *p == '#')
+      return;
+    size_t len = end - p;
+
+    if (len > 1 && p[0] == 'v' && isSpace(p[1])) {
+      p += 2;
+      double x = 0, y = 0, z = 0, r = 1, g = 1, b = 1;
+      parseReal(p, end, x);
+      parseReal(p, end, y);
+      parseReal(p, end, z);
+      bool color =
+          parseReal(p, end, r) && parseReal(p, end, g) && parseReal(p, end, b);
+      if (!color)
+        r = g = b = 1;
+      c.allColors &= color;
+      c.v.insert(c.v.end(), {x, y, z});
+      c.vc.insert(c.vc.end(), {r, g, b});
+    } else if (len > 2 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+      p += 3;
+      double x = 0, y = 0, z = 0;
+      parseReal(p, end, x);
+      parseReal(p, end, y);
+      parseReal(p, end, z);
+      c.vn.insert(c.vn.end(), {x, y, z});
+    } else if (len > 2 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+      p += 3;
+      double u = 0, v = 0;
+      parseReal(p, end, u);
+      parseReal(p, end, v);
+      c.vt.insert(c.vt.end(), {u, v});
+    } else if (len > 1 && p[0] == 'f' && isSpace(p[1])) {
+      const char *line = p;
+      p += 2;
+      size_t first = c.corners.size();
+      for (skipSpace(p, end); p < end; skipSpace(p, end)) {
+        if (!parseCorner(p, end))
+          return fail(line, "bad face (e.g. a zero index)");
+        // anything else up to the next space is ignored
+        while (p < end && !isSpace(*p))
+          ++p;
+      }
+      c.faceSizes.push_back(uint32_t(c.corners.size() - first));
+    } else if (len >= 6 && !strncmp(p, "usemtl", 6) &&
+               (len == 6 || isSpace(p[6]))) {
+      p += 6;
+      addEvent(USEMTL, std::string(nextWord(p, end)));
+    } else if (len > 6 && !strncmp(p, "mtllib", 6) && isSpace(p[6])) {
+      addEvent(MTLLIB, std::string(p + 7, end));
+    } else if (len > 1 && p[0] == 'g' && isSpace(p[1])) {
+      p += 2;
+      std::string name;
+      for (auto w = nextWord(p, end); !w.empty(); w = nextWord(p, end)) {
+        if (!name.empty())
+          name += ' ';
+        name += w;
+      }
+      addEvent(GROUP, std::move(name));
+    } else if (len > 1 && p[0] == 'o' && isSpace(p[1])) {
+      addEvent(OBJECT, std::string(p + 2, end));
+    }
+    // Everything else (lines, points, smoothing groups...) is ignored.
+  }
+
+  Chunk &c;
+};
+
+// Cut [begin, end) into chunks that end on line boundaries.
+std::vector<Chunk> splitIntoChunks(const char *begin, const char *end,
+                                   int threads) {
+  size_t size = end - begin;
+  // A few chunks per thread so that uneven chunks still balance.
+  size_t target = std::max(MIN_CHUNK_SIZE, size / (4 * size_t(threads) + 1));
+
+  std::vector<Chunk> chunks;
+  const char *p = begin;
+  while (p < end) {
+    const char *q = p + std::min(target, size_t(end - p));
+    if (q < end) {
+      const char *nl = static_cast<const char *>(memchr(q, '\n', end - q));
+      q = nl ? nl + 1 : end;
+    }
+    chunks.emplace_back();
+    chunks.back().begin = p;
+    chunks.back().end = q;
+    p = q;
+  }
+  return chunks;
+}
+
+int lineNumber(const char *begin, const char *at) {
+  int line = 1;
+  for (const char *p = begin; p < at; ++p)
+    line += (*p == '\n');
+  return line;
+}
+
+template <typename T>
+void concat(std::vector<T> &out, std::vector<Chunk> &chunks,
+            std::vector<T> Chunk::*member, int threads) {
+  std::vector<size_t> offsets;
+  size_t total = 0;
+  for (auto &c : chunks) {
+    offsets.push_back(total);
+    total += (c.*member).size();
+  }
+  out.resize(total);
+  parallelFor(chunks.size(), threads, [&](size_t i) {
+    std::vector<T> &src = chunks[i].*member;
+    std::copy(src.begin(), src.end(), out.begin() + offsets[i]);
+    std::vector<T>().swap(src);
+  });
+}
+
+// Shift relative indices, check every index and split faces into triangles.
+void triangulateChunk(Chunk &c, const ObjData &obj) {
+  int nv = int(obj.vertices.size() / 3);
+  int nvt = int(obj.texcoords.size() / 2);
+  int nvn = int(obj.normals.size() / 3);
+
+  for (const Fixup &f : c.fixups) {
+    ObjCorner &corner = c.corners[f.corner];
+    if (f.attribute == 0)
+      corner.v += int(c.vBase);
+    else if (f.attribute == 1)
+      corner.vt += int(c.vtBase);
+    else
+      corner.vn += int(c.vnBase);
+  }
+  for (const ObjCorner &corner : c.corners) {
+    if (corner.v < 0 || corner.v >= nv || corner.vt < -1 ||
+        corner.vt >= nvt || corner.vn < -1 || corner.vn >= nvn)
+      throw ParserException("Error while parsing OBJ file: face refers to "
+                            "a vertex, texcoord or normal that doesn't "
+                            "exist");
+  }
+
+  c.pieces.emplace_back();
+  c.pieces.back().startsShape = false;
+  int material = c.startMaterial;
+  size_t nextEvent = 0;
+  auto applyEvents = [&](size_t face) {
+    for (; nextEvent < c.events.size() && c.events[nextEvent].face == face;
+         ++nextEvent) {
+      const Event &e = c.events[nextEvent];
+      if (e.kind == USEMTL) {
+        material = e.materialId;
+      } else if (e.kind == GROUP || e.kind == OBJECT) {
+        c.pieces.emplace_back();
+        c.pieces.back().startsShape = true;
+        c.pieces.back().name = e.arg;
+      }
+    }
+  };
+
+  const ObjCorner *corner = c.corners.data();
+  for (size_t f = 0; f < c.faceSizes.size(); ++f) {
+    applyEvents(f);
+    Piece &piece = c.pieces.back();
+    uint32_t n = c.faceSizes[f];
+    const ObjCorner *fc = corner;
+    corner += n;
+
+    if (n < 3) {
+      c.warnings += "Degenerated face found\n.";
+      continue;
+    }
+    if (n == 4) {
+      // Split along the shorter diagonal, as tinyobj does.
+      const double *p0 = &obj.vertices[3 * fc[0].v];
+      const double *p1 = &obj.vertices[3 * fc[1].v];
+      const double *p2 = &obj.vertices[3 * fc[2].v];
+      const double *p3 = &obj.vertices[3 * fc[3].v];
+      double e02x = p2[0] - p0[0], e02y = p2[1] - p0[1], e02z = p2[2] - p0[2];
+      double e13x = p3[0] - p1[0], e13y = p3[1] - p1[1], e13z = p3[2] - p1[2];
+      double sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+      double sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+      if (sqr02 < sqr13)
+        piece.corners.insert(piece.corners.end(),
+                             {fc[0], fc[1], fc[2], fc[0], fc[2], fc[3]});
+      else
+        piece.corners.insert(piece.corners.end(),
+                             {fc[0], fc[1], fc[3], fc[1], fc[2], fc[3]});
+      piece.materialIds.insert(piece.materialIds.end(), 2, material);
+      continue;
+    }
+    // Triangles, and larger polygons as a fan (assumed convex).
+    for (uint32_t k = 1; k + 1 < n; ++k) {
+      piece.corners.insert(piece.corners.end(), {fc[0], fc[k], fc[k + 1]});
+      piece.materialIds.push_back(material);
+    }
+  }
+  applyEvents(c.faceSizes.size());
+
+  std::vector<ObjCorner>().swap(c.corners);
+  std::vector<uint32_t>().swap(c.faceSizes);
+}
+
+} // namespace
+
+ObjData loadObj(const std::string &path, const std::string &mtlSearchPath,
+                int threads) {
+  TimelineSpan span("load obj", "load", [&path]() { return path; });
+  MappedFile file;
+  if (!file.open(path.c_str()))
+    throw ParserException("Error while parsing OBJ file: cannot open " +
+                          path);
+  const char *begin = file.data().data();
+  const char *end = begin + file.size();
+
+  // 1. Parse the chunks independently.
+  std::vector<Chunk> chunks = splitIntoChunks(begin, end, threads);
+  parallelFor(chunks.size(), threads, [&](size_t i) {
+    TimelineSpan chunk("parse obj chunk", "load",
+                       [i]() { return std::to_string(i); });
+    ChunkParser(chunks[i]).run();
+  });
+
+  for (auto &c : chunks) {
+    if (c.errorAt) {
+      std::ostringstream ss;
+      ss << "Error while parsing OBJ file: " << c.error << " on line "
+         << lineNumber(begin, c.errorAt);
+      throw ParserException(ss.str());
+    }
+  }
+
+  // 2. Stitch the attribute arrays together in file order.
+  ObjData obj;
+  bool allColors = true;
+  size_t vCount = 0, vtCount = 0, vnCount = 0;
+  for (auto &c : chunks) {
+    c.vBase = vCount;
+    c.vtBase = vtCount;
+    c.vnBase = vnCount;
+    vCount += c.v.size() / 3;
+    vtCount += c.vt.size() / 2;
+    vnCount += c.vn.size() / 3;
+    allColors &= c.allColors;
+  }
+  concat(obj.vertices, chunks, &Chunk::v, threads);
+  concat(obj.texcoords, chunks, &Chunk::vt, threads);
+  concat(obj.normals, chunks, &Chunk::vn, threads);
+  if (allColors)
+    concat(obj.colors, chunks, &Chunk::vc, threads);
+  else
+    for (auto &c : chunks)
+      std::vector<double>().swap(c.vc);
+
+  // 3. Read the material libraries, and work out which material is active
+  // at the start of each chunk.
+  tinyobj::MaterialFileReader readMtl(mtlSearchPath);
+  std::map<std::string, int> materialMap;
+  std::set<std::string> loadedLibs;
+  for (auto &c : chunks) {
+    for (auto &e : c.events) {
+      if (e.kind != MTLLIB)
+        continue;
+      std::istringstream names(e.arg);
+      std::string name;
+      bool found = false;
+      while (!found && names >> name) {
+        if (loadedLibs.count(name)) {
+          found = true;
+          break;
+        }
+        std::string warn, err;
+        found = readMtl(name, &obj.materials, &materialMap, &warn, &err);
+        obj.warnings += warn + err;
+        if (found)
+          loadedLibs.insert(name);
+      }
+      if (!found)
+        obj.warnings += "Failed to load material file(s). Use default "
+                        "material.\n";
+    }
+  }
+
+  int material = -1;
+  for (auto &c : chunks) {
+    c.startMaterial = material;
+    for (auto &e : c.events) {
+      if (e.kind != USEMTL)
+        continue;
+      auto it = materialMap.find(e.arg);
+      if (it == materialMap.end())
+        obj.warnings += "material [ '" + e.arg + "' ] not found in .mtl\n";
+      e.materialId = material = it == materialMap.end() ? -1 : it->second;
+    }
+  }
+
+  // 4. Triangulate each chunk, then assemble the shapes in order.
+  parallelFor(chunks.size(), threads,
+              [&](size_t i) { triangulateChunk(chunks[i], obj); });
+
+  ObjShape shape;
+  for (auto &c : chunks) {
+    obj.warnings += c.warnings;
+    for (Piece &piece : c.pieces) {
+      if (piece.startsShape) {
+        if (!shape.corners.empty())
+          obj.shapes.push_back(std::move(shape));
+        shape = ObjShape();
+        shape.name = piece.name;
+      }
+      if (shape.corners.empty()) {
+        shape.corners = std::move(piece.corners);
+        shape.materialIds = std::move(piece.materialIds);
+      } else {
+        shape.corners.insert(shape.corners.end(), piece.corners.begin(),
+                             piece.corners.end());
+        shape.materialIds.insert(shape.materialIds.end(),
+                                 piece.materialIds.begin(),
+                                 piece.materialIds.end());
+      }
+    }
+    std::vector<Piece>().swap(c.pieces);
+  }
+  if (!shape.corners.empty())
+    obj.shapes.push_back(std::move(shape));
+
+  return obj;
+}
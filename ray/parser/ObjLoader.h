@@ -0,0 +1,51 @@
+#ifndef __OBJLOADER_H__
+#define __OBJLOADER_H__
+
+#include <string>
+#include <vector>
+
+// Must match JsonParser.cpp, which holds the tinyobj implementation.
+#ifndef TINYOBJLOADER_USE_DOUBLE
+#define TINYOBJLOADER_USE_DOUBLE
+#endif
+#include "tiny_obj_loader.h"
+
+/* A fast loader for the subset of the OBJ format that obj_mesh supports (see
+jsonformat.md). The file is memory-mapped, cut into chunks at line
+boundaries and the chunks are parsed in parallel; the results are then
+stitched back together in file order. Materials still come from tinyobj's
+.mtl reader.
+
+The output mirrors what tinyobj::ObjReader produces with triangulate = true
+and vertex_color = false, so it can stand in for it: attribute arrays are
+shared by all shapes, shapes are split at "g" and "o" lines, and every face
+is a triangle. Indices are validated, so every corner refers to an existing
+position, and to an existing normal/texcoord or -1. */
+
+struct ObjCorner {
+  int v;  // position
+  int vt; // texcoord, or -1
+  int vn; // normal, or -1
+};
+
+struct ObjShape {
+  std::string name;
+  std::vector<ObjCorner> corners; // 3 per triangle
+  std::vector<int> materialIds;   // 1 per triangle, -1 for none
+};
+
+struct ObjData {
+  std::vector<double> vertices;  // 3 per position
+  std::vector<double> normals;   // 3 per normal
+  std::vector<double> texcoords; // 2 per texcoord
+  std::vector<double> colors;    // 3 per position, or empty
+  std::vector<ObjShape> shapes;
+  std::vector<tinyobj::material_t> materials;
+  std::string warnings;
+};
+
+// Throws ParserException if the file can't be read or is malformed.
+ObjData loadObj(const std::string &path, const std::string &mtlSearchPath,
+                int threads);
+
+#endif // __OBJLOADER_H__
@@ -26,11 +26,11 @@ template <typename T> unique_ptr<T> wrap_unique_ptr(T *pointer) {
 Scene *Parser::parseScene() {
   _tokenizer.Read(SBT_RAYTRACER);
 
-  unique_ptr<Token> versionNumber(_tokenizer.Read(SCALAR));
+  Token versionNumber = _tokenizer.Read(SCALAR);
 
-  if (versionNumber->value() > 1.1) {
+  if (versionNumber.value() > 1.1) {
     ostringstream ost;
-    ost << "SBT-raytracer version number " << versionNumber->value()
+    ost << "SBT-raytracer version number " << versionNumber.value()
         << " too high; only able to parse v1.1 and below.";
     throw ParserException(ost.str());
   }
@@ -39,9 +39,9 @@ Scene *Parser::parseScene() {
   unique_ptr<Material> mat(new Material);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case SPHERE:
     case BOX:
     case SQUARE:
@@ -92,10 +92,10 @@ void Parser::parseCamera(Scene *scene) {
   _tokenizer.Read(LBRACE);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
     glm::dvec4 quaternian;
-    switch (t->kind()) {
+    switch (t.kind()) {
     case POSITION:
       scene->getCamera().setEye(parseVec3dExpression());
       break;
@@ -145,8 +145,8 @@ void Parser::parseCamera(Scene *scene) {
 
 void Parser::parseTransformableElement(Scene *scene, TransformNode *transform,
                                        const Material &mat) {
-  const Token *t = _tokenizer.Peek();
-  switch (t->kind()) {
+  const Token &t = _tokenizer.Peek();
+  switch (t.kind()) {
   case SPHERE:
   case BOX:
   case SQUARE:
@@ -173,8 +173,8 @@ void Parser::parseGroup(Scene *scene, TransformNode *transform,
   unique_ptr<Material> newMat;
   _tokenizer.Read(LBRACE);
   for (;;) {
-    const Token *t = _tokenizer.Peek();
-    switch (t->kind()) {
+    const Token &t = _tokenizer.Peek();
+    switch (t.kind()) {
     case SPHERE:
     case BOX:
     case SQUARE:
@@ -203,8 +203,8 @@ void Parser::parseGroup(Scene *scene, TransformNode *transform,
 
 void Parser::parseGeometry(Scene *scene, TransformNode *transform,
                            const Material &mat) {
-  const Token *t = _tokenizer.Peek();
-  switch (t->kind()) {
+  const Token &t = _tokenizer.Peek();
+  switch (t.kind()) {
   case SPHERE:
     parseSphere(scene, transform, mat);
     return;
@@ -293,8 +293,8 @@ void Parser::parseScale(Scene *scene, TransformNode *transform,
   x = parseScalar();
   _tokenizer.Read(COMMA);
 
-  const Token *next = _tokenizer.Peek();
-  if (SCALAR == next->kind()) {
+  const Token &next = _tokenizer.Peek();
+  if (SCALAR == next.kind()) {
     y = parseScalar();
     _tokenizer.Read(COMMA);
     z = parseScalar();
@@ -342,25 +342,25 @@ void Parser::parseTransform(Scene *scene, TransformNode *transform,
 void Parser::parseSphere(Scene *scene, TransformNode *transform,
                          const Material &mat) {
   Sphere *sphere = 0;
-  Material *newMat = 0;
+  unique_ptr<Material> newMat;
 
   _tokenizer.Read(SPHERE);
   _tokenizer.Read(LBRACE);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case MATERIAL:
-      delete newMat;
-      newMat = parseMaterialExpression(scene, mat);
+      newMat.reset(parseMaterialExpression(scene, mat));
       break;
     case NAME:
       parseIdentExpression();
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      sphere = new Sphere(scene, newMat ? newMat : new Material(mat));
+      sphere = scene->arena().create<Sphere>(
+          scene, newMat ? newMat.get() : &mat);
       sphere->setTransform(transform->transform());
       scene->add(sphere);
       return;
@@ -377,21 +377,21 @@ void Parser::parseBox(Scene *scene, TransformNode *transform,
   _tokenizer.Read(BOX);
   _tokenizer.Read(LBRACE);
 
-  Material *newMat = 0;
+  unique_ptr<Material> newMat;
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case MATERIAL:
-      delete newMat;
-      newMat = parseMaterialExpression(scene, mat);
+      newMat.reset(parseMaterialExpression(scene, mat));
       break;
     case NAME:
       parseIdentExpression();
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      box = new Box(scene, newMat ? newMat : new Material(mat));
+      box = scene->arena().create<Box>(
+          scene, newMat ? newMat.get() : &mat);
       box->setTransform(transform->transform());
       scene->add(box);
       return;
@@ -404,25 +404,25 @@ void Parser::parseBox(Scene *scene, TransformNode *transform,
 void Parser::parseSquare(Scene *scene, TransformNode *transform,
                          const Material &mat) {
   Square *square = 0;
-  Material *newMat = 0;
+  unique_ptr<Material> newMat;
 
   _tokenizer.Read(SQUARE);
   _tokenizer.Read(LBRACE);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case MATERIAL:
-      delete newMat;
-      newMat = parseMaterialExpression(scene, mat);
+      newMat.reset(parseMaterialExpression(scene, mat));
       break;
     case NAME:
       parseIdentExpression();
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      square = new Square(scene, newMat ? newMat : new Material(mat));
+      square = scene->arena().create<Square>(
+          scene, newMat ? newMat.get() : &mat);
       square->setTransform(transform->transform());
       scene->add(square);
       return;
@@ -435,25 +435,25 @@ void Parser::parseSquare(Scene *scene, TransformNode *transform,
 void Parser::parseCylinder(Scene *scene, TransformNode *transform,
                            const Material &mat) {
   Cylinder *cylinder = 0;
-  Material *newMat = 0;
+  unique_ptr<Material> newMat;
 
   _tokenizer.Read(CYLINDER);
   _tokenizer.Read(LBRACE);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case MATERIAL:
-      delete newMat;
-      newMat = parseMaterialExpression(scene, mat);
+      newMat.reset(parseMaterialExpression(scene, mat));
       break;
     case NAME:
       parseIdentExpression();
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      cylinder = new Cylinder(scene, newMat ? newMat : new Material(mat));
+      cylinder = scene->arena().create<Cylinder>(
+          scene, newMat ? newMat.get() : &mat);
       cylinder->setTransform(transform->transform());
       scene->add(cylinder);
       return;
@@ -469,7 +469,7 @@ void Parser::parseCone(Scene *scene, TransformNode *transform,
   _tokenizer.Read(LBRACE);
 
   Cone *cone;
-  Material *newMat = 0;
+  unique_ptr<Material> newMat;
 
   double bottomRadius = 1.0;
   double topRadius = 0.0;
@@ -477,12 +477,11 @@ void Parser::parseCone(Scene *scene, TransformNode *transform,
   bool capped = true; // Capped by default
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case MATERIAL:
-      delete newMat;
-      newMat = parseMaterialExpression(scene, mat);
+      newMat.reset(parseMaterialExpression(scene, mat));
       break;
     case NAME:
       parseIdentExpression();
@@ -501,8 +500,9 @@ void Parser::parseCone(Scene *scene, TransformNode *transform,
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      cone = new Cone(scene, newMat ? newMat : new Material(mat), height,
-                      bottomRadius, topRadius, capped);
+      cone = scene->arena().create<Cone>(
+          scene, newMat ? newMat.get() : &mat, height, bottomRadius,
+          topRadius, capped);
       cone->setTransform(transform->transform());
       scene->add(cone);
       return;
@@ -514,8 +514,8 @@ void Parser::parseCone(Scene *scene, TransformNode *transform,
 
 void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
                           const Material &mat) {
-  Trimesh *tmesh =
-      new Trimesh(scene, new Material(mat), transform->transform());
+  Trimesh *tmesh = scene->arena().create<Trimesh>(scene, &mat,
+                                                  transform->transform());
 
   _tokenizer.Read(TRIMESH);
   _tokenizer.Read(LBRACE);
@@ -525,18 +525,19 @@ void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
 
   const char *error;
   for (;;) {
-    const Token *t = _tokenizer.Peek();
+    const Token &t = _tokenizer.Peek();
 
-    switch (t->kind()) {
+    switch (t.kind()) {
     case GENNORMALS:
       _tokenizer.Read(GENNORMALS);
       _tokenizer.Read(SEMICOLON);
       generateNormals = true;
       break;
 
-    case MATERIAL:
-      tmesh->setMaterial(parseMaterialExpression(scene, mat));
-      break;
+    case MATERIAL: {
+      unique_ptr<Material> temp(parseMaterialExpression(scene, mat));
+      tmesh->setMaterial(temp.get());
+    } break;
 
     case NAME:
       parseIdentExpression();
@@ -551,11 +552,11 @@ void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
       _tokenizer.Read(NORMALS);
       _tokenizer.Read(EQUALS);
       _tokenizer.Read(LPAREN);
-      if (RPAREN != _tokenizer.Peek()->kind()) {
+      if (RPAREN != _tokenizer.Peek().kind()) {
         tmesh->addNormal(parseVec3d());
         for (;;) {
-          const Token *nextToken = _tokenizer.Peek();
-          if (RPAREN == nextToken->kind())
+          const Token &nextToken = _tokenizer.Peek();
+          if (RPAREN == nextToken.kind())
             break;
           _tokenizer.Read(COMMA);
           tmesh->addNormal(parseVec3d());
@@ -570,11 +571,11 @@ void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
       _tokenizer.Read(FACES);
       _tokenizer.Read(EQUALS);
       _tokenizer.Read(LPAREN);
-      if (RPAREN != _tokenizer.Peek()->kind()) {
+      if (RPAREN != _tokenizer.Peek().kind()) {
         parseFaces(faces);
         for (;;) {
-          const Token *nextToken = _tokenizer.Peek();
-          if (RPAREN == nextToken->kind())
+          const Token &nextToken = _tokenizer.Peek();
+          if (RPAREN == nextToken.kind())
             break;
           _tokenizer.Read(COMMA);
           parseFaces(faces);
@@ -588,11 +589,11 @@ void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
       _tokenizer.Read(POLYPOINTS);
       _tokenizer.Read(EQUALS);
       _tokenizer.Read(LPAREN);
-      if (RPAREN != _tokenizer.Peek()->kind()) {
+      if (RPAREN != _tokenizer.Peek().kind()) {
         tmesh->addVertex(parseVec3d());
         for (;;) {
-          const Token *nextToken = _tokenizer.Peek();
-          if (RPAREN == nextToken->kind())
+          const Token &nextToken = _tokenizer.Peek();
+          if (RPAREN == nextToken.kind())
             break;
           _tokenizer.Read(COMMA);
           tmesh->addVertex(parseVec3d());
@@ -660,7 +661,7 @@ void Parser::parseFaces(list<glm::dvec3> &faces) {
 void Parser::parseAmbientLight(Scene *scene) {
   _tokenizer.Read(AMBIENT_LIGHT);
   _tokenizer.Read(LBRACE);
-  if (_tokenizer.Peek()->kind() != COLOR)
+  if (_tokenizer.Peek().kind() != COLOR)
     throw SyntaxErrorException("Expected color attribute", _tokenizer);
 
   scene->addAmbient(parseVec3dExpression());
@@ -683,8 +684,8 @@ PointLight *Parser::parsePointLight(Scene *scene) {
   _tokenizer.Read(LBRACE);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
-    switch (t->kind()) {
+    const Token &t = _tokenizer.Peek();
+    switch (t.kind()) {
     case POSITION:
       if (hasPosition)
         throw SyntaxErrorException("Repeated 'position' attribute", _tokenizer);
@@ -717,7 +718,7 @@ PointLight *Parser::parsePointLight(Scene *scene) {
       if (!hasPosition)
         throw SyntaxErrorException("Expected: 'position'", _tokenizer);
       _tokenizer.Read(RBRACE);
-      return new PointLight(
+      return scene->arena().create<PointLight>(
           scene, position, color, constantAttenuationCoefficient,
           linearAttenuationCoefficient, quadraticAttenuationCoefficient);
 
@@ -742,8 +743,8 @@ DirectionalLight *Parser::parseDirectionalLight(Scene *scene) {
   _tokenizer.Read(LBRACE);
 
   for (;;) {
-    const Token *t = _tokenizer.Peek();
-    switch (t->kind()) {
+    const Token &t = _tokenizer.Peek();
+    switch (t.kind()) {
     case DIRECTION:
       if (hasDirection)
         throw SyntaxErrorException("Repeated 'direction' "
@@ -766,7 +767,7 @@ DirectionalLight *Parser::parseDirectionalLight(Scene *scene) {
       if (!hasDirection)
         throw SyntaxErrorException("Expected: 'position'", _tokenizer);
       _tokenizer.Read(RBRACE);
-      return new DirectionalLight(scene, direction, color);
+      return scene->arena().create<DirectionalLight>(scene, direction, color);
 
     default:
       throw SyntaxErrorException("expecting 'position' or 'color' "
@@ -829,26 +830,26 @@ string Parser::parseIdentExpression() {
 }
 
 double Parser::parseScalar() {
-  unique_ptr<Token> scalar(_tokenizer.Read(SCALAR));
+  Token scalar = _tokenizer.Read(SCALAR);
 
-  return scalar->value();
+  return scalar.value();
 }
 
 string Parser::parseIdent() {
-  unique_ptr<Token> scalar(_tokenizer.Read(IDENT));
+  Token scalar = _tokenizer.Read(IDENT);
 
-  return scalar->ident();
+  return scalar.ident();
 }
 
 list<double> Parser::parseScalarList() {
   list<double> ret;
 
   _tokenizer.Read(LPAREN);
-  if (RPAREN != _tokenizer.Peek()->kind()) {
+  if (RPAREN != _tokenizer.Peek().kind()) {
     ret.push_back(parseScalar());
     for (;;) {
-      const Token *nextToken = _tokenizer.Peek();
-      if (RPAREN == nextToken->kind())
+      const Token &nextToken = _tokenizer.Peek();
+      if (RPAREN == nextToken.kind())
         break;
       _tokenizer.Read(COMMA);
       ret.push_back(parseScalar());
@@ -860,12 +861,12 @@ list<double> Parser::parseScalarList() {
 }
 
 bool Parser::parseBoolean() {
-  const Token *next = _tokenizer.Peek();
-  if (SYMTRUE == next->kind()) {
+  const Token &next = _tokenizer.Peek();
+  if (SYMTRUE == next.kind()) {
     _tokenizer.Read(SYMTRUE);
     return true;
   }
-  if (SYMFALSE == next->kind()) {
+  if (SYMFALSE == next.kind()) {
     _tokenizer.Read(SYMFALSE);
     return false;
   }
@@ -874,35 +875,35 @@ bool Parser::parseBoolean() {
 
 glm::dvec3 Parser::parseVec3d() {
   _tokenizer.Read(LPAREN);
-  unique_ptr<Token> value1(_tokenizer.Read(SCALAR));
+  Token value1 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(COMMA);
-  unique_ptr<Token> value2(_tokenizer.Read(SCALAR));
+  Token value2 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(COMMA);
-  unique_ptr<Token> value3(_tokenizer.Read(SCALAR));
+  Token value3 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(RPAREN);
 
-  return glm::dvec3(value1->value(), value2->value(), value3->value());
+  return glm::dvec3(value1.value(), value2.value(), value3.value());
 }
 
 glm::dvec4 Parser::parseVec4d() {
   _tokenizer.Read(LPAREN);
-  unique_ptr<Token> value1(_tokenizer.Read(SCALAR));
+  Token value1 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(COMMA);
-  unique_ptr<Token> value2(_tokenizer.Read(SCALAR));
+  Token value2 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(COMMA);
-  unique_ptr<Token> value3(_tokenizer.Read(SCALAR));
+  Token value3 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(COMMA);
-  unique_ptr<Token> value4(_tokenizer.Read(SCALAR));
+  Token value4 = _tokenizer.Read(SCALAR);
   _tokenizer.Read(RPAREN);
 
-  return glm::dvec4(value1->value(), value2->value(), value3->value(),
-                    value4->value());
+  return glm::dvec4(value1.value(), value2.value(), value3.value(),
+                    value4.value());
 }
 
 Material *Parser::parseMaterial(Scene *scene, const Material &parent) {
-  const Token *tok = _tokenizer.Peek();
-  if (IDENT == tok->kind()) {
-    return new Material(materials[tok->ident()]);
+  const Token &tok = _tokenizer.Peek();
+  if (IDENT == tok.kind()) {
+    return new Material(materials[tok.ident()]);
   }
 
   _tokenizer.Read(LBRACE);
@@ -912,8 +913,8 @@ Material *Parser::parseMaterial(Scene *scene, const Material &parent) {
   Material *mat = new Material(parent);
 
   for (;;) {
-    const Token *token = _tokenizer.Peek();
-    switch (token->kind()) {
+    const Token &token = _tokenizer.Peek();
+    switch (token.kind()) {
     case EMISSIVE:
       mat->setEmissive(parseVec3dMaterialParameter(scene));
       break;
@@ -953,7 +954,7 @@ Material *Parser::parseMaterial(Scene *scene, const Material &parent) {
 
     case NAME:
       _tokenizer.Read(NAME);
-      name = (_tokenizer.Read(IDENT))->ident();
+      name = _tokenizer.Read(IDENT).ident();
       _tokenizer.Read(SEMICOLON);
       break;
 
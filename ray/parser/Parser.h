@@ -29,29 +29,25 @@ typedef std::map<string, Material> mmap;
 
 /* While parsing the file, we will end up traversing a DFS of a transformation
 tree. We use the utility classes TransformNode and TransformRoot to track the
-transformations. */
+transformations. Nodes are allocated from an arena owned by the root, so a
+scene with many transformed objects doesn't pay one heap allocation per node,
+and the whole tree goes away with the root. */
 class TransformNode {
+  friend class Arena;
+
 protected:
   // information about this node's transformation
   glm::dmat4 xform;
 
-  // information about parent & children
+  // information about parent
   TransformNode *parent;
-  std::vector<TransformNode *> children;
-
-public:
-  typedef std::vector<TransformNode *>::iterator child_iter;
-  typedef std::vector<TransformNode *>::const_iterator child_citer;
 
-  ~TransformNode() {
-    for (auto c : children)
-      delete c;
-  }
+  // where this node's children are allocated
+  Arena *nodes;
 
+public:
   TransformNode *createChild(const glm::dmat4 &xform) {
-    TransformNode *child = new TransformNode(this, xform);
-    children.push_back(child);
-    return child;
+    return nodes->create<TransformNode>(this, xform, nodes);
   }
 
   const glm::dmat4 &transform() const { return xform; }
@@ -61,7 +57,8 @@ protected:
   // protected so that users can't directly construct one of these...
   // force them to use the createChild() method.  Note that they CAN
   // directly create a TransformRoot object.
-  TransformNode(TransformNode *parent, const glm::dmat4 &xform) : children() {
+  TransformNode(TransformNode *parent, const glm::dmat4 &xform, Arena *nodes)
+      : nodes(nodes) {
     this->parent = parent;
     if (parent == NULL)
       this->xform = xform;
@@ -72,7 +69,10 @@ protected:
 
 class TransformRoot : public TransformNode {
 public:
-  TransformRoot() : TransformNode(NULL, glm::dmat4(1.0)) {}
+  TransformRoot() : TransformNode(NULL, glm::dmat4(1.0), &nodeArena) {}
+
+private:
+  Arena nodeArena{4096};
 };
 
 /*
@@ -104,8 +104,8 @@ string getNameForToken(const SYMBOL kind) {
       reservedWords["regular17gon"] = SEVENTEENGON;
    to the list below.
 */
-SYMBOL lookupReservedWord(const string &ident) {
-  static std::map<string, SYMBOL> reservedWords;
+SYMBOL lookupReservedWord(std::string_view ident) {
+  static std::map<string, SYMBOL, std::less<>> reservedWords;
 
   if (reservedWords.empty()) {
     reservedWords["ambient_light"] = AMBIENT_LIGHT;
@@ -161,27 +161,23 @@ SYMBOL lookupReservedWord(const string &ident) {
   }
 
   // search ReservedWords table
-  std::map<string, SYMBOL>::const_iterator itr = reservedWords.find(ident);
+  auto itr = reservedWords.find(ident);
   if (itr == reservedWords.end())
     return UNKNOWN;
   else
     return (*itr).second;
 }
 
-string Token::toString() const { return getNameForToken(kind()); }
+string Token::toString() const {
+  ostringstream oss;
+  oss << getNameForToken(kind());
+  if (_kind == IDENT)
+    oss << ": \"" << _ident << "\"";
+  else if (_kind == SCALAR)
+    oss << ": " << _value;
+  return oss.str();
+}
 
 void Token::Print(ostream &out) const { out << toString(); }
 
 void Token::Print() const { Print(std::cout); }
-
-string IdentToken::toString() const {
-  ostringstream oss(Token::toString());
-  oss << ": \"" << _ident << "\"";
-  return oss.str();
-}
-
-string ScalarToken::toString() const {
-  ostringstream oss(Token::toString());
-  oss << ": " << _value;
-  return oss.str();
-}
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <string_view>
 
 #include "ParserException.h"
 
@@ -97,58 +98,50 @@ enum SYMBOL {
 
 // Helper functions
 string getNameForToken(const SYMBOL kind);
-SYMBOL lookupReservedWord(const string &name);
+SYMBOL lookupReservedWord(std::string_view name);
 
+/* Tokens are small values. An identifier's text is a view into the
+   Tokenizer's source, so it is only valid while that source is; ident()
+   returns a copy for callers that need to keep it. */
 class Token {
 public:
-  Token(SYMBOL kind) : _kind(kind) {}
+  Token(SYMBOL kind = UNKNOWN) : _kind(kind) {}
+
+  static Token scalar(double value) {
+    Token t(SCALAR);
+    t._value = value;
+    return t;
+  }
+  static Token identifier(std::string_view ident) {
+    Token t(IDENT);
+    t._ident = ident;
+    return t;
+  }
 
   SYMBOL kind() const { return _kind; }
 
   // Note that these errors should not ever be encountered at runtime,
   // and signify parser bugs of some kind.
-  virtual std::string ident() const {
-    throw ParserFatalException("not an IdentToken");
-    return std::string();
+  std::string ident() const {
+    if (_kind != IDENT)
+      throw ParserFatalException("not an IdentToken");
+    return std::string(_ident);
   }
-  virtual double value() const {
-    throw ParserFatalException("not a ScalarToken");
-    return 0.0;
+  double value() const {
+    if (_kind != SCALAR)
+      throw ParserFatalException("not a ScalarToken");
+    return _value;
   }
 
   // Utility functions
-  virtual void Print(std::ostream &out) const;
-  virtual void Print() const;
-  virtual string toString() const;
-
-  virtual ~Token() {}
-
-protected:
-  const SYMBOL _kind;
-};
-
-class IdentToken : public Token {
-public:
-  IdentToken(std::string ident) : Token(IDENT), _ident(ident) {}
-
-  std::string ident() const { return _ident; }
-
-  string toString() const;
-
-protected:
-  const std::string _ident;
-};
-
-class ScalarToken : public Token {
-public:
-  ScalarToken(double value) : Token(SCALAR), _value(value) {}
-
-  double value() const { return _value; }
-
+  void Print(std::ostream &out) const;
+  void Print() const;
   string toString() const;
 
-protected:
-  const double _value;
+private:
+  SYMBOL _kind;
+  double _value = 0.0;
+  std::string_view _ident;
 };
 
 #endif
@@ -1,11 +1,11 @@
 // Tokenizer.cpp
 // Breaks the input stream up into tokens
+#include <charconv>
+#include <ctype.h>
 #include <map>
 #include <sstream>
-#include <stdlib.h>
 #include <string>
 
-#include "../fileio/buffer.h"
 #include "Token.h"
 #include "Tokenizer.h"
 
@@ -24,20 +24,20 @@
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Tokenizer::Tokenizer(istream&) constructor
+// Tokenizer::Tokenizer(string_view) constructor
 //
 //   This constructor sets up the initial state that we need in order
-// to start scanning.  Note that we will be passed an OPEN file.  This
-// simplifies the scanner part, since we don't have to open it and
-// error check to see if it exists.  We assume that the caller (which
-// will be the main() function) sets up everything and passes us a VALID
-// file pointer.
+// to start scanning.  The source is scanned in place (it is normally a
+// memory-mapped file), so nothing is copied and tokens only hold views
+// into it.
 //
 
-Tokenizer::Tokenizer(istream &fp, bool printTokens) : buffer(fp, false, false) {
+Tokenizer::Tokenizer(std::string_view source, bool printTokens)
+    : pos(source.data()), end(source.data() + source.size()),
+      lineStart(source.data()), HasUnGetToken(false) {
+  LineNumber = 1;
   TokenColumn = 0;
-  CurrentCh = ' ';
-  UnGetToken = NULL;
+  LastPrintedLine = 0;
   _printTokens = printTokens;
 }
 
@@ -47,53 +47,52 @@ Tokenizer::Tokenizer(istream &fp, bool printTokens) : buffer(fp, false, false) {
 // last phase to be executed
 //
 void Tokenizer::ScanProgram() {
-  while (Get()->kind() != EOFSYM)
+  while (Get().kind() != EOFSYM)
     ;
 }
 
-unique_ptr<Token> Tokenizer::Get() { return unique_ptr<Token>(GetNext()); }
-
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Get() method
+// Token Tokenizer::Get() method
 //
 // Advance through the source to find the next token. Returns peeked token,
 // if there is one.
 //
 
-Token *Tokenizer::GetNext() {
-  Token *T = NULL;
-
+Token Tokenizer::Get() {
   // First check to see if there is an UnGetToken. If there is, use it.
-  if (UnGetToken != NULL) {
-    T = UnGetToken;
-    UnGetToken = NULL;
-    return T;
+  if (HasUnGetToken) {
+    HasUnGetToken = false;
+    return UnGetToken;
   }
+  return GetNext();
+}
 
-  // Otherwise, crank up the scanner and get a new token.
+Token Tokenizer::GetNext() {
+  Token T;
 
   // Get rid of any whitespace
   SkipWhiteSpace();
 
   // test for end of file
-  if (buffer.isEOF()) {
-    T = new Token(EOFSYM);
+  if (isEOF()) {
+    T = Token(EOFSYM);
 
   } else {
     // Save the starting position of the symbol in a variable,
     // so that nicer error messages can be produced.
-    TokenColumn = buffer.CurColumn();
+    TokenColumn = int(pos - lineStart);
 
     // Check kind of current character
+    char ch = *pos;
 
     // Note that _'s are now allowed in identifiers.
-    if (isalpha(CurrentCh) || '_' == CurrentCh) {
+    if (isalpha((unsigned char)ch) || '_' == ch) {
       // grab identifier or reserved word
       T = GetIdent();
-    } else if ('"' == CurrentCh) {
+    } else if ('"' == ch) {
       T = GetQuotedIdent();
-    } else if (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh) {
+    } else if (isdigit((unsigned char)ch) || '-' == ch || '.' == ch) {
       T = GetScalar();
     } else {
       //
@@ -104,210 +103,214 @@ Token *Tokenizer::GetNext() {
     }
   }
 
-  if (T == NULL) {
-    throw ParserFatalException("didn't get a token");
-  }
-
   if (_printTokens) {
     std::cout << "Token read: ";
-    T->Print();
+    T.Print();
     std::cout << std::endl;
   }
 
   return T;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// void Tokenizer::GetCh() private method
+//
+//   Advance to the next character, keeping track of where the current
+// line starts so that errors can report a line and column.
+//
+
+void Tokenizer::GetCh() {
+  if (pos == end)
+    return;
+  if (*pos++ == '\n') {
+    ++LineNumber;
+    lineStart = pos;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// void Tokenizer::PrintLine() method
+//
+//   This method displays the current line on the screen.
+//
+
+void Tokenizer::PrintLine(ostream &out) const {
+  if (LineNumber > LastPrintedLine) {
+    const char *lineEnd = lineStart;
+    while (lineEnd != end && *lineEnd != '\n')
+      ++lineEnd;
+    out << "# " << std::string_view(lineStart, lineEnd - lineStart)
+        << std::endl;
+    LastPrintedLine = LineNumber;
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // Skips spaces, tabs, newlines, and comments
 //
 void Tokenizer::SkipWhiteSpace() {
-  while (isspace(CurrentCh)) {
-    GetCh();
-  }
+  for (;;) {
+    while (pos != end && isspace((unsigned char)*pos))
+      GetCh();
+
+    if (CurrentCh() != '/') // Look for comments
+      return;
 
-  if ('/' == CurrentCh) // Look for comments
-  {
     GetCh();
-    if ('/' == CurrentCh) {
+    if ('/' == CurrentCh()) {
       // Throw out everything until the end of the line
-      while ('\n' != CurrentCh) {
-        GetCh();
-      }
-    } else if ('*' == CurrentCh) {
+      while (pos != end && '\n' != *pos)
+        ++pos;
+    } else if ('*' == CurrentCh()) {
       int startLine = CurLine();
-      while (true) {
-        GetCh();
-        if ('*' == CurrentCh) {
-          GetCh();
-          if (CondReadCh('/'))
-            break;
-          else if (buffer.isEOF()) {
-            std::ostringstream ost;
-            ost << "Unterminated comment "
-                   "in line ";
-            ost << startLine;
-            throw SyntaxErrorException(ost.str(), *this);
-          }
-        } else if (buffer.isEOF()) {
+      GetCh();
+      for (;;) {
+        if (isEOF()) {
           std::ostringstream ost;
           ost << "Unterminated comment in line ";
           ost << startLine;
           throw SyntaxErrorException(ost.str(), *this);
         }
+        if ('*' == CurrentCh()) {
+          GetCh();
+          if (CondReadCh('/'))
+            break;
+        } else {
+          GetCh();
+        }
       }
     } else {
       std::ostringstream ost;
-      ost << "unexpected character: '" << CurrentCh << "'";
+      ost << "unexpected character: '" << CurrentCh() << "'";
       throw SyntaxErrorException(ost.str(), *this);
     }
-
-    SkipWhiteSpace(); // We may need to throw out
-                      //  more white space/comments
-                      // This is admittedly tail recursion...
+    // We may need to throw out more white space/comments
   }
 }
 
-Token *Tokenizer::GetQuotedIdent() {
+Token Tokenizer::GetQuotedIdent() {
   GetCh(); // Throw out beginning '"'
 
-  std::ostringstream ident;
-  while ('"' != CurrentCh) {
-    if ('\n' == CurrentCh)
+  const char *start = pos;
+  while ('"' != CurrentCh()) {
+    if ('\n' == CurrentCh() || isEOF())
       throw SyntaxErrorException("Unterminated string constant", *this);
-
-    ident << CurrentCh;
     GetCh();
   }
+  std::string_view ident(start, pos - start);
   GetCh();
-  return new IdentToken(ident.str());
+  return Token::identifier(ident);
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetIdent method
+// Token Tokenizer::GetIdent method
 //
 //   GetIdent scans an identifier-like token.  It returns an
 //   identifier or a reserved word token.
 //
 
-Token *Tokenizer::GetIdent() {
+Token Tokenizer::GetIdent() {
   // an IDENTIFIER or a RESERVED WORD token
-  std::ostringstream ident;
-  while (isalnum(CurrentCh) || '_' == CurrentCh || '-' == CurrentCh) {
-    // While we still have something that can
-    ident << CurrentCh;
-    GetCh();
-  }
-  return SearchReserved(ident.str());
+  const char *start = pos;
+  while (pos != end &&
+         (isalnum((unsigned char)*pos) || '_' == *pos || '-' == *pos))
+    ++pos;
+  return SearchReserved(std::string_view(start, pos - start));
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetInt method
+// Token Tokenizer::GetScalar method
 //
-//   GetInt scans an integer.  It returns an integer token.
+//   GetScalar scans a number.  It returns a scalar token.
 //
 
-Token *Tokenizer::GetScalar() {
-  // an INTEGER token
-  string ret("");
-  while (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh ||
-         'e' == CurrentCh) {
-    ret += CurrentCh;
-    GetCh();
-  }
-  return new ScalarToken(atof(ret.c_str()));
+Token Tokenizer::GetScalar() {
+  const char *start = pos;
+  while (pos != end && (isdigit((unsigned char)*pos) || '-' == *pos ||
+                        '.' == *pos || 'e' == *pos))
+    ++pos;
+
+  // Like atof(), use the longest prefix that is a number, and read nothing
+  // at all as 0.
+  double value = 0.0;
+  std::from_chars(start, pos, value);
+  return Token::scalar(value);
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetPunct() method
+// Token Tokenizer::GetPunct() method
 //
 //   Gets a punctuation token from input stream and returns it.
 //
 
-Token *Tokenizer::GetPunct() {
-  Token *T;
+Token Tokenizer::GetPunct() {
+  SYMBOL kind;
 
-  switch (CurrentCh) {
+  switch (CurrentCh()) {
   case '(':
-    GetCh();
-    T = new Token(LPAREN);
+    kind = LPAREN;
     break;
   case ')':
-    GetCh();
-    T = new Token(RPAREN);
+    kind = RPAREN;
     break;
   case '{':
-    GetCh();
-    T = new Token(LBRACE);
+    kind = LBRACE;
     break;
   case '}':
-    GetCh();
-    T = new Token(RBRACE);
+    kind = RBRACE;
     break;
   case ',':
-    GetCh();
-    T = new Token(COMMA);
+    kind = COMMA;
     break;
   case '=':
-    GetCh();
-    T = new Token(EQUALS);
+    kind = EQUALS;
     break;
   case ';':
-    GetCh();
-    T = new Token(SEMICOLON);
+    kind = SEMICOLON;
     break;
 
   default:
     std::ostringstream ost;
-    ost << "unexpected character: '" << CurrentCh << "'";
+    ost << "unexpected character: '" << CurrentCh() << "'";
     throw SyntaxErrorException(ost.str(), *this);
   }
 
-  return T;
-}
-
-//////////////////////////////////////////////////////////////////////////
-//
-// void Tokenizer::UnGet(Token*) method
-//
-//   UnGet returns the last read token to the input, where it will be
-//   returned for the next Get call.  At most 1 token can be pushed back
-//   at a time this way and this token is pointed to by the pointer
-//   TokenToUnGet.  TokenToUnGet must be non null.
-
-void Tokenizer::UnGet(Token *TokenToUnGet) {
-  if (UnGetToken != NULL) {
-    throw ParserFatalException("trying to UnGet more than one token");
-  }
-  UnGetToken = TokenToUnGet;
+  GetCh();
+  return Token(kind);
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Peek() method
+// const Token& Tokenizer::Peek() method
 //
-//   Peek reads the next token and pushes it back on the token stream
+//   Peek reads the next token and pushes it back on the token stream,
+//   where it will be returned by the next Get/Read/CondRead call.
 //
 
-const Token *Tokenizer::Peek() {
-  Token *T = GetNext();
-  UnGet(T);
-  return T;
+const Token &Tokenizer::Peek() {
+  if (!HasUnGetToken) {
+    UnGetToken = GetNext();
+    HasUnGetToken = true;
+  }
+  return UnGetToken;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Read(SYMBOL) method
+// Token Tokenizer::Read(SYMBOL) method
 //
 //   Read gets the next token and checks that it's of the expected type.
 //
 
-unique_ptr<Token> Tokenizer::Read(SYMBOL kind) {
-  unique_ptr<Token> T(Get());
-  if (T->kind() != kind) {
+Token Tokenizer::Read(SYMBOL kind) {
+  Token T = Get();
+  if (T.kind() != kind) {
     string msg(getNameForToken(kind));
     msg.append(" expected");
     throw SyntaxErrorException(msg, *this);
@@ -325,8 +328,7 @@ unique_ptr<Token> Tokenizer::Read(SYMBOL kind) {
 //
 
 bool Tokenizer::CondRead(SYMBOL kind) {
-  const Token *T = Peek();
-  if (T->kind() == kind) {
+  if (Peek().kind() == kind) {
     Get();
     return true;
   } else {
@@ -336,26 +338,18 @@ bool Tokenizer::CondRead(SYMBOL kind) {
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::SearchReserved(const string&) private method
+// Token Tokenizer::SearchReserved(string_view) private method
 //
 //   SearchReserved() maps a character string to an IdentToken or one of
-// several possible reserved word tokens, using a binary search on the
-// ReservedWords structure.
+// several possible reserved word tokens.
 //
 
-//
-// The list of all the Reserved words and their associated symbols,
-// in alphabetical order so this can be searched using binary search.
-//
-
-typedef std::map<string, SYMBOL> ReservedWordsMap;
-
-Token *Tokenizer::SearchReserved(const string &ident) const {
+Token Tokenizer::SearchReserved(std::string_view ident) const {
   SYMBOL tokSymbol = lookupReservedWord(ident);
   if (UNKNOWN == tokSymbol) {
-    return new IdentToken(ident);
+    return Token::identifier(ident);
   } else {
-    return new Token(tokSymbol);
+    return Token(tokSymbol);
   }
 }
 
@@ -369,7 +363,7 @@ Token *Tokenizer::SearchReserved(const string &ident) const {
 //
 
 bool Tokenizer::CondReadCh(char c) {
-  if (c == CurrentCh) {
+  if (c == CurrentCh() && !isEOF()) {
     GetCh();
     return true;
   } else {
@@ -2,11 +2,11 @@
 
 #define __TOKENIZER_H__
 
-#include "../fileio/buffer.h"
 #include "Token.h"
 
 #include <memory>
 #include <string>
+#include <string_view>
 
 /** This file is deprecated and is kept to support parsing of legacy .ray files.
     See JsonParser.{cpp,h} for the new parsing code. **/
@@ -14,7 +14,7 @@
 // Needed to correct for annoying "feature" in MSVC's compiler
 #pragma warning(disable : 4786)
 
-using std::istream;
+using std::ostream;
 using std::string;
 using std::unique_ptr;
 
@@ -33,28 +33,30 @@ using std::unique_ptr;
 
 class Tokenizer {
 public:
-  Tokenizer(istream &fp, bool printTokens);
+  // Scan the given text in place. The text (usually a MappedFile) must
+  // outlive the Tokenizer and any identifier token it returns.
+  Tokenizer(std::string_view source, bool printTokens);
 
   // destructively read & return the next token, skipping over whitespace
-  unique_ptr<Token> Get();
+  Token Get();
 
   // non-destructively get the next token, pushing it back to be read
-  // again
-  const Token *Peek();
+  // again. The reference is valid until the next Get/Read/CondRead.
+  const Token &Peek();
 
   // Get() the next token, and check that it's of the expected SYMBOL type
-  unique_ptr<Token> Read(SYMBOL expected);
+  Token Read(SYMBOL expected);
 
   // read the next token only if it matches the expected token type.
   // Return whether it matches.
   bool CondRead(SYMBOL expected);
 
   // display the current source line onto the screen.
-  void PrintLine(ostream &out) const { buffer.PrintLine(out); }
+  void PrintLine(ostream &out) const;
 
   // return the column number/line number of the current token.
   int CurColumn() const { return TokenColumn; }
-  int CurLine() const { return buffer.CurLine(); }
+  int CurLine() const { return LineNumber; }
 
   // Repeatedly scan tokens and throw them away.  Useful if this is the
   // last phase to be executed
@@ -63,33 +65,36 @@ public:
 protected:
   // private methods:
 
-  // push the argument token back onto the scanner's token stream;
-  // it will be returned by the next Get/Peek/Read/CondRead call
-  Token *GetNext();
-  void UnGet(Token *t);
+  Token GetNext();
 
-  Token *
-  SearchReserved(const string &) const; // Convert ident string into token
+  // Convert ident string into token
+  Token SearchReserved(std::string_view) const;
 
-  void GetCh() { CurrentCh = buffer.GetCh(); }
+  bool isEOF() const { return pos == end; }
+  char CurrentCh() const { return pos == end ? '\0' : *pos; }
+  void GetCh(); // advance one character, tracking line numbers
   bool CondReadCh(char expected); // consume a character, if it matches
 
   void SkipWhiteSpace(); // skip spaces, tabs, newlines
 
-  Token *GetPunct();  // scan punctuation token
-  Token *GetScalar(); // scan integer token
-  Token *GetIdent();  // scan identifier token
-  Token *GetQuotedIdent();
+  Token GetPunct();  // scan punctuation token
+  Token GetScalar(); // scan integer token
+  Token GetIdent();  // scan identifier token
+  Token GetQuotedIdent();
 
   // private data:
 
-  Buffer buffer;  // The file buffer
-  char CurrentCh; // The current character in the current line
+  const char *pos;       // The current character
+  const char *end;       // One past the last character
+  const char *lineStart; // First character of the current line
 
-  Token *UnGetToken; // The token that has been "ungot"
+  Token UnGetToken;   // The token that has been "ungot"
+  bool HasUnGetToken; // Whether UnGetToken holds a token
 
+  int LineNumber; // The number of the current line, starting from 1
   int TokenColumn; // The column where the last read token starts,
                    // for generating error messages
+  mutable int LastPrintedLine; // The line number of the last printed line
 
   bool _printTokens; // printing flag
 };
@@ -0,0 +1,63 @@
+#include "arena.h"
+#include <algorithm>
+#include <stdint.h>
+
+// Blocks double in size up to this limit, so even very large scenes only
+// need a few dozen allocations.
+static const size_t MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+
+Arena::Arena(size_t firstBlockSize) : nextBlockSize(firstBlockSize) {}
+
+Arena::~Arena() { release(); }
+
+void *Arena::allocate(size_t size, size_t align) {
+  uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+  if (!cur || p + size > reinterpret_cast<uintptr_t>(end)) {
+    addBlock(size + align);
+    p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+  }
+  cur = reinterpret_cast<char *>(p + size);
+  used += size;
+  return reinterpret_cast<void *>(p);
+}
+
+void Arena::addBlock(size_t minSize) {
+  size_t size = std::max(nextBlockSize, minSize);
+  nextBlockSize = std::min(nextBlockSize * 2, MAX_BLOCK_SIZE);
+  Block b{new char[size], size};
+  blocks.push_back(b);
+  cur = b.data;
+  end = b.data + size;
+}
+
+void Arena::runDestructors() {
+  for (auto itr = destructors.rbegin(); itr != destructors.rend(); ++itr)
+    itr->fn(itr->obj);
+  destructors.clear();
+}
+
+void Arena::reset() {
+  runDestructors();
+  if (blocks.empty())
+    return;
+  auto largest = std::max_element(
+      blocks.begin(), blocks.end(),
+      [](const Block &a, const Block &b) { return a.size < b.size; });
+  Block keep = *largest;
+  for (auto &b : blocks)
+    if (b.data != keep.data)
+      delete[] b.data;
+  blocks.assign(1, keep);
+  cur = keep.data;
+  end = keep.data + keep.size;
+  used = 0;
+}
+
+void Arena::release() {
+  runDestructors();
+  for (auto &b : blocks)
+    delete[] b.data;
+  blocks.clear();
+  cur = end = nullptr;
+  used = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* A monotonic (bump-pointer) allocator. Objects created in an Arena are never
+freed individually: their memory is carved out of a few large blocks, and
+everything is destroyed at once when the Arena is destroyed or reset().
+Destructors of non-trivially-destructible objects are run in reverse order of
+creation.
+
+The Scene owns one of these for its lights and geometry, and each Trimesh one
+for its faces, so loading and tearing down a scene with millions of elements
+costs a handful of allocations instead of one per element. */
+class Arena {
+public:
+  explicit Arena(size_t firstBlockSize = 64 * 1024);
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Raw, uninitialized storage with the requested alignment.
+  void *allocate(size_t size, size_t align);
+
+  // Construct a T in the arena. The Arena owns the result.
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    void *mem = allocate(sizeof(T), alignof(T));
+    T *obj = new (mem) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value)
+      destructors.push_back({&destroy<T>, obj});
+    return obj;
+  }
+
+  // Destroy every object and release all blocks but the largest, which is
+  // kept so that the next scene of a similar size allocates nothing new.
+  void reset();
+
+  // Destroy every object and free all memory.
+  void release();
+
+  size_t bytesUsed() const { return used; }
+  size_t blockCount() const { return blocks.size(); }
+
+private:
+  struct Block {
+    char *data;
+    size_t size;
+  };
+  struct Destructor {
+    void (*fn)(void *);
+    void *obj;
+  };
+
+  template <typename T> static void destroy(void *p) {
+    static_cast<T *>(p)->~T();
+  }
+
+  void runDestructors();
+  void addBlock(size_t minSize);
+
+  std::vector<Block> blocks;
+  std::vector<Destructor> destructors;
+  char *cur = nullptr;
+  char *end = nullptr;
+  size_t nextBlockSize;
+  size_t used = 0;
+};
+
+#endif // __ARENA_H__
@@ -1,5 +1,6 @@
 #include "camera.h"
 #include "../ui/TraceUI.h"
+#include <cmath>
 
 #define PI 3.14159265359
 #define SHOW(x) (cerr << #x << " = " << (x) << "\n")
@@ -28,6 +29,23 @@ void Camera::rayThrough(double x, double y, ray &r)
   r.setDirection(dir);
 }
 
+void Camera::rayThrough(double x, double y, double pixelWidth,
+                        double pixelHeight, ray &r) {
+  rayThrough(x, y, r);
+
+  // The unnormalized direction is d = look + x u + y v; differentiating
+  // d / |d| gives (dd |d|^2 - d (d . dd)) / |d|^3 for a change dd.
+  glm::dvec3 d = look + (x - 0.5) * u + (y - 0.5) * v;
+  double dd = glm::dot(d, d);
+  double scale = 1.0 / (dd * std::sqrt(dd));
+  ray::Differentials diff;
+  diff.dPdx = glm::dvec3(0.0);
+  diff.dPdy = glm::dvec3(0.0);
+  diff.dDdx = (dd * u - glm::dot(d, u) * d) * (scale * pixelWidth);
+  diff.dDdy = (dd * v - glm::dot(d, v) * d) * (scale * pixelHeight);
+  r.setDifferentials(diff);
+}
+
 void Camera::setEye(const glm::dvec3 &eye) { this->eye = eye; }
 
 void Camera::setLook(double r, double i, double j, double k)
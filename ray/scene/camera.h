@@ -6,9 +6,15 @@
 #include <glm/vec3.hpp>
 
 class Camera {
+  friend class BinaryScene;
+
 public:
   Camera();
   void rayThrough(double x, double y, ray &r);
+  // Same, and also give the ray its differentials for a pixel that is
+  // pixelWidth by pixelHeight in normalized window coordinates.
+  void rayThrough(double x, double y, double pixelWidth, double pixelHeight,
+                  ray &r);
   void setEye(const glm::dvec3 &eye);
   void setLook(double, double, double, double);
   void setLook(const glm::dvec3 &viewDir, const glm::dvec3 &upDir);
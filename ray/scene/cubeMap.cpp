@@ -2,72 +2,162 @@
 #include "../scene/material.h"
 #include "../ui/TraceUI.h"
 #include "ray.h"
+#include <algorithm>
+#include <cmath>
 extern TraceUI *traceUI;
 
-glm::dvec3 CubeMap::getColor(ray r) const {
-    glm::dvec3 d = glm::normalize(r.getDirection());
-
-    double x = d.x;
-    double y = d.y;
-    double z = d.z;
-
-    double ax = std::abs(x);
-    double ay = std::abs(y);
-    double az = std::abs(z);
-
-    int face;
-    double u, v;
-
-    if (ax >= ay && ax >= az) {
-        // X face
-        if (x > 0) {
-            face = 0;  // +X
-            u = -z / ax;
-            v = -y / ax;
-        } else {
-            face = 1;  // -X
-            u =  z / ax;
-            v = -y / ax;
-        }
-    } else if (ay >= ax && ay >= az) {
-        // Y face
-        if (y > 0) {
-            face = 2;  // +Y
-            u =  x / ay;
-            v =  z / ay;
-        } else {
-            face = 3;  // -Y
-            u =  x / ay;
-            v = -z / ay;
-        }
-    } else {
-        // Z face
-        if (z > 0) {
-            face = 4;  // +Z
-            u =  x / az;
-            v = -y / az;
-        } else {
-            face = 5;  // -Z
-            u = -x / az;
-            v = -y / az;
+namespace {
+// How each face maps directions to texture coordinates: the face is picked
+// by the component of largest magnitude (`major`), and u and v are the
+// signed components `u` and `v` divided by it, mapped from [-1, 1] to
+// [0, 1]. Faces are in the order of CubeMap::setNthMap.
+struct FaceAxes {
+  int major;
+  int u;
+  double uSign;
+  int v;
+  double vSign;
+};
+const FaceAxes faceAxes[6] = {
+    {0, 2, -1.0, 1, -1.0}, // +X
+    {0, 2, 1.0, 1, -1.0},  // -X
+    {1, 0, 1.0, 2, 1.0},   // +Y
+    {1, 0, 1.0, 2, -1.0},  // -Y
+    {2, 0, 1.0, 1, -1.0},  // +Z
+    {2, 0, -1.0, 1, -1.0}, // -Z
+};
+
+int faceFor(const glm::dvec3 &d) {
+  double ax = std::abs(d.x), ay = std::abs(d.y), az = std::abs(d.z);
+  if (ax >= ay && ax >= az)
+    return d.x > 0 ? 0 : 1;
+  if (ay >= ax && ay >= az)
+    return d.y > 0 ? 2 : 3;
+  return d.z > 0 ? 4 : 5;
+}
+
+glm::dvec2 faceCoordinates(const FaceAxes &f, const glm::dvec3 &d) {
+  double m = std::abs(d[f.major]);
+  double u = 0.5 * (f.uSign * d[f.u] / m + 1.0);
+  double v = 0.5 * (f.vSign * d[f.v] / m + 1.0);
+  return glm::dvec2(glm::clamp(u, 0.0, 1.0), glm::clamp(v, 0.0, 1.0));
+}
+
+// The change in face coordinates for a change dd in direction d.
+glm::dvec2 faceDifferential(const FaceAxes &f, const glm::dvec3 &d,
+                            const glm::dvec3 &dd) {
+  double m = std::abs(d[f.major]);
+  double dm = d[f.major] > 0 ? dd[f.major] : -dd[f.major];
+  auto derivative = [&](int axis, double sign) {
+    return 0.5 * sign * (dd[axis] * m - d[axis] * dm) / (m * m);
+  };
+  return glm::dvec2(derivative(f.u, f.uSign), derivative(f.v, f.vSign));
+}
+} // namespace
+
+glm::dvec3 CubeMap::getColor(const glm::dvec3 &d) const {
+  int face = faceFor(d);
+  if (!tMap[face]) {
+    return glm::dvec3(0.0); // fallback background
+  }
+  return tMap[face]->getMappedValue(faceCoordinates(faceAxes[face], d));
+}
+
+glm::dvec3 CubeMap::getColor(const glm::dvec3 &d, const glm::dvec3 &dDdx,
+                             const glm::dvec3 &dDdy) const {
+  int face = faceFor(d);
+  const TextureMap *map = tMap[face].get();
+  if (!map) {
+    return glm::dvec3(0.0); // fallback background
+  }
+  const FaceAxes &f = faceAxes[face];
+  glm::dvec2 dx = faceDifferential(f, d, dDdx);
+  glm::dvec2 dy = faceDifferential(f, d, dDdy);
+
+  // Widen the footprint to filter_width texels; the mip pyramid built when
+  // the face was loaded then does the filtering in a few lookups.
+  double width = std::max(1, traceUI->getFilterWidth());
+  glm::dvec2 size(map->getWidth(), map->getHeight());
+  if (glm::length(dx * size) < width)
+    dx = glm::dvec2(width / size.x, 0.0);
+  if (glm::length(dy * size) < width)
+    dy = glm::dvec2(0.0, width / size.y);
+
+  return map->getFilteredValue(
+      faceCoordinates(f, d), dx, dy,
+      TextureMap::Filter(traceUI->getTextureFilter()));
+}
+
+// Cell (x, y) of a face covers face coordinates s, t in [-1, 1] of width
+// 2 / SAMPLE_RES. The solid angle it subtends is its area divided by
+// (1 + s^2 + t^2)^(3/2), measured at its centre.
+void CubeMap::buildDistribution() const {
+  const int n = SAMPLE_RES;
+  const double cell = 2.0 / n;
+  cdf.assign(6 * n * n + 1, 0.0);
+  double total = 0.0;
+  for (int face = 0; face < 6; ++face) {
+    const TextureMap *map = tMap[face].get();
+    for (int y = 0; y < n; ++y)
+      for (int x = 0; x < n; ++x) {
+        double weight = 0.0;
+        if (map) {
+          glm::dvec2 uv((x + 0.5) / n, (y + 0.5) / n);
+          glm::dvec3 c = map->getFilteredValue(
+              uv, glm::dvec2(1.0 / n, 0.0), glm::dvec2(0.0, 1.0 / n),
+              TextureMap::TRILINEAR);
+          double s = 2.0 * uv.x - 1.0, t = 2.0 * uv.y - 1.0;
+          double r2 = 1.0 + s * s + t * t;
+          double luminance = 0.299 * c[0] + 0.587 * c[1] + 0.114 * c[2];
+          weight = luminance * cell * cell / (r2 * std::sqrt(r2));
         }
+        total += weight;
+        cdf[(face * n + y) * n + x + 1] = total;
+      }
+  }
+  if (total > 0.0)
+    for (double &c : cdf)
+      c /= total;
+}
+
+bool CubeMap::sampleDirection(const glm::dvec3 &random, glm::dvec3 &dir,
+                              double &pdf) const {
+  if (!distributionReady.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> guard(distributionLock);
+    if (!distributionReady.load(std::memory_order_relaxed)) {
+      buildDistribution();
+      distributionReady.store(true, std::memory_order_release);
     }
+  }
+  if (cdf.back() <= 0.0)
+    return false;
 
-    // Map from [-1, 1] → [0, 1]
-    u = 0.5 * (u + 1.0);
-    v = 0.5 * (v + 1.0);
+  // The cell whose CDF interval holds random[0]; zero-weight cells have
+  // empty intervals and are never picked.
+  size_t cell = std::upper_bound(cdf.begin() + 1, cdf.end(), random[0]) -
+                (cdf.begin() + 1);
+  cell = std::min(cell, cdf.size() - 2);
+  double p = cdf[cell + 1] - cdf[cell];
 
-    // Clamp for safety
-    u = glm::clamp(u, 0.0, 1.0);
-    v = glm::clamp(v, 0.0, 1.0);
-    // Sample the cube face texture
-    if (!tMap[face]) {
-        return glm::dvec3(0.0); // fallback background
-    }
-    return tMap[face]->getMappedValue(glm::dvec2(u, v));
-}
+  const int n = SAMPLE_RES;
+  int face = int(cell / (n * n));
+  int y = int(cell / n % n), x = int(cell % n);
+  double s = 2.0 * (x + random[1]) / n - 1.0;
+  double t = 2.0 * (y + random[2]) / n - 1.0;
 
-//return glm::dvec3(1.0, 0.0, 0.0); // bright red
+  const FaceAxes &f = faceAxes[face];
+  dir[f.major] = face % 2 == 0 ? 1.0 : -1.0;
+  dir[f.u] = f.uSign * s;
+  dir[f.v] = f.vSign * t;
+  double r2 = 1.0 + s * s + t * t;
+  dir /= std::sqrt(r2);
+
+  // p is spread uniformly over the cell's area in (s, t); dividing by the
+  // area and the Jacobian of the projection gives it per steradian.
+  double area = (2.0 / n) * (2.0 / n);
+  pdf = p / area * r2 * std::sqrt(r2);
+  return true;
+}
 
 CubeMap::CubeMap() {}
 
@@ -76,4 +166,5 @@ CubeMap::~CubeMap() {}
 void CubeMap::setNthMap(int n, TextureMap *m) {
   if (m != tMap[n].get())
     tMap[n].reset(m);
+  distributionReady = false;
 }
@@ -1,7 +1,11 @@
-#pragma once
+#ifndef __CUBEMAP_H__
+#define __CUBEMAP_H__
 
+#include <atomic>
 #include <glm/vec3.hpp>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 class TextureMap;
 class ray;
@@ -21,6 +25,34 @@ public:
   void setZnegMap(TextureMap *m) { setNthMap(5, m); }
 
   void setNthMap(int n, TextureMap *m);
+  TextureMap *getNthMap(int n) const { return tMap[n].get(); }
 
-  glm::dvec3 getColor(ray r) const;
+  // The environment seen in direction d, which needn't be normalized.
+  glm::dvec3 getColor(const glm::dvec3 &d) const;
+  // Same, averaged over the cone of directions that a pixel covers, as
+  // given by a ray's direction differentials (see ray::Differentials).
+  // The footprint is never taken to be narrower than TraceUI's
+  // filter_width, in texels.
+  glm::dvec3 getColor(const glm::dvec3 &d, const glm::dvec3 &dDdx,
+                      const glm::dvec3 &dDdy) const;
+
+  // Pick a direction with probability roughly proportional to the
+  // brightness the environment has there, for lighting with it (see
+  // Material::shade). `random` holds three numbers uniform in [0, 1); pdf is
+  // set to the density of the returned direction per unit solid angle.
+  // Returns false if the cubemap is completely black.
+  bool sampleDirection(const glm::dvec3 &random, glm::dvec3 &dir,
+                       double &pdf) const;
+
+private:
+  // Luminance times solid angle of each cell of a SAMPLE_RES x SAMPLE_RES
+  // grid over every face, accumulated into a CDF over all six faces. Built
+  // on first use and again after a face changes.
+  static constexpr int SAMPLE_RES = 64;
+  void buildDistribution() const;
+  mutable std::vector<double> cdf;
+  mutable std::atomic<bool> distributionReady{false};
+  mutable std::mutex distributionLock;
 };
+
+#endif // __CUBEMAP_H__
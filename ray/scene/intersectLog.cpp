@@ -0,0 +1,103 @@
+#include "intersectLog.h"
+#include "ray.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+std::atomic<uint64_t> nextSerial(1);
+
+// The rings the calling thread owns, one per log it has recorded to. They
+// are shared with their logs so that either may go first; on exit the
+// thread hands its rings back to the logs still using them.
+template <typename Ring> struct ThreadRings {
+  std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> owned;
+
+  ~ThreadRings() {
+    for (auto &entry : owned)
+      entry.second->owned.store(false, std::memory_order_release);
+  }
+};
+
+} // namespace
+
+IntersectLog::IntersectLog() : serial(nextSerial++) {}
+
+IntersectLog::~IntersectLog() = default;
+
+IntersectLog::Ring *IntersectLog::ring() {
+  thread_local ThreadRings<Ring> mine;
+  for (auto &entry : mine.owned)
+    if (entry.first == serial)
+      return entry.second.get();
+
+  // Forget the rings of logs that are gone.
+  mine.owned.erase(std::remove_if(mine.owned.begin(), mine.owned.end(),
+                                  [](const auto &entry) {
+                                    return entry.second.use_count() == 1;
+                                  }),
+                   mine.owned.end());
+
+  std::shared_ptr<Ring> claimed;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &r : rings) {
+      bool free = false;
+      if (r->owned.compare_exchange_strong(free, true,
+                                           std::memory_order_acquire)) {
+        claimed = r;
+        break;
+      }
+    }
+    if (!claimed) {
+      claimed = std::make_shared<Ring>();
+      rings.push_back(claimed);
+    }
+  }
+  mine.owned.emplace_back(serial, claimed);
+  return claimed.get();
+}
+
+void IntersectLog::record(const ray &r, const isect &i, bool hit) {
+  Ring *log = ring();
+  uint64_t head = log->head.load(std::memory_order_relaxed);
+  log->records[head % SLOTS] =
+      IntersectRecord{r.getPosition(), r.getDirection(), i.getN(),
+                      i.getT(),        int(r.type()),    hit};
+  log->head.store(head + 1, std::memory_order_release);
+}
+
+void IntersectLog::clear() {
+  Ring *log = ring();
+  log->start.store(log->head.load(std::memory_order_relaxed),
+                   std::memory_order_release);
+}
+
+std::vector<IntersectRecord> IntersectLog::snapshot() const {
+  std::vector<std::shared_ptr<Ring>> all;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    all = rings;
+  }
+
+  std::vector<IntersectRecord> out;
+  for (const auto &log : all) {
+    uint64_t head = log->head.load(std::memory_order_acquire);
+    uint64_t first = log->start.load(std::memory_order_acquire);
+    first = std::max(first, head > CAPACITY ? head - CAPACITY : 0);
+    size_t copied = out.size();
+    for (uint64_t n = first; n < head; ++n)
+      out.push_back(log->records[n % SLOTS]);
+
+    // The writer may since have reused the slots of the oldest records,
+    // including the one it is writing now; drop those.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now = log->head.load(std::memory_order_relaxed);
+    if (now + 1 > SLOTS && now + 1 - SLOTS > first) {
+      size_t stale = size_t(std::min(now + 1 - SLOTS, head) - first);
+      out.erase(out.begin() + copied, out.begin() + copied + stale);
+    }
+  }
+  return out;
+}
@@ -0,0 +1,75 @@
+#ifndef __INTERSECTLOG_H__
+#define __INTERSECTLOG_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+class ray;
+class isect;
+
+/* One Scene::intersect call as the debugging view draws it: the ray, and
+where it hit (or, for a miss, the point at t = 1000 it is drawn to). */
+struct IntersectRecord {
+  glm::dvec3 position;
+  glm::dvec3 direction;
+  glm::dvec3 normal;
+  double t;
+  int type; // ray::RayType
+  bool hit;
+};
+
+/* The intersections traced while debugging is on, kept so the debugging
+view can draw them. Every thread that records gets a ring of its own for
+the last CAPACITY records. It claims the ring under a lock the first time
+it records to this log, and keeps a thread_local reference to it; after
+that recording takes no lock and no allocation, and memory stays bounded
+however long debugging runs. When the thread exits its ring is released,
+and the next new thread takes it over (keeping what it holds) rather than
+adding another.
+
+Only the owning thread writes or clears a ring. snapshot() may run on any
+thread at the same time: it copies what each ring holds and then drops any
+record that a writer could have overwritten during the copy. */
+class IntersectLog {
+public:
+  static constexpr size_t CAPACITY = 4096;
+
+  IntersectLog();
+  ~IntersectLog();
+
+  IntersectLog(const IntersectLog &) = delete;
+  IntersectLog &operator=(const IntersectLog &) = delete;
+
+  void record(const ray &r, const isect &i, bool hit);
+
+  // Forget what the calling thread has recorded so far.
+  void clear();
+
+  // Everything still recorded, each thread's records oldest first.
+  std::vector<IntersectRecord> snapshot() const;
+
+private:
+  // One slot more than is kept: the one being written next.
+  static constexpr size_t SLOTS = CAPACITY + 1;
+
+  struct Ring {
+    IntersectRecord records[SLOTS];
+    std::atomic<uint64_t> head{0};  // records ever written
+    std::atomic<uint64_t> start{0}; // head at the last clear()
+    std::atomic<bool> owned{true};  // by a live thread
+  };
+
+  Ring *ring();
+
+  const uint64_t serial; // tells logs apart in the threads' references
+  mutable std::mutex lock; // guards `rings`, not what is in them
+  std::vector<std::shared_ptr<Ring>> rings;
+};
+
+#endif // __INTERSECTLOG_H__
@@ -0,0 +1,108 @@
+#include "kdTree.h"
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+
+#include "scene.h"
+
+// Each sphere's quadratic for t is set up for all lanes at once (with GCC
+// and Clang in vector registers); the square roots and the choice of root
+// are left to the lanes the ray actually meets. Sphere::intersectLocal
+// works with a unit radius, so its RAY_EPSILON is radius * RAY_EPSILON here.
+void SphereBlock::intersect(const ray &r, const Geometry *const *objects,
+                            isect &i, bool &have, uint32_t &best) const {
+  // A block has no bounding boxes to test; each sphere is one test.
+  rayStats.primitiveTests += count;
+  glm::dvec3 origin = r.getPosition(), dir = r.getDirection();
+  double a = glm::dot(dir, dir);
+  alignas(32) double b[LANES], discriminant[LANES];
+#if defined(__GNUC__)
+  typedef double Lanes __attribute__((vector_size(LANES * sizeof(double))));
+  Lanes cx, cy, cz, rad;
+  memcpy(&cx, x, sizeof(cx));
+  memcpy(&cy, y, sizeof(cy));
+  memcpy(&cz, z, sizeof(cz));
+  memcpy(&rad, radius, sizeof(rad));
+  Lanes ox = cx - origin.x, oy = cy - origin.y, oz = cz - origin.z;
+  Lanes bl = ox * dir.x + oy * dir.y + oz * dir.z;
+  Lanes c = ox * ox + oy * oy + oz * oz - rad * rad;
+  Lanes dl = bl * bl - a * c;
+  memcpy(b, &bl, sizeof(bl));
+  memcpy(discriminant, &dl, sizeof(dl));
+#else
+  for (int k = 0; k < LANES; ++k) {
+    double ox = x[k] - origin.x, oy = y[k] - origin.y, oz = z[k] - origin.z;
+    b[k] = ox * dir.x + oy * dir.y + oz * dir.z;
+    double c = ox * ox + oy * oy + oz * oz - radius[k] * radius[k];
+    discriminant[k] = b[k] * b[k] - a * c;
+  }
+#endif
+  for (int k = 0; k < count; ++k) {
+    if (discriminant[k] < 0.0)
+      continue;
+    double root = std::sqrt(discriminant[k]);
+    double epsilon = RAY_EPSILON * radius[k];
+    double t2 = (b[k] + root) / a;
+    if (t2 <= epsilon)
+      continue;
+    double t1 = (b[k] - root) / a;
+    double t = t1 > epsilon ? t1 : t2;
+    if (have && (t > i.getT() || (t == i.getT() && ids[k] > best)))
+      continue;
+    const SceneObject *sphere =
+        static_cast<const SceneObject *>(objects[ids[k]]);
+    isect hit;
+    hit.setObject(sphere);
+    hit.setMaterialRef(&sphere->getMaterial());
+    hit.setT(t);
+    hit.setN(glm::normalize(r.at(t) - glm::dvec3(x[k], y[k], z[k])));
+    i = hit;
+    have = true;
+    best = ids[k];
+  }
+}
+
+void KdTreeStats::print(std::ostream &out) const {
+  out << "kd-tree (tree_depth " << maxDepth << ", leaf_size " << leafSize
+      << "): " << objects << " objects";
+  if (unbounded)
+    out << " and " << unbounded << " without bounds";
+  out << std::endl;
+  if (!objects)
+    return;
+
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(2) << "  SAH cost " << sahCost
+      << ", " << interiorNodes << " interior nodes, " << leaves
+      << " leaves (" << emptyLeaves << " empty, " << emptySpace * 100
+      << "% of the volume), depth " << depth << ", "
+      << double(references) / objects << " references per object";
+  if (sphereReferences)
+    out << ", " << sphereReferences << " in sphere blocks";
+  out << ", " << double(runs) / leaves << " type runs per leaf" << std::endl;
+  out.flags(flags);
+
+  out << "  objects by type:";
+  for (int t = 0; t < PRIMITIVE_TYPES; ++t)
+    if (byType[t])
+      out << " " << primitiveTypeName(PrimitiveType(t)) << ":" << byType[t];
+  out << std::endl;
+
+  out << "  leaves by depth:";
+  for (size_t d = 0; d < leavesByDepth.size(); ++d)
+    if (leavesByDepth[d])
+      out << " " << d << ":" << leavesByDepth[d];
+  out << std::endl << "  leaves by size:";
+  for (size_t b = 0; b < leavesBySize.size(); ++b) {
+    if (!leavesBySize[b])
+      continue;
+    // Bucket b holds leaves of 2^(b-1) to 2^b - 1 objects.
+    size_t low = b ? size_t(1) << (b - 1) : 0, high = b ? 2 * low - 1 : 0;
+    out << " " << low;
+    if (high > low)
+      out << "-" << high;
+    out << ":" << leavesBySize[b];
+  }
+  out << std::endl;
+}
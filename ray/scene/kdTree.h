@@ -1,3 +1,415 @@
-#pragma once
+#ifndef __KDTREE_H__
+#define __KDTREE_H__
 
-// Note: you can put kd-tree here
+#include <algorithm>
+#include <iosfwd>
+#include <limits>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../SceneObjects/primitiveRuns.h"
+#include "bbox.h"
+#include "ray.h"
+
+/* What a built KdTree looks like, for judging tree_depth and leaf_size on a
+scene (printed after loading with "kd_report" in the -j config). */
+struct KdTreeStats {
+  int maxDepth = 0; // the limits the tree was built with
+  int leafSize = 0;
+  size_t objects = 0;   // objects with bounds, which are in the tree
+  size_t unbounded = 0; // objects without, which every ray is tested against
+  size_t references = 0; // object references in leaves; objects that
+                         // straddle a split are counted once per leaf
+  size_t sphereReferences = 0; // of those, spheres tested in SphereBlocks
+  size_t runs = 0; // of objects of one type, over all leaves
+  size_t byType[PRIMITIVE_TYPES] = {}; // objects in the tree of each type
+
+  // Expected cost of a ray through the whole tree, counting a traversal
+  // step as 1 and an object test as 80: every node weighted by the chance
+  // (surface area relative to the root) that a ray through the root also
+  // passes through it.
+  double sahCost = 0;
+  int interiorNodes = 0;
+  int leaves = 0;
+  int emptyLeaves = 0;
+  int depth = 0;            // of the deepest leaf
+  double emptySpace = 0;    // fraction of the root's volume in empty leaves
+  std::vector<int> leavesByDepth;
+  std::vector<int> leavesBySize; // 0, 1, 2-3, 4-7, 8-15, ... objects
+
+  void print(std::ostream &out) const;
+};
+
+/* Up to LANES spheres of a kd-tree leaf, centres and radii in separate
+arrays, so that one ray is tested against all of them with packed SIMD
+arithmetic and no virtual calls, bounding boxes or per-object transforms.
+
+A block is 4 doubles wide. How many of them one instruction handles is up
+to the compiler flags: with the default x86-64 target (SSE2) GCC splits
+every operation in two, so it is 2-wide; built with -mavx (or
+-march=native on a machine that has it) it is 4-wide.
+
+The hit is computed in world space straight from the centre and radius,
+with the epsilon Sphere::intersectLocal uses scaled to world units, so it
+is the same hit as the transformed path up to rounding. */
+struct SphereBlock {
+  static constexpr int LANES = 4;
+
+  alignas(32) double x[LANES] = {};
+  alignas(32) double y[LANES] = {};
+  alignas(32) double z[LANES] = {};
+  alignas(32) double radius[LANES] = {};
+  uint32_t ids[LANES]; // into the tree's objects
+  int count = 0;
+
+  // Intersect r with each sphere k < count, which is objects[ids[k]]. Like
+  // intersectRun: the nearest hit so far is in i, `have` and `best` say
+  // whether there is one and the id of its object, and a hit replaces it
+  // if it is nearer, or as near and has a lower id.
+  void intersect(const ray &r, const Geometry *const *objects, isect &i,
+                 bool &have, uint32_t &best) const;
+};
+
+/* A kd-tree over the world-space bounding boxes of a scene's objects, split
+by the surface area heuristic. `maxDepth` limits how deep it goes, and a
+node with at most `leafSize` objects is not split any further.
+
+intersect() finds the same hit as testing every object in turn: of hits at
+equal t the earliest object in the list wins, as it does for the linear
+loop in Scene::intersect. Objects without bounds are kept aside and always
+tested, the spheres of each leaf are packed into SphereBlocks and the rest
+are sorted into runs of one PrimitiveType. Obj is Geometry; a template
+only so the scene header can forward declare it. */
+template <typename Obj> class KdTree {
+public:
+  static constexpr int DEPTH_LIMIT = 64;
+
+  KdTree(const std::vector<Obj *> &objects, int maxDepth, int leafSize);
+
+  bool intersect(ray &r, isect &i) const;
+
+  const KdTreeStats &getStats() const { return stats; }
+
+private:
+  // Relative costs for the surface area heuristic, as in pbrt.
+  static constexpr double TRAVERSAL_COST = 1.0;
+  static constexpr double INTERSECT_COST = 80.0;
+  static constexpr double EMPTY_BONUS = 0.5;
+  static constexpr uint32_t LEAF = 3;
+
+  struct Node {
+    double split;
+    uint32_t axis;  // 0-2, or LEAF
+    uint32_t index; // interior: the child above the split (the one below
+                    // is the next node); leaf: first entry of `refs`
+    uint32_t firstRun; // leaf: its objects other than spheres, as entries
+    uint32_t runCount; // of `runs` covering `refs` from `index` on
+    uint32_t firstBlock; // leaf: its spheres, as entries of `blocks`
+    uint32_t blockCount;
+  };
+  struct Run {
+    PrimitiveType type;
+    uint32_t count;
+  };
+  struct Box {
+    glm::dvec3 min, max;
+    double area() const {
+      glm::dvec3 d = max - min;
+      return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+    double volume() const {
+      glm::dvec3 d = max - min;
+      return d[0] * d[1] * d[2];
+    }
+  };
+  struct Edge {
+    double t;
+    bool start;
+    bool operator<(const Edge &o) const {
+      return t < o.t || (t == o.t && start && !o.start);
+    }
+  };
+
+  void build(std::vector<uint32_t> &ids, const Box &box, int depth,
+             int badRefines);
+  void makeLeaf(uint32_t node, const std::vector<uint32_t> &ids,
+                const Box &box, int depth);
+
+  std::vector<const Obj *> objects; // in scene order
+  std::vector<Box> boxes;           // of each object
+  std::vector<uint32_t> unbounded;
+  std::vector<Node> nodes;
+  std::vector<uint32_t> refs;
+  std::vector<Run> runs;
+  std::vector<SphereBlock> blocks;
+  std::vector<glm::dvec4> spheres; // centre and radius, or radius < 0
+  std::vector<PrimitiveType> types; // of each object
+  BoundingBox rootBounds;
+  Box root;
+  int maxDepth;
+  int leafSize;
+  KdTreeStats stats;
+};
+
+template <typename Obj>
+KdTree<Obj>::KdTree(const std::vector<Obj *> &sceneObjects, int maxDepth,
+                    int leafSize)
+    : objects(sceneObjects.begin(), sceneObjects.end()),
+      maxDepth(std::min(std::max(maxDepth, 0), DEPTH_LIMIT)),
+      leafSize(std::max(leafSize, 1)) {
+  stats.maxDepth = this->maxDepth;
+  stats.leafSize = this->leafSize;
+
+  std::vector<uint32_t> ids;
+  boxes.resize(objects.size());
+  spheres.resize(objects.size(), glm::dvec4(-1.0));
+  types.resize(objects.size());
+  for (uint32_t id = 0; id < objects.size(); ++id) {
+    if (!objects[id]->hasBoundingBoxCapability()) {
+      unbounded.push_back(id);
+      continue;
+    }
+    types[id] = primitiveType(objects[id]);
+    ++stats.byType[int(types[id])];
+    glm::dvec3 centre;
+    double radius;
+    if (types[id] == PrimitiveType::SPHERE &&
+        objects[id]->worldSphere(centre, radius))
+      spheres[id] = glm::dvec4(centre, radius);
+    const BoundingBox &b = objects[id]->getBoundingBox();
+    boxes[id] = Box{b.getMin(), b.getMax()};
+    if (ids.empty())
+      root = boxes[id];
+    root.min = glm::min(root.min, boxes[id].min);
+    root.max = glm::max(root.max, boxes[id].max);
+    ids.push_back(id);
+  }
+  stats.objects = ids.size();
+  stats.unbounded = unbounded.size();
+  if (ids.empty())
+    return;
+
+  // Hits found by the objects themselves can land a little outside their
+  // boxes; don't let the root clip them off.
+  glm::dvec3 extent = root.max - root.min;
+  glm::dvec3 pad(1e-9 * std::max({extent[0], extent[1], extent[2], 1.0}));
+  rootBounds = BoundingBox(root.min - pad, root.max + pad);
+  build(ids, root, 0, 0);
+
+  double rootArea = root.area(), rootVolume = root.volume();
+  stats.sahCost = rootArea > 0 ? stats.sahCost / rootArea : 0;
+  stats.emptySpace = rootVolume > 0 ? stats.emptySpace / rootVolume : 0;
+  stats.references = refs.size() + stats.sphereReferences;
+  stats.runs = runs.size();
+  std::vector<glm::dvec4>().swap(spheres);
+  std::vector<PrimitiveType>().swap(types);
+}
+
+template <typename Obj>
+void KdTree<Obj>::build(std::vector<uint32_t> &ids, const Box &box, int depth,
+                        int badRefines) {
+  uint32_t node = uint32_t(nodes.size());
+  nodes.push_back(Node());
+  size_t n = ids.size();
+  if (n <= size_t(leafSize) || depth >= maxDepth) {
+    makeLeaf(node, ids, box, depth);
+    return;
+  }
+
+  // The cheapest split at any object's bounds on any axis.
+  double leafCost = INTERSECT_COST * n;
+  double invArea = 1.0 / box.area();
+  double bestCost = std::numeric_limits<double>::infinity();
+  double bestSplit = 0;
+  int bestAxis = -1;
+  std::vector<Edge> edges(2 * n);
+  glm::dvec3 size = box.max - box.min;
+  for (int axis = 0; axis < 3; ++axis) {
+    for (size_t k = 0; k < n; ++k) {
+      edges[2 * k] = Edge{boxes[ids[k]].min[axis], true};
+      edges[2 * k + 1] = Edge{boxes[ids[k]].max[axis], false};
+    }
+    std::sort(edges.begin(), edges.end());
+
+    int other0 = (axis + 1) % 3, other1 = (axis + 2) % 3;
+    double crossArea = size[other0] * size[other1];
+    double perimeter = size[other0] + size[other1];
+    size_t below = 0, above = n;
+    for (const Edge &e : edges) {
+      if (!e.start)
+        --above;
+      if (e.t > box.min[axis] && e.t < box.max[axis]) {
+        double belowArea =
+            2 * (crossArea + (e.t - box.min[axis]) * perimeter);
+        double aboveArea =
+            2 * (crossArea + (box.max[axis] - e.t) * perimeter);
+        double bonus = (below == 0 || above == 0) ? EMPTY_BONUS : 0;
+        double cost = TRAVERSAL_COST +
+                      INTERSECT_COST * (1 - bonus) * invArea *
+                          (belowArea * below + aboveArea * above);
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestSplit = e.t;
+          bestAxis = axis;
+        }
+      }
+      if (e.start)
+        ++below;
+    }
+  }
+
+  if (bestCost > leafCost)
+    ++badRefines;
+  if (bestAxis < 0 || (bestCost > 4 * leafCost && n < 16) || badRefines == 3) {
+    makeLeaf(node, ids, box, depth);
+    return;
+  }
+
+  // Objects that touch the split go on both sides.
+  std::vector<uint32_t> belowIds, aboveIds;
+  for (uint32_t id : ids) {
+    if (boxes[id].min[bestAxis] <= bestSplit)
+      belowIds.push_back(id);
+    if (boxes[id].max[bestAxis] >= bestSplit)
+      aboveIds.push_back(id);
+  }
+  std::vector<uint32_t>().swap(ids);
+
+  ++stats.interiorNodes;
+  stats.sahCost += TRAVERSAL_COST * box.area();
+  Box belowBox = box, aboveBox = box;
+  belowBox.max[bestAxis] = bestSplit;
+  aboveBox.min[bestAxis] = bestSplit;
+  build(belowIds, belowBox, depth + 1, badRefines);
+  nodes[node] =
+      Node{bestSplit, uint32_t(bestAxis), uint32_t(nodes.size()), 0, 0, 0, 0};
+  build(aboveIds, aboveBox, depth + 1, badRefines);
+}
+
+template <typename Obj>
+void KdTree<Obj>::makeLeaf(uint32_t node, const std::vector<uint32_t> &ids,
+                           const Box &box, int depth) {
+  uint32_t first = uint32_t(refs.size());
+  uint32_t firstRun = uint32_t(runs.size());
+  uint32_t firstBlock = uint32_t(blocks.size());
+  for (uint32_t id : ids) {
+    const glm::dvec4 &s = spheres[id];
+    if (s.w < 0) {
+      refs.push_back(id);
+      continue;
+    }
+    if (blocks.size() == firstBlock ||
+        blocks.back().count == SphereBlock::LANES)
+      blocks.emplace_back();
+    SphereBlock &b = blocks.back();
+    b.x[b.count] = s.x;
+    b.y[b.count] = s.y;
+    b.z[b.count] = s.z;
+    b.radius[b.count] = s.w;
+    b.ids[b.count] = id;
+    ++b.count;
+    ++stats.sphereReferences;
+  }
+  // Ties go to the lowest id whatever order the objects are tested in, so
+  // sorting them changes nothing but the dispatch.
+  std::sort(refs.begin() + first, refs.end(), [&](uint32_t a, uint32_t b) {
+    return types[a] < types[b] || (types[a] == types[b] && a < b);
+  });
+  for (size_t k = first; k < refs.size(); ++k) {
+    if (k == first || types[refs[k]] != runs.back().type)
+      runs.push_back(Run{types[refs[k]], 0});
+    ++runs.back().count;
+  }
+  nodes[node] = Node{0,
+                     LEAF,
+                     first,
+                     firstRun,
+                     uint32_t(runs.size()) - firstRun,
+                     firstBlock,
+                     uint32_t(blocks.size()) - firstBlock};
+
+  ++stats.leaves;
+  stats.depth = std::max(stats.depth, depth);
+  stats.sahCost += INTERSECT_COST * ids.size() * box.area();
+  if (ids.empty()) {
+    ++stats.emptyLeaves;
+    stats.emptySpace += box.volume();
+  }
+  if (stats.leavesByDepth.size() <= size_t(depth))
+    stats.leavesByDepth.resize(depth + 1);
+  ++stats.leavesByDepth[depth];
+  size_t bucket = 0;
+  for (size_t size = ids.size(); size; size >>= 1)
+    ++bucket;
+  if (stats.leavesBySize.size() <= bucket)
+    stats.leavesBySize.resize(bucket + 1);
+  ++stats.leavesBySize[bucket];
+}
+
+template <typename Obj> bool KdTree<Obj>::intersect(ray &r, isect &i) const {
+  bool have = false;
+  uint32_t best = 0;
+  intersectRun(PrimitiveType::OTHER, objects.data(), unbounded.data(),
+               uint32_t(unbounded.size()), r, i, have, best);
+
+  double tMin, tMax;
+  if (nodes.empty() || !rootBounds.intersect(r, tMin, tMax))
+    return have;
+
+  struct Todo {
+    uint32_t node;
+    double tMin, tMax;
+  };
+  Todo todo[DEPTH_LIMIT];
+  int pending = 0;
+  glm::dvec3 origin = r.getPosition(), dir = r.getDirection();
+  uint32_t n = 0;
+  for (;;) {
+    // Everything left is further away than what was hit.
+    if (have && i.getT() < tMin)
+      break;
+    const Node &node = nodes[n];
+    if (node.axis != LEAF) {
+      int axis = node.axis;
+      bool belowFirst = origin[axis] < node.split ||
+                        (origin[axis] == node.split && dir[axis] <= 0);
+      uint32_t first = belowFirst ? n + 1 : node.index;
+      uint32_t second = belowFirst ? node.index : n + 1;
+      double tPlane = dir[axis] != 0
+                          ? (node.split - origin[axis]) / dir[axis]
+                          : std::numeric_limits<double>::infinity();
+      if (tPlane > tMax || tPlane <= 0) {
+        n = first;
+      } else if (tPlane < tMin) {
+        n = second;
+      } else {
+        todo[pending++] = Todo{second, tPlane, tMax};
+        n = first;
+        tMax = tPlane;
+      }
+      continue;
+    }
+
+    const uint32_t *ids = refs.data() + node.index;
+    for (uint32_t k = 0; k < node.runCount; ++k) {
+      const Run &run = runs[node.firstRun + k];
+      intersectRun(run.type, objects.data(), ids, run.count, r, i, have,
+                   best);
+      ids += run.count;
+    }
+    for (uint32_t k = 0; k < node.blockCount; ++k)
+      blocks[node.firstBlock + k].intersect(r, objects.data(), i, have, best);
+    if (pending == 0)
+      break;
+    --pending;
+    n = todo[pending].node;
+    tMin = todo[pending].tMin;
+    tMax = todo[pending].tMax;
+  }
+  return have;
+}
+
+#endif // __KDTREE_H__
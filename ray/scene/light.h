@@ -32,6 +32,8 @@ public:
 };
 
 class DirectionalLight : public Light {
+  friend class BinaryScene;
+
 public:
   DirectionalLight(Scene *scene, const glm::dvec3 &orien,
                    const glm::dvec3 &color)
@@ -51,6 +53,8 @@ public:
 };
 
 class PointLight : public Light {
+  friend class BinaryScene;
+
 public:
   PointLight(Scene *scene, const glm::dvec3 &pos, const glm::dvec3 &color,
              float constantAttenuationTerm, float linearAttenuationTerm,
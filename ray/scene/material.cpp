@@ -5,14 +5,53 @@
 extern TraceUI *traceUI;
 
 #include "../fileio/images.h"
+#include "cubeMap.h"
+#include "parallel.h"
+#include "timeline.h"
 #include <glm/gtx/io.hpp>
 #include <iostream>
+#include <random>
 
 using namespace std;
 extern bool debugMode;
 
 Material::~Material() {}
 
+// Monte Carlo estimate of the diffuse light reaching point P from the
+// cubemap, using `samples` directions drawn from CubeMap::sampleDirection.
+// The 1/pi of the Lambertian lobe makes a uniformly white environment light
+// a surface as much as a white light shining straight on it would.
+glm::dvec3 Material::shadeEnvironment(Scene *scene, const CubeMap &cubemap,
+                                      int samples, const glm::dvec3 &P,
+                                      const glm::dvec3 &N,
+                                      const isect &i) const {
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double eps = 1e-6;
+  const double invPi = 1.0 / 3.14159265358979323846;
+
+  glm::dvec3 sum(0.0);
+  for (int k = 0; k < samples; ++k) {
+    // Stratify the first number, which picks the cubemap cell.
+    glm::dvec3 random((k + uniform(sampleRng)) / samples, uniform(sampleRng),
+                      uniform(sampleRng));
+    glm::dvec3 L;
+    double pdf;
+    if (!cubemap.sampleDirection(random, L, pdf))
+      return glm::dvec3(0.0);
+    double NdotL = glm::dot(N, L);
+    if (NdotL <= 0.0 || pdf <= 0.0)
+      continue;
+
+    ray shadowRay(P + eps * N, L, glm::dvec3(1.0), ray::SHADOW);
+    isect blocker;
+    if (scene->intersect(shadowRay, blocker))
+      continue;
+
+    sum += cubemap.getColor(L) * (NdotL / pdf);
+  }
+  return kd(i) * invPi * sum / double(samples);
+}
+
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point.
 glm::dvec3 Material::shade(Scene *scene, const ray &r, const isect &i) const {
@@ -71,13 +110,54 @@ color += atten * shadow * (diffuse + specular);
 
   }
 
+  // Image-based lighting from the cubemap
+  int envSamples = traceUI->getEnvSamples();
+  if (envSamples > 0 && traceUI->cubeMap())
+    color += shadeEnvironment(scene, *traceUI->getCubeMap(), envSamples,
+                              r.at(i.getT()), N, i);
+
   return color;
 }
 
 
-TextureMap::TextureMap(string filename) {
-  data = readImage(filename.c_str(), width, height);
-  if (data.empty()) {
+namespace {
+// Shared by every scene and the cubemap, and started on first use so that
+// it picks up the thread count from the command line.
+TaskPool &textureLoaders() {
+  static TaskPool pool(TraceUI::m_threads);
+  return pool;
+}
+} // namespace
+
+TextureMap::TextureMap(string filename) { decode(filename); }
+
+TextureMap *TextureMap::loadAsync(const string &filename) {
+  TextureMap *t = new TextureMap();
+  t->pending = textureLoaders().submit([t, filename]() {
+    Timeline::nameThread("texture loader");
+    t->decode(filename);
+  });
+  return t;
+}
+
+void TextureMap::wait() {
+  if (pending.valid())
+    pending.get();
+}
+
+// A load that is still running writes into this object, so let it finish.
+TextureMap::~TextureMap() {
+  if (pending.valid())
+    pending.wait();
+  if (backing)
+    TextureCache::instance().drop(this);
+}
+
+void TextureMap::decode(const string &filename) {
+  TimelineSpan span("decode texture", "load",
+                    [&filename]() { return filename; });
+  std::vector<uint8_t> rgb = readImage(filename.c_str(), width, height);
+  if (rgb.empty()) {
     width = 0;
     height = 0;
     string error("Unable to load texture map '");
@@ -85,69 +165,297 @@ TextureMap::TextureMap(string filename) {
     error.append("'.");
     throw TextureMapException(error);
   }
+  buildLevels(rgb);
+}
+
+// Each texel of a level is the average of the texels it covers in the level
+// above: 2x2 of them, except that along an odd sized side the last texel
+// covers three, so that the extra row or column is averaged in rather than
+// dropped. Levels are filtered in plain row-major form and only then cut
+// into tiles.
+void TextureMap::buildLevels(const std::vector<uint8_t> &rgb) {
+  levels.clear();
+  if (width <= 0 || height <= 0)
+    return;
+  bool useFloats = traceUI && traceUI->floatTextures();
+  floatTexels = useFloats;
+  backing.reset();
+
+  // Row-major RGB of the level being tiled: the caller's image at first,
+  // then the last one filtered into `half`.
+  const uint8_t *image = rgb.data();
+  std::vector<uint8_t> half, next;
+  int w = width, h = height;
+  for (;;) {
+    Level level;
+    level.width = w;
+    level.height = h;
+    level.tilesAcross = (w + TILE - 1) / TILE;
+    int tilesDown = (h + TILE - 1) / TILE;
+    level.bytes.assign(size_t(level.tilesAcross) * tilesDown * TILE * TILE * 4,
+                       0);
+    for (int y = 0; y < h; ++y) {
+      const uint8_t *in = image + size_t(y) * w * 3;
+      for (int x = 0; x < w; ++x, in += 3) {
+        uint8_t *out = &level.bytes[level.texel(x, y) * 4];
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+      }
+    }
+    if (useFloats) {
+      // One flat pass over the tiled bytes, which the compiler vectorizes.
+      level.floats.resize(level.bytes.size());
+      for (size_t k = 0; k < level.bytes.size(); ++k)
+        level.floats[k] = level.bytes[k] / 255.0f;
+      std::vector<uint8_t>().swap(level.bytes);
+    }
+    levels.push_back(std::move(level));
+    if (w == 1 && h == 1)
+      break;
+
+    int hw = std::max(1, w / 2), hh = std::max(1, h / 2);
+    next.resize(size_t(hw) * hh * 3);
+    for (int y = 0; y < hh; ++y) {
+      int y0 = 2 * y, y1 = y == hh - 1 ? h - 1 : 2 * y + 1;
+      for (int x = 0; x < hw; ++x) {
+        int x0 = 2 * x, x1 = x == hw - 1 ? w - 1 : 2 * x + 1;
+        int count = (y1 - y0 + 1) * (x1 - x0 + 1);
+        int sum[3] = {0, 0, 0};
+        for (int sy = y0; sy <= y1; ++sy) {
+          const uint8_t *in = image + (size_t(sy) * w + x0) * 3;
+          for (int sx = x0; sx <= x1; ++sx, in += 3) {
+            sum[0] += in[0];
+            sum[1] += in[1];
+            sum[2] += in[2];
+          }
+        }
+        uint8_t *out = &next[(size_t(y) * hw + x) * 3];
+        for (int c = 0; c < 3; ++c)
+          out[c] = uint8_t((sum[c] + count / 2) / count);
+      }
+    }
+    half.swap(next);
+    image = half.data();
+    w = hw;
+    h = hh;
+  }
+
+  if (TextureCache::instance().enabled())
+    pageOut();
+}
+
+// Move every level to a backing file, from where the TextureCache reads it
+// back a page at a time. If anything fails the texture stays resident.
+void TextureMap::pageOut() {
+  std::unique_ptr<TextureBacking> file = TextureBacking::create();
+  if (!file)
+    return;
+  for (Level &level : levels) {
+    const void *texels = floatTexels ? (const void *)level.floats.data()
+                                     : (const void *)level.bytes.data();
+    level.size = floatTexels ? level.floats.size() * sizeof(float)
+                             : level.bytes.size();
+    if (!file->append(texels, level.size, level.offset))
+      return;
+  }
+  for (Level &level : levels) {
+    std::vector<uint8_t>().swap(level.bytes);
+    std::vector<float>().swap(level.floats);
+  }
+  backing = std::move(file);
+}
+
+bool TextureMap::readPage(int level, size_t page,
+                          TextureCache::Page &out) const {
+  const Level &L = levels[level];
+  size_t start = page * TextureCache::PAGE_BYTES;
+  if (start >= L.size)
+    return false;
+  out.resize(std::min(TextureCache::PAGE_BYTES, L.size - start));
+  return backing->read(L.offset + start, out.data(), out.size());
+}
+
+std::vector<uint8_t> TextureMap::getPixels() const {
+  std::vector<uint8_t> rgb;
+  if (levels.empty())
+    return rgb;
+  rgb.reserve(size_t(width) * height * 3);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      glm::dvec3 c = getPixelAt(x, y);
+      for (int k = 0; k < 3; ++k)
+        rgb.push_back(uint8_t(std::lround(c[k] * 255.0)));
+    }
+  return rgb;
 }
 
+namespace {
+inline double channel(uint8_t c) { return c / 255.0; }
+inline double channel(float c) { return c; }
+
+template <typename T> glm::dvec3 texelAt(const T *texels, size_t index) {
+  const T *p = texels + 4 * index;
+  return glm::dvec3(channel(p[0]), channel(p[1]), channel(p[2]));
+}
+
+// Texels of a paged level, read through the TextureCache. The page of the
+// last texel is kept, as neighbouring texels usually share it.
+class PagedTexels {
+public:
+  PagedTexels(const TextureMap *texture, int level, bool floats)
+      : texture(texture), level(level), floats(floats) {}
+
+  glm::dvec3 operator()(size_t index) {
+    size_t byte = index * (floats ? 4 * sizeof(float) : 4);
+    size_t number = byte / TextureCache::PAGE_BYTES;
+    if (!page || number != pageNumber) {
+      page = TextureCache::instance().fetch(texture, level, number);
+      pageNumber = number;
+    }
+    if (!page)
+      return glm::dvec3(1.0); // the backing file couldn't be read
+    const uint8_t *at = page->data() + byte % TextureCache::PAGE_BYTES;
+    return floats ? texelAt(reinterpret_cast<const float *>(at), 0)
+                  : texelAt(at, 0);
+  }
+
+private:
+  const TextureMap *texture;
+  int level;
+  bool floats;
+  std::shared_ptr<const TextureCache::Page> page;
+  size_t pageNumber = 0;
+};
+} // namespace
+
 glm::dvec3 TextureMap::getMappedValue(const glm::dvec2 &coord) const {
+  return sampleLevel(0, coord);
+}
+
+glm::dvec3 TextureMap::sampleLevel(int level, const glm::dvec2 &coord) const {
     if (width == 0 || height == 0) {
         return glm::dvec3(1.0); // safety fallback
     }
 
+    const Level &L = levels[level];
+
     // Clamp UVs
     double u = glm::clamp(coord.x, 0.0, 1.0);
     double v = glm::clamp(coord.y, 0.0, 1.0);
 
     // Convert to image space
-    double x = u * (width  - 1);
-    double y = v * (height - 1); // flip V (image origin is top-left)
+    double x = u * (L.width  - 1);
+    double y = v * (L.height - 1); // flip V (image origin is top-left)
 
     int x0 = static_cast<int>(std::floor(x));
     int y0 = static_cast<int>(std::floor(y));
-    int x1 = x0 + 1;
-    int y1 = y0 + 1;
+    int x1 = std::min(x0 + 1, L.width - 1);
+    int y1 = std::min(y0 + 1, L.height - 1);
 
     double sx = x - x0;
     double sy = y - y0;
 
     // Sample four surrounding pixels
-    glm::dvec3 c00 = getPixelAt(x0, y0);
-    glm::dvec3 c10 = getPixelAt(x1, y0);
-    glm::dvec3 c01 = getPixelAt(x0, y1);
-    glm::dvec3 c11 = getPixelAt(x1, y1);
-
-    // Interpolate in x
-    glm::dvec3 c0 = (1.0 - sx) * c00 + sx * c10;
-    glm::dvec3 c1 = (1.0 - sx) * c01 + sx * c11;
+    auto blend = [&](auto &&fetch) {
+      glm::dvec3 c00 = fetch(L.texel(x0, y0));
+      glm::dvec3 c10 = fetch(L.texel(x1, y0));
+      glm::dvec3 c01 = fetch(L.texel(x0, y1));
+      glm::dvec3 c11 = fetch(L.texel(x1, y1));
+
+      // Interpolate in x
+      glm::dvec3 c0 = (1.0 - sx) * c00 + sx * c10;
+      glm::dvec3 c1 = (1.0 - sx) * c01 + sx * c11;
+
+      // Interpolate in y
+      return (1.0 - sy) * c0 + sy * c1;
+    };
+    if (backing)
+      return blend(PagedTexels(this, level, floatTexels));
+    if (!L.floats.empty())
+      return blend([&](size_t i) { return texelAt(L.floats.data(), i); });
+    return blend([&](size_t i) { return texelAt(L.bytes.data(), i); });
+}
 
-    // Interpolate in y
-    return (1.0 - sy) * c0 + sy * c1;
+glm::dvec3 TextureMap::sampleTrilinear(double lod,
+                                       const glm::dvec2 &coord) const {
+  int last = getLevels() - 1;
+  if (lod <= 0.0)
+    return sampleLevel(0, coord);
+  if (lod >= last)
+    return sampleLevel(last, coord);
+  int level = int(lod);
+  double f = lod - level;
+  return (1.0 - f) * sampleLevel(level, coord) +
+         f * sampleLevel(level + 1, coord);
 }
 
+glm::dvec3 TextureMap::getFilteredValue(const glm::dvec2 &coord,
+                                        const glm::dvec2 &dx,
+                                        const glm::dvec2 &dy,
+                                        Filter filter) const {
+  // Footprint side lengths, in texels of the full resolution image.
+  glm::dvec2 size(width, height);
+  double lx = glm::length(dx * size);
+  double ly = glm::length(dy * size);
+  double major = std::max(lx, ly);
+  if (filter == BILINEAR || major <= 1.0)
+    return sampleLevel(0, coord);
+
+  if (filter == TRILINEAR)
+    return sampleTrilinear(std::log2(major), coord);
+
+  // Anisotropic: cover the long side with up to MAX_TAPS samples taken at
+  // the level matching the spacing between them (or the short side, if
+  // that is wider).
+  const int MAX_TAPS = 8;
+  double minor = std::min(lx, ly);
+  int taps = int(std::ceil(major / std::max(minor, major / MAX_TAPS)));
+  taps = std::max(1, std::min(taps, MAX_TAPS));
+  double lod = std::log2(std::max(major / taps, minor));
+  glm::dvec2 axis = lx >= ly ? dx : dy;
+  glm::dvec3 sum(0.0);
+  for (int k = 0; k < taps; ++k)
+    sum += sampleTrilinear(lod, coord + axis * ((k + 0.5) / taps - 0.5));
+  return sum / double(taps);
+}
 
 glm::dvec3 TextureMap::getPixelAt(int x, int y) const {
+    if (levels.empty()) {
+        return glm::dvec3(1.0);
+    }
+
     // Clamp to image bounds
     x = std::max(0, std::min(x, width - 1));
     y = std::max(0, std::min(y, height - 1));
 
-    int idx = (y * width + x) * 3;
+    const Level &L = levels[0];
+    size_t index = L.texel(x, y);
+    if (backing)
+      return PagedTexels(this, 0, floatTexels)(index);
+    return L.floats.empty() ? texelAt(L.bytes.data(), index)
+                            : texelAt(L.floats.data(), index);
+}
 
-    double r = data[idx]     / 255.0;
-    double g = data[idx + 1] / 255.0;
-    double b = data[idx + 2] / 255.0;
 
-    return glm::dvec3(r, g, b);
+namespace {
+glm::dvec3 lookup(const TextureMap &map, const isect &is) {
+  return map.getFilteredValue(
+      is.getUVCoordinates(), is.getUVdx(), is.getUVdy(),
+      TextureMap::Filter(traceUI->getTextureFilter()));
 }
-
+} // namespace
 
 glm::dvec3 MaterialParameter::value(const isect &is) const {
   if (0 != _textureMap)
-    return _textureMap->getMappedValue(is.getUVCoordinates());
+    return lookup(*_textureMap, is);
   else
     return _value;
 }
 
 double MaterialParameter::intensityValue(const isect &is) const {
   if (0 != _textureMap) {
-    glm::dvec3 value(_textureMap->getMappedValue(is.getUVCoordinates()));
+    glm::dvec3 value(lookup(*_textureMap, is));
     return (0.299 * value[0]) + (0.587 * value[1]) + (0.114 * value[2]);
   } else
     return (0.299 * _value[0]) + (0.587 * _value[1]) + (0.114 * _value[2]);
@@ -7,13 +7,16 @@
 #ifndef __MATERIAL_H__
 #define __MATERIAL_H__
 
+#include "textureCache.h"
 #include <glm/glm.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <future>
 #include <stdint.h>
 #include <string>
 #include <vector>
 
+class CubeMap;
 class Scene;
 class ray;
 class isect;
@@ -23,10 +26,50 @@ using std::string;
 /* The TextureMap class can be used to store a texture map,
 which consists of a bitmap and various accessors to it. To implement basic
 texture mapping, you'll want to fill in the getMappedValue function to
-implement basic texture mapping. */
+implement basic texture mapping.
+
+Every texture also keeps a mip pyramid, built when it is loaded: level n is
+the image box-filtered down to 1/2^n of its size in each direction, ending at
+1x1. getFilteredValue uses it to look up the average colour over a pixel's
+footprint instead of a single point, which is what stops distant textures
+from shimmering and aliasing.
+
+Levels are not stored row by row but in TILE x TILE blocks of texels, each
+block contiguous. A texel is four bytes (RGB and a pad byte), so a tile is
+exactly one 64-byte cache line and the 2x2 texels of a bilinear lookup
+usually come from a single line instead of two rows far apart. With the
+"float_textures" setting the texels are instead converted once, at load, to
+four floats already scaled to [0, 1], trading four times the memory for no
+conversion work per lookup.
+
+When the TextureCache has a budget, the levels are written to a
+TextureBacking file as soon as they are built and only the pages that
+lookups touch are brought back into memory. */
 class TextureMap {
+  friend class BinaryScene;
+  friend class TextureCache;
+
 public:
+  enum Filter {
+    BILINEAR,   // full resolution only, ignoring the footprint
+    TRILINEAR,  // blend the two mip levels closest to the footprint size
+    ANISOTROPIC // several trilinear taps along the footprint's long axis
+  };
+
   TextureMap(string filename);
+  // An already decoded image: 3 bytes (RGB) per pixel, rows top to bottom.
+  TextureMap(int width, int height, const std::vector<uint8_t> &pixels)
+      : width(width), height(height) {
+    buildLevels(pixels);
+  }
+
+  // Start decoding the file on the texture loader threads and return at
+  // once. wait() must be called before the texture is used.
+  static TextureMap *loadAsync(const string &filename);
+
+  // Block until an asynchronous load has finished. Throws
+  // TextureMapException if the file couldn't be decoded.
+  void wait();
 
   // Return the mapped value; here the coordinate is assumed to be within
   // the parametrization space:
@@ -34,6 +77,12 @@ public:
   // (i.e., {(u, v): 0 <= u <= 1 and 0 <= v <= 1}
   glm::dvec3 getMappedValue(const glm::dvec2 &coord) const;
 
+  // The average value over a footprint centred on coord, whose sides are
+  // the (u, v) vectors dx and dy (see isect::getUVdx). A zero footprint
+  // gives the same result as getMappedValue.
+  glm::dvec3 getFilteredValue(const glm::dvec2 &coord, const glm::dvec2 &dx,
+                              const glm::dvec2 &dy, Filter filter) const;
+
   // Retrieve the value stored in a physical location (with integer coordinates)
   // in the bitmap. Should be called from getMappedValue in order to do
   // bilinear interpolation.
@@ -41,13 +90,52 @@ public:
 
   int getWidth() const { return width; }
   int getHeight() const { return height; }
+  // Number of mip levels, counting the full resolution image.
+  int getLevels() const { return int(levels.size()); }
+  // The full resolution image as 3 bytes (RGB) per pixel, rows top to
+  // bottom, i.e. in the form the constructor takes.
+  std::vector<uint8_t> getPixels() const;
 
-  ~TextureMap() {}
+  ~TextureMap();
 
 protected:
+  TextureMap() : width(0), height(0) {}
+  void decode(const string &filename);
+  // Build the pyramid from a row-major RGB image of width x height.
+  void buildLevels(const std::vector<uint8_t> &rgb);
+  void pageOut();
+
+  // Bilinear lookup in one level of the pyramid, 0 being full resolution.
+  glm::dvec3 sampleLevel(int level, const glm::dvec2 &coord) const;
+  // Linear blend between the two levels around a fractional one.
+  glm::dvec3 sampleTrilinear(double lod, const glm::dvec2 &coord) const;
+  // Read one page of a level from the backing file, for the TextureCache.
+  bool readPage(int level, size_t page, TextureCache::Page &out) const;
+
+  static constexpr int TILE = 4; // texels per side of a tile
+
+  struct Level {
+    int width;
+    int height;
+    int tilesAcross;
+    std::vector<uint8_t> bytes; // 4 per texel, unless floats is used
+    std::vector<float> floats;  // 4 per texel, for float textures
+    size_t offset = 0;          // where a paged level is in the backing
+    size_t size = 0;            // and how many bytes it takes there
+
+    // Index of texel (x, y) in units of texels.
+    size_t texel(int x, int y) const {
+      return (size_t(y / TILE) * tilesAcross + x / TILE) * (TILE * TILE) +
+             (y % TILE) * TILE + x % TILE;
+    }
+  };
+
   int width;
   int height;
-  std::vector<uint8_t> data;
+  std::vector<Level> levels; // full resolution first, halving each time
+  bool floatTexels = false;
+  std::unique_ptr<TextureBacking> backing; // set if the levels are paged
+  std::future<void> pending; // set while an asynchronous load is running
 };
 
 class TextureMapException {
@@ -72,6 +160,8 @@ to do this.
 */
 
 class MaterialParameter {
+  friend class BinaryScene;
+
 public:
   explicit MaterialParameter(const glm::dvec3 &par)
       : _value(par), _textureMap(0) {}
@@ -139,6 +229,8 @@ private:
 };
 
 class Material {
+  friend class BinaryScene;
+
 public:
   Material()
       : _ke(glm::dvec3(0.0, 0.0, 0.0)), _ka(glm::dvec3(0.0, 0.0, 0.0)),
@@ -236,6 +328,10 @@ public:
   bool Both() const { return _both; }
 
 private:
+  glm::dvec3 shadeEnvironment(Scene *scene, const CubeMap &cubemap,
+                              int samples, const glm::dvec3 &P,
+                              const glm::dvec3 &N, const isect &i) const;
+
   MaterialParameter _ke; // emissive
   MaterialParameter _ka; // ambient
   MaterialParameter _ks; // specular
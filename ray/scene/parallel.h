@@ -0,0 +1,120 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/* Run body(i) for every i in [0, count) on up to `threads` threads. Work is
+handed out one index at a time, so uneven items still balance. The first
+exception thrown by any call is rethrown on the calling thread once every
+worker has stopped. */
+template <typename Body>
+void parallelFor(size_t count, int threads, const Body &body) {
+  size_t workers = std::min(count, size_t(std::max(threads, 1)));
+  if (workers <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      body(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  std::exception_ptr error;
+  std::mutex errorLock;
+
+  auto work = [&]() {
+    for (size_t i; !failed && (i = next++) < count;) {
+      try {
+        body(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(errorLock);
+        if (!error)
+          error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < workers; ++t)
+    pool.emplace_back(work);
+  work();
+  for (auto &th : pool)
+    th.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/* A fixed set of worker threads that run submitted jobs in order. submit()
+returns a future for the job's result; an exception thrown by the job is
+stored in the future and rethrown by get(). The destructor lets queued jobs
+finish before joining the workers. */
+class TaskPool {
+public:
+  explicit TaskPool(int threads) {
+    for (int t = 0; t < std::max(threads, 1); ++t)
+      workers.emplace_back([this]() { run(); });
+  }
+
+  ~TaskPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &th : workers)
+      th.join();
+  }
+
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+
+  template <typename Job>
+  std::future<std::invoke_result_t<Job>> submit(Job job) {
+    using Result = std::invoke_result_t<Job>;
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+    std::future<Result> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      jobs.emplace_back([task]() { (*task)(); });
+    }
+    wake.notify_one();
+    return result;
+  }
+
+private:
+  void run() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      job();
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+};
+
+#endif // __PARALLEL_H__
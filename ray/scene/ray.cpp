@@ -5,16 +5,20 @@
 
 
 const Material &isect::getMaterial() const {
-  return material ? *material : obj->getMaterial();
+  if (material)
+    return *material;
+  return materialRef ? *materialRef : obj->getMaterial();
 }
 
 ray::ray(const glm::dvec3 &pp, const glm::dvec3 &dd, const glm::dvec3 &w,
          RayType tt)
     : p(pp), d(dd), atten(w), t(tt) {
-  TraceUI::addRay(ray_thread_id);
+  TraceUI::addRay(ray_thread_id, tt);
 }
 
-ray::ray(const ray &other) : p(other.p), d(other.d), atten(other.atten) {
+ray::ray(const ray &other)
+    : p(other.p), d(other.d), atten(other.atten), t(other.t),
+      differentials(other.differentials), diff(other.diff) {
   TraceUI::addRay(ray_thread_id);
 }
 
@@ -25,9 +29,13 @@ ray &ray::operator=(const ray &other) {
   d = other.d;
   atten = other.atten;
   t = other.t;
+  differentials = other.differentials;
+  diff = other.diff;
   return *this;
 }
 
 glm::dvec3 ray::at(const isect &i) const { return at(i.getT()); }
 
 thread_local unsigned int ray_thread_id = 0;
+thread_local RayStats rayStats;
+thread_local std::mt19937 sampleRng;
@@ -14,6 +14,8 @@
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <memory>
+#include <random>
+#include <stdint.h>
 
 class SceneObject;
 class isect;
@@ -23,6 +25,26 @@ class isect;
  */
 extern thread_local unsigned int ray_thread_id;
 
+/*
+ * rayStats: running totals of the work this thread has done tracing rays,
+ * for the per-pixel cost maps. They only ever go up; the difference across
+ * a pixel is what it cost.
+ */
+struct RayStats {
+  uint64_t rays = 0;           // Scene::intersect calls
+  uint64_t boxTests = 0;       // bounding boxes tested in Geometry::intersect
+  uint64_t primitiveTests = 0; // intersectLocal calls and mesh triangles
+};
+extern thread_local RayStats rayStats;
+
+/*
+ * sampleRng: where this thread's random samples come from (antialiasing
+ * jitter, environment lighting). RayTracer reseeds it from the pixel's
+ * position before tracing each pixel, so what a pixel draws doesn't depend
+ * on which pixels were traced before it.
+ */
+extern thread_local std::mt19937 sampleRng;
+
 // A ray has a position where the ray starts, and a direction (which should
 // always be normalized!)
 
@@ -30,6 +52,16 @@ class ray {
 public:
   enum RayType { VISIBILITY, REFLECTION, REFRACTION, SHADOW };
 
+  // Ray differentials (Igehy, "Tracing Ray Differentials", 1999): how the
+  // origin and direction change when moving one pixel to the right (x) or
+  // down (y). Camera rays get them from Camera::rayThrough, and traceRay
+  // carries them through reflection and refraction so that texture lookups
+  // know the size of the pixel's footprint.
+  struct Differentials {
+    glm::dvec3 dPdx, dPdy;
+    glm::dvec3 dDdx, dDdy;
+  };
+
   ray(const glm::dvec3 &pp, const glm::dvec3 &dd, const glm::dvec3 &w,
       RayType tt = VISIBILITY);
   ray(const ray &other);
@@ -48,11 +80,20 @@ public:
   void setPosition(const glm::dvec3 &pp) { p = pp; }
   void setDirection(const glm::dvec3 &dd) { d = dd; }
 
+  bool hasDifferentials() const { return differentials; }
+  const Differentials &getDifferentials() const { return diff; }
+  void setDifferentials(const Differentials &dd) {
+    diff = dd;
+    differentials = true;
+  }
+
 private:
   glm::dvec3 p;
   glm::dvec3 d;
   glm::dvec3 atten;
   RayType t;
+  bool differentials = false;
+  Differentials diff;
 };
 
 
@@ -61,7 +102,8 @@ private:
 class isect {
 public:
   isect()
-      : obj(NULL), t(0.0), N(), uvCoordinates(), bary(), material(nullptr) {}
+      : obj(NULL), t(0.0), N(), uvCoordinates(), bary(), dudP(), dvdP(),
+        uvDx(), uvDy(), material(nullptr), materialRef(nullptr) {}
   isect(const isect &other) { copyFromOther(other); }
 
   ~isect() {}
@@ -86,8 +128,31 @@ public:
     else
       material.reset(new Material(m));
   }
+  // Use a material that outlives this intersection (e.g. one held by the
+  // object that was hit) without copying it.
+  void setMaterialRef(const Material *m) {
+    material.reset();
+    materialRef = m;
+  }
   void setUVCoordinates(const glm::dvec2 &coords) { uvCoordinates = coords; }
   glm::dvec2 getUVCoordinates() const { return uvCoordinates; }
+  // How u and v change per unit of distance along the surface, in world
+  // space. Left at zero by objects without texture coordinates.
+  void setUVGradients(const glm::dvec3 &du, const glm::dvec3 &dv) {
+    dudP = du;
+    dvdP = dv;
+  }
+  const glm::dvec3 &getUGradient() const { return dudP; }
+  const glm::dvec3 &getVGradient() const { return dvdP; }
+  // The pixel's footprint in texture space: the change in (u, v) from this
+  // pixel to the next one in x and in y. Zero when unknown, which makes
+  // texture lookups sample the full resolution image.
+  void setUVFootprint(const glm::dvec2 &dx, const glm::dvec2 &dy) {
+    uvDx = dx;
+    uvDy = dy;
+  }
+  const glm::dvec2 &getUVdx() const { return uvDx; }
+  const glm::dvec2 &getUVdy() const { return uvDy; }
   void setBary(const glm::dvec3 &weights) { bary = weights; }
   void setBary(const double alpha, const double beta, const double gamma) {
     setBary(glm::dvec3(alpha, beta, gamma));
@@ -103,6 +168,11 @@ private:
     N = other.N;
     bary = other.bary;
     uvCoordinates = other.uvCoordinates;
+    dudP = other.dudP;
+    dvdP = other.dvdP;
+    uvDx = other.uvDx;
+    uvDy = other.uvDy;
+    materialRef = other.materialRef;
     if (other.material) {
       setMaterial(*other.material);
     } else {
@@ -115,10 +185,14 @@ private:
   glm::dvec3 N;
   glm::dvec2 uvCoordinates;
   glm::dvec3 bary;
+  glm::dvec3 dudP, dvdP;
+  glm::dvec2 uvDx, uvDy;
 
   // if this intersection has its own material (as opposed to one in its
   // associated object) as in the case where the material was interpolated
   std::unique_ptr<Material> material;
+  // otherwise, the material that was hit, if it isn't the object's own
+  const Material *materialRef;
 };
 
 const double RAY_EPSILON = 0.00000001;
@@ -12,31 +12,14 @@ using namespace std;
 
 bool Geometry::intersect(ray &r, isect &i) const {
   double tmin, tmax;
-  if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax)))
-    return false;
-  // Transform the ray into the object's local coordinate space
-  glm::dvec3 pos = transform.globalToLocalCoords(r.getPosition());
-  glm::dvec3 dir =
-      transform.globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
-  double length = glm::length(dir);
-  dir = glm::normalize(dir);
-  // Backup World pos/dir, and switch to local pos/dir
-  glm::dvec3 Wpos = r.getPosition();
-  glm::dvec3 Wdir = r.getDirection();
-  r.setPosition(pos);
-  r.setDirection(dir);
-  bool rtrn = false;
-  if (intersectLocal(r, i)) {
-    // Transform the intersection point & normal returned back into
-    // global space.
-    i.setN(transform.localToGlobalCoordsNormal(i.getN()));
-    i.setT(i.getT() / length);
-    rtrn = true;
+  if (hasBoundingBoxCapability()) {
+    ++rayStats.boxTests;
+    if (!bounds.intersect(r, tmin, tmax))
+      return false;
   }
-  // Restore World pos/dir
-  r.setPosition(Wpos);
-  r.setDirection(Wdir);
-  return rtrn;
+  ++rayStats.primitiveTests;
+  return intersectTransformed(
+      r, i, [this](ray &r, isect &i) { return intersectLocal(r, i); });
 }
 
 bool Geometry::hasBoundingBoxCapability() const {
@@ -93,12 +76,8 @@ void Geometry::ComputeBoundingBox() {
 
 Scene::Scene() { ambientIntensity = glm::dvec3(0, 0, 0); }
 
-Scene::~Scene() {
-  for (auto &obj : objects)
-    delete obj;
-  for (auto &light : lights)
-    delete light;
-}
+// Lights and geometry are destroyed along with elementArena.
+Scene::~Scene() {}
 
 void Scene::add(Geometry *obj) {
   obj->ComputeBoundingBox();
@@ -108,6 +87,20 @@ void Scene::add(Geometry *obj) {
 
 void Scene::add(Light *light) { lights.emplace_back(light); }
 
+void Scene::finalize() {
+  // Textures decode in the background while the rest of the scene is
+  // parsed; they all have to be ready before anything is rendered.
+  for (auto &entry : textureCache)
+    entry.second->wait();
+
+  sceneBounds = BoundingBox();
+  for (auto &obj : objects) {
+    if (!obj->getTransform().isIdentity() && obj->bakeTransform())
+      obj->ComputeBoundingBox();
+    sceneBounds.merge(obj->getBoundingBox());
+  }
+}
+
 
 // Get any intersection with an object.  Return information about the
 // intersection through the reference parameter.
@@ -115,12 +108,17 @@ bool Scene::intersect(ray &r, isect &i) const {
   double tmin = 0.0;
   double tmax = 0.0;
   bool have_one = false;
-  for (const auto &obj : objects) {
-    isect cur;
-    if (obj->intersect(r, cur)) {
-      if (!have_one || (cur.getT() < i.getT())) {
-        i = cur;
-        have_one = true;
+  ++rayStats.rays;
+  if (kdtree) {
+    have_one = kdtree->intersect(r, i);
+  } else {
+    for (const auto &obj : objects) {
+      isect cur;
+      if (obj->intersect(r, cur)) {
+        if (!have_one || (cur.getT() < i.getT())) {
+          i = cur;
+          have_one = true;
+        }
       }
     }
   }
@@ -128,15 +126,19 @@ bool Scene::intersect(ray &r, isect &i) const {
     i.setT(1000.0);
   // if debugging,
   if (TraceUI::m_debug) {
-    addToIntersectCache(std::make_pair(new ray(r), new isect(i)));
+    addToIntersectCache(r, i, have_one);
   }
   return have_one;
 }
 
+void Scene::setKdTree(unique_ptr<KdTree<Geometry>> tree) {
+  kdtree = std::move(tree);
+}
+
 TextureMap *Scene::getTexture(string name) {
   auto itr = textureCache.find(name);
   if (itr == textureCache.end()) {
-    textureCache[name].reset(new TextureMap(name));
+    textureCache[name].reset(TextureMap::loadAsync(name));
     return textureCache[name].get();
   }
   return itr->second.get();
@@ -10,14 +10,16 @@
 #define __SCENE_H__
 
 #include <algorithm>
+#include <cmath>
 #include <map>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <vector>
 
+#include "arena.h"
 #include "bbox.h"
 #include "camera.h"
+#include "intersectLog.h"
 #include "material.h"
 #include "ray.h"
 
@@ -66,6 +68,7 @@ protected:
   glm::dmat4x4 xform;
   glm::dmat4x4 inverse;
   glm::dmat3x3 normi;
+  bool identity;
 
 public:
   MatrixTransform() : MatrixTransform(glm::dmat4(1.0)) {}
@@ -73,8 +76,13 @@ public:
   MatrixTransform(const glm::dmat4x4 &xform) : xform{xform} {
     this->inverse = glm::inverse(this->xform);
     this->normi = glm::transpose(glm::inverse(glm::dmat3x3(this->xform)));
+    this->identity = (this->xform == glm::dmat4(1.0));
   }
 
+  // True when local and global coordinates coincide, so no transform is
+  // needed at all.
+  bool isIdentity() const { return identity; }
+
   // Coordinate-Space transformation
   glm::dvec3 globalToLocalCoords(const glm::dvec3 &v) const {
     return inverse * v;
@@ -92,6 +100,26 @@ public:
     return glm::normalize(normi * v);
   }
 
+  // The gradient of a function of local position (e.g. a texture
+  // coordinate), as a gradient with respect to global position.
+  glm::dvec3 localToGlobalCoordsGradient(const glm::dvec3 &v) const {
+    return normi * v;
+  }
+
+  // True when the linear part is a rotation (possibly mirrored) times a
+  // uniform scale, which is then stored in scale.
+  bool uniformScale(double &scale) const {
+    glm::dmat3 m(xform);
+    double l0 = glm::length(m[0]), l1 = glm::length(m[1]),
+           l2 = glm::length(m[2]);
+    scale = std::max({l0, l1, l2});
+    double tolerance = 1e-9 * scale;
+    return scale > 0 && scale - std::min({l0, l1, l2}) <= tolerance &&
+           std::abs(glm::dot(m[0], m[1])) <= tolerance * scale &&
+           std::abs(glm::dot(m[1], m[2])) <= tolerance * scale &&
+           std::abs(glm::dot(m[2], m[0])) <= tolerance * scale;
+  }
+
   const glm::dmat4x4 &transform() const { return xform; }
 };
 
@@ -104,10 +132,29 @@ protected:
   // do not call directly - this should only be called by intersect()
   virtual bool intersectLocal(ray &r, isect &i) const = 0;
 
+  // The part of intersect() after the bounding box test: local(r, i) is
+  // intersectLocal, called with r in the object's local space.
+  template <typename Local>
+  bool intersectTransformed(ray &r, isect &i, Local local) const;
+
 public:
   // intersections performed in the global coordinate space.
   bool intersect(ray &r, isect &i) const;
 
+  // intersect() for an object that has bounds and is a T exactly (not a
+  // subclass of it): T's intersectLocal is called directly, not through
+  // the vtable, so a run of objects of one type needs no virtual calls.
+  template <typename T> bool intersectAs(ray &r, isect &i) const {
+    ++rayStats.boxTests;
+    double tmin, tmax;
+    if (!bounds.intersect(r, tmin, tmax))
+      return false;
+    ++rayStats.primitiveTests;
+    return intersectTransformed(r, i, [this](ray &r, isect &i) {
+      return static_cast<const T *>(this)->T::intersectLocal(r, i);
+    });
+  }
+
   virtual bool hasBoundingBoxCapability() const;
   const BoundingBox &getBoundingBox() const { return bounds; }
   glm::dvec3 getNormal() { return glm::dvec3(1.0, 0.0, 0.0); }
@@ -121,6 +168,20 @@ public:
   void setTransform(const MatrixTransform &transform) {
     this->transform = transform;
   };
+  const MatrixTransform &getTransform() const { return transform; }
+
+  // Apply the transform to the object's own geometry and reset it to the
+  // identity, so that intersect() can skip the per-ray coordinate change.
+  // Returns false if the object cannot do this (the default).
+  virtual bool bakeTransform() { return false; }
+
+  // If the object is a sphere in world space, its centre and radius, so
+  // that it can be tested in batches (see SphereBlock). The default says
+  // it isn't.
+  virtual bool worldSphere([[maybe_unused]] glm::dvec3 &centre,
+                           [[maybe_unused]] double &radius) const {
+    return false;
+  }
 
   Geometry(Scene *scene) : SceneElement(scene) {}
 
@@ -139,22 +200,62 @@ protected:
   MatrixTransform transform;
 };
 
+template <typename Local>
+bool Geometry::intersectTransformed(ray &r, isect &i, Local local) const {
+  if (transform.isIdentity()) {
+    // Rays are already normalized in world space, so there is nothing to
+    // transform or rescale.
+    if (!local(r, i))
+      return false;
+    i.setN(glm::normalize(i.getN()));
+    return true;
+  }
+  // Transform the ray into the object's local coordinate space
+  glm::dvec3 pos = transform.globalToLocalCoords(r.getPosition());
+  glm::dvec3 dir =
+      transform.globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
+  double length = glm::length(dir);
+  dir = glm::normalize(dir);
+  // Backup World pos/dir, and switch to local pos/dir
+  glm::dvec3 Wpos = r.getPosition();
+  glm::dvec3 Wdir = r.getDirection();
+  r.setPosition(pos);
+  r.setDirection(dir);
+  bool rtrn = false;
+  if (local(r, i)) {
+    // Transform the intersection point & normal returned back into
+    // global space.
+    i.setN(transform.localToGlobalCoordsNormal(i.getN()));
+    i.setUVGradients(transform.localToGlobalCoordsGradient(i.getUGradient()),
+                     transform.localToGlobalCoordsGradient(i.getVGradient()));
+    i.setT(i.getT() / length);
+    rtrn = true;
+  }
+  // Restore World pos/dir
+  r.setPosition(Wpos);
+  r.setDirection(Wdir);
+  return rtrn;
+}
+
 // A SceneObject is a real actual thing that we want to model in the
 // world. It has extent (its Geometry heritage) and surface properties
 // (its material binding).
 class SceneObject : public Geometry {
 public:
   const Material &getMaterial() const { return this->material; };
-  void setMaterial(Material *m) { this->material = *m; };
+  void setMaterial(const Material *m) { this->material = *m; };
 
   void glDraw(int quality, bool actualMaterials, bool actualTextures) const;
 
 protected:
-  SceneObject(Scene *scene, Material *mat) : Geometry(scene), material{*mat} {}
+  SceneObject(Scene *scene, const Material *mat)
+      : Geometry(scene), material{*mat} {}
   Material material;
 };
 
 class Scene {
+  friend class BinaryScene;
+
 public:
   Scene();
   virtual ~Scene();
@@ -165,14 +266,29 @@ public:
   Scene &operator=(Scene &&other) = delete;
 
   // There is a special assumption for add(): we assume that the object
-  // referred to by the pointer was created with new and will be managed
-  // by this Scene (i.e. nothing else will call delete on the pointer).
+  // referred to by the pointer was created in this Scene's arena, e.g.
+  //   scene->add(scene->arena().create<Sphere>(scene, &mat));
+  // and so is owned by the Scene (nothing may call delete on the pointer).
   // Violation of this assumption may lead to double free or corruption
   void add(Geometry *obj);
   void add(Light *light);
 
+  // Scene-lifetime storage for lights, geometry and mesh faces.
+  Arena &arena() { return elementArena; }
+
   bool intersect(ray &r, isect &i) const;
 
+  // Use a kd-tree over the objects' bounds for intersect(), or test every
+  // object again if `tree` is null. The tree must be built from
+  // getAllObjects() after finalize().
+  void setKdTree(unique_ptr<KdTree<Geometry>> tree);
+  const KdTree<Geometry> *getKdTree() const { return kdtree.get(); }
+
+  // Called once after parsing: waits for textures to finish loading, bakes
+  // object transforms where possible and recomputes the bounds. Throws
+  // TextureMapException if a texture couldn't be loaded.
+  void finalize();
+
   auto beginLights() const { return lights.begin(); }
   auto endLights() const { return lights.end(); }
   const auto &getAllLights() const { return lights; }
@@ -186,7 +302,8 @@ public:
 
   // For efficiency reasons, we'll store texture maps in a cache
   // in the Scene. This makes sure they get deleted when the scene
-  // is destroyed.
+  // is destroyed. The texture is decoded in the background and is only
+  // ready to use after finalize().
   TextureMap *getTexture(string name);
 
   // These two functions are for handling ambient light; in the Phong model, the
@@ -211,6 +328,10 @@ private:
       If you need to search for something within objects or lights, use
       functions in <algorithms> like find() or count()
   */
+  // Declared first so that it is destroyed last, after everything that
+  // might still point into it.
+  Arena elementArena;
+
   std::vector<Geometry *> objects;
   std::vector<Light *> lights;
   Camera camera;
@@ -227,25 +348,21 @@ private:
   // hasBoundingBoxCapability() are exempt from this requirement.
   BoundingBox sceneBounds;
 
-  KdTree<Geometry> *kdtree;
+  unique_ptr<KdTree<Geometry>> kdtree;
 
-  mutable std::mutex intersectionCacheMutex;
+  mutable IntersectLog intersectCache;
 
 public:
-  // This is used for debugging purposes only.
-  void addToIntersectCache(std::pair<ray *, isect *> isect) const {
-    intersectionCacheMutex.lock();
-    intersectCache.push_back(isect);
-    intersectionCacheMutex.unlock();
+  // These are used for debugging purposes only.
+  void addToIntersectCache(const ray &r, const isect &i, bool hit) const {
+    intersectCache.record(r, i, hit);
   }
 
-  void clearIntersectCache() const {
-    intersectionCacheMutex.lock();
-    intersectCache.clear();
-    intersectionCacheMutex.unlock();
-  }
+  void clearIntersectCache() const { intersectCache.clear(); }
 
-  mutable std::vector<std::pair<ray *, isect *>> intersectCache;
+  std::vector<IntersectRecord> getIntersectCache() const {
+    return intersectCache.snapshot();
+  }
 };
 
 #endif // __SCENE_H__
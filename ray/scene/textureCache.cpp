@@ -0,0 +1,109 @@
+#include "textureCache.h"
+#include "../ui/TraceUI.h"
+#include "material.h"
+
+extern TraceUI *traceUI;
+
+std::unique_ptr<TextureBacking> TextureBacking::create() {
+  FILE *file = tmpfile();
+  if (!file)
+    return nullptr;
+  return std::unique_ptr<TextureBacking>(new TextureBacking(file));
+}
+
+TextureBacking::~TextureBacking() { fclose(file); }
+
+bool TextureBacking::append(const void *data, size_t size, size_t &offset) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (fseek(file, long(end), SEEK_SET) != 0 ||
+      fwrite(data, 1, size, file) != size)
+    return false;
+  offset = end;
+  end += size;
+  return true;
+}
+
+bool TextureBacking::read(size_t offset, void *data, size_t size) {
+  std::lock_guard<std::mutex> guard(lock);
+  return fseek(file, long(offset), SEEK_SET) == 0 &&
+         fread(data, 1, size, file) == size;
+}
+
+TextureCache &TextureCache::instance() {
+  static TextureCache cache(
+      traceUI ? size_t(traceUI->getTextureCacheMB()) << 20 : 0);
+  return cache;
+}
+
+TextureCache::TextureCache(size_t budget) : budget(budget) {}
+
+std::shared_ptr<const TextureCache::Page>
+TextureCache::fetch(const TextureMap *texture, int level, size_t page) {
+  Key key{texture, level, page};
+  Shard &shard = shardFor(key);
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto found = shard.entries.find(key);
+    if (found != shard.entries.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, found->second.lru);
+      ++hits;
+      return found->second.page;
+    }
+  }
+
+  // Read without holding the shard, so that hits on other pages go on.
+  ++misses;
+  auto data = std::make_shared<Page>();
+  if (!texture->readPage(level, page, *data))
+    return nullptr;
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto found = shard.entries.find(key);
+  if (found != shard.entries.end()) // another thread read it first
+    return found->second.page;
+  shard.lru.push_front(key);
+  shard.entries[key] = Entry{data, shard.lru.begin()};
+  shard.bytes += data->size();
+  size_t now = resident += data->size();
+  for (size_t peak = peakResident; now > peak;)
+    if (peakResident.compare_exchange_weak(peak, now))
+      break;
+  evict(shard);
+  return data;
+}
+
+// Every shard gets an equal share of the budget, and always keeps the page
+// it was just given.
+void TextureCache::evict(Shard &shard) {
+  size_t share = budget / SHARDS;
+  while (shard.bytes > share && shard.lru.size() > 1) {
+    auto victim = shard.entries.find(shard.lru.back());
+    size_t size = victim->second.page->size();
+    shard.bytes -= size;
+    resident -= size;
+    shard.entries.erase(victim);
+    shard.lru.pop_back();
+    ++evictions;
+  }
+}
+
+void TextureCache::drop(const TextureMap *texture) {
+  for (Shard &shard : shards) {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    for (auto it = shard.lru.begin(); it != shard.lru.end();) {
+      if (it->texture != texture) {
+        ++it;
+        continue;
+      }
+      auto victim = shard.entries.find(*it);
+      shard.bytes -= victim->second.page->size();
+      resident -= victim->second.page->size();
+      shard.entries.erase(victim);
+      it = shard.lru.erase(it);
+    }
+  }
+}
+
+TextureCache::Stats TextureCache::getStats() const {
+  return Stats{hits, misses, evictions, resident, peakResident};
+}
@@ -0,0 +1,131 @@
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+class TextureMap;
+
+/* Where a texture keeps its tiled mip levels when they are not resident: an
+anonymous temporary file that the levels are appended to once, right after
+they are built, and that pages are read back from on demand. The file is
+deleted when the texture goes away. */
+class TextureBacking {
+public:
+  // Returns null if no temporary file can be created.
+  static std::unique_ptr<TextureBacking> create();
+  ~TextureBacking();
+
+  TextureBacking(const TextureBacking &) = delete;
+  TextureBacking &operator=(const TextureBacking &) = delete;
+
+  // Append size bytes and return the offset they were written at. Returns
+  // false if the write failed.
+  bool append(const void *data, size_t size, size_t &offset);
+  // Read size bytes at offset; safe to call from several threads.
+  bool read(size_t offset, void *data, size_t size);
+
+private:
+  explicit TextureBacking(FILE *file) : file(file) {}
+
+  FILE *file;
+  size_t end = 0;
+  std::mutex lock;
+};
+
+/* Keeps the resident pages of every paged texture within a memory budget,
+set with "texture_cache_mb" in the -j config (0, the default, leaves all
+textures fully in memory and the cache unused).
+
+A page is PAGE_BYTES of one mip level's tile array; it is read from the
+texture's TextureBacking on a miss and dropped, least recently used first,
+once the budget is exceeded. The entries are split over a few independently
+locked shards, each with its own LRU list and share of the budget, so that
+render threads rarely wait on each other. Pages are handed out as
+shared_ptrs: one that is evicted while a lookup is still reading it lives
+until that lookup is done. */
+class TextureCache {
+public:
+  static constexpr size_t PAGE_BYTES = 4096;
+
+  using Page = std::vector<uint8_t>;
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t resident;     // bytes of pages currently cached
+    size_t peakResident; // the most that ever were
+  };
+
+  // The cache shared by all textures, sized from the TraceUI settings when
+  // first used.
+  static TextureCache &instance();
+
+  explicit TextureCache(size_t budget);
+
+  TextureCache(const TextureCache &) = delete;
+  TextureCache &operator=(const TextureCache &) = delete;
+
+  bool enabled() const { return budget > 0; }
+  size_t getBudget() const { return budget; }
+
+  // Page `page` of mip level `level` of the texture, read from its backing
+  // store if it isn't cached. Returns null if the read fails.
+  std::shared_ptr<const Page> fetch(const TextureMap *texture, int level,
+                                    size_t page);
+
+  // Forget every page of a texture that is being destroyed.
+  void drop(const TextureMap *texture);
+
+  Stats getStats() const;
+
+private:
+  struct Key {
+    const TextureMap *texture;
+    int level;
+    size_t page;
+    bool operator==(const Key &o) const {
+      return texture == o.texture && level == o.level && page == o.page;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      size_t h = std::hash<const void *>()(k.texture);
+      h ^= (size_t(k.level) + 0x9e3779b9 + (h << 6) + (h >> 2));
+      h ^= (k.page + 0x9e3779b9 + (h << 6) + (h >> 2));
+      return h;
+    }
+  };
+  struct Entry {
+    std::shared_ptr<const Page> page;
+    std::list<Key>::iterator lru;
+  };
+  struct Shard {
+    std::mutex lock;
+    std::list<Key> lru; // most recently used first
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    size_t bytes = 0;
+  };
+
+  static constexpr size_t SHARDS = 16;
+
+  Shard &shardFor(const Key &key) {
+    return shards[KeyHash()(key) % SHARDS];
+  }
+  void evict(Shard &shard);
+
+  size_t budget;
+  Shard shards[SHARDS];
+  std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+  std::atomic<size_t> resident{0}, peakResident{0};
+};
+
+#endif // __TEXTURECACHE_H__
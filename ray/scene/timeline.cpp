@@ -0,0 +1,119 @@
+#include "timeline.h"
+#include <fstream>
+#include <json.hpp>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using Json = nlohmann::json;
+
+std::atomic<bool> Timeline::on{false};
+
+namespace {
+
+struct Event {
+  const char *name;
+  const char *category;
+  Timeline::Clock::time_point begin, end;
+  std::string detail;
+};
+
+// One per thread that ever recorded anything. They belong to the registry,
+// not the thread, so events outlive short-lived worker threads.
+struct ThreadLog {
+  int id;
+  std::string name;
+  std::mutex lock; // only contended while write() runs
+  std::vector<Event> events;
+};
+
+struct Registry {
+  std::mutex lock;
+  std::vector<std::unique_ptr<ThreadLog>> threads;
+  Timeline::Clock::time_point zero;
+};
+
+Registry &registry() {
+  static Registry r;
+  return r;
+}
+
+ThreadLog &threadLog() {
+  thread_local ThreadLog *log = nullptr;
+  if (!log) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.threads.emplace_back(new ThreadLog);
+    log = r.threads.back().get();
+    log->id = int(r.threads.size());
+    log->name = "thread " + std::to_string(log->id);
+  }
+  return *log;
+}
+
+} // namespace
+
+void Timeline::start() {
+  Registry &r = registry();
+  {
+    std::lock_guard<std::mutex> guard(r.lock);
+    if (on)
+      return;
+    r.zero = Clock::now();
+  }
+  on = true;
+}
+
+void Timeline::nameThread(const char *name) {
+  if (!enabled())
+    return;
+  ThreadLog &log = threadLog();
+  std::lock_guard<std::mutex> guard(log.lock);
+  log.name = name;
+}
+
+void Timeline::record(const char *name, const char *category,
+                      Clock::time_point begin, Clock::time_point end,
+                      std::string detail) {
+  ThreadLog &log = threadLog();
+  std::lock_guard<std::mutex> guard(log.lock);
+  log.events.push_back(Event{name, category, begin, end, std::move(detail)});
+}
+
+void Timeline::write(const char *fname) {
+  Registry &r = registry();
+  auto micros = [&r](Clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - r.zero).count();
+  };
+
+  Json events = Json::array();
+  {
+    std::lock_guard<std::mutex> guard(r.lock);
+    for (auto &thread : r.threads) {
+      std::lock_guard<std::mutex> threadGuard(thread->lock);
+      events.push_back(Json{{"name", "thread_name"},
+                            {"ph", "M"},
+                            {"pid", 1},
+                            {"tid", thread->id},
+                            {"args", {{"name", thread->name}}}});
+      for (const Event &e : thread->events) {
+        Json event{{"name", e.name},
+                   {"cat", e.category},
+                   {"ph", "X"},
+                   {"pid", 1},
+                   {"tid", thread->id},
+                   {"ts", micros(e.begin)},
+                   {"dur", micros(e.end) - micros(e.begin)}};
+        if (!e.detail.empty())
+          event["args"] = {{"detail", e.detail}};
+        events.push_back(std::move(event));
+      }
+    }
+  }
+
+  std::ofstream out(fname);
+  out << Json{{"traceEvents", events}, {"displayTimeUnit", "ms"}}.dump()
+      << std::endl;
+  if (!out)
+    throw std::string("Unable to write trace file ") + fname;
+}
@@ -0,0 +1,73 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/* A record of what every thread was doing when, for finding stalls and load
+imbalance. Code marks a phase with a TimelineSpan; once Timeline::start()
+has been called (ray --trace FILE), each span becomes one event, and
+Timeline::write() saves them all in the Chrome trace-event format, which
+chrome://tracing and ui.perfetto.dev open.
+
+Until start() is called a span costs one relaxed atomic load. Recording
+appends to a buffer of the calling thread, so threads don't contend. */
+class Timeline {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+  // Start recording; the first call also sets time zero.
+  static void start();
+
+  // Label the calling thread in the trace; safe to call more than once.
+  static void nameThread(const char *name);
+
+  // Save everything recorded so far. Throws a string if that fails.
+  static void write(const char *fname);
+
+  // Add one finished span. `name` and `category` must be string literals.
+  static void record(const char *name, const char *category,
+                     Clock::time_point begin, Clock::time_point end,
+                     std::string detail);
+
+private:
+  static std::atomic<bool> on;
+};
+
+/* Times its own lifetime as one event on the timeline. `detail`, if given,
+is shown with the event (e.g. the file being loaded); the variant taking a
+function only builds it when recording, so call sites don't pay for string
+formatting when tracing is off. */
+class TimelineSpan {
+public:
+  TimelineSpan(const char *name, const char *category = "ray")
+      : name(Timeline::enabled() ? name : nullptr), category(category) {
+    if (this->name)
+      begin = Timeline::Clock::now();
+  }
+  template <typename Detail>
+  TimelineSpan(const char *name, const char *category, const Detail &detail)
+      : TimelineSpan(name, category) {
+    if (this->name)
+      this->detail = detail();
+  }
+  ~TimelineSpan() {
+    if (name)
+      Timeline::record(name, category, begin, Timeline::Clock::now(),
+                       std::move(detail));
+  }
+
+  TimelineSpan(const TimelineSpan &) = delete;
+  TimelineSpan &operator=(const TimelineSpan &) = delete;
+
+private:
+  const char *name;
+  const char *category;
+  Timeline::Clock::time_point begin;
+  std::string detail;
+};
+
+#endif // __TIMELINE_H__
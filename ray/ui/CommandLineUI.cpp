@@ -1,5 +1,8 @@
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 #ifndef _MSC_VER
 #include <unistd.h>
@@ -11,10 +14,15 @@ extern int getopt(int argc, char **argv, const char *optstring);
 
 #include <assert.h>
 
+#include "../fileio/costmap.h"
 #include "../fileio/images.h"
 #include "CommandLineUI.h"
 
 #include "../RayTracer.h"
+#include "../parser/BinaryScene.h"
+#include "../parser/ParserException.h"
+#include "../scene/textureCache.h"
+#include "../scene/timeline.h"
 
 using namespace std;
 
@@ -25,6 +33,25 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
   progName = argv[0];
   const char *jsonfile = nullptr;
   string cubemap_file;
+
+  // getopt only knows short options, so take the long ones out by hand.
+  int kept = 1;
+  for (int a = 1; a < argc; ++a) {
+    if (!strcmp(argv[a], "--compile"))
+      compileOnly = true;
+    else if (!strcmp(argv[a], "--tonemap"))
+      toneMapOnly = true;
+    else if (!strcmp(argv[a], "--trace") && a + 1 < argc)
+      traceName = argv[++a];
+    else
+      argv[kept++] = argv[a];
+  }
+  argc = kept;
+  if (traceName) {
+    Timeline::start();
+    Timeline::nameThread("main");
+  }
+
   while ((i = getopt(argc, argv, "tr:w:hj:c:")) != EOF) {
     switch (i) {
     case 'r':
@@ -52,6 +79,10 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
   if (jsonfile) {
     loadFromJson(jsonfile);
   }
+  if (compileOnly) {
+    // The .rbin holds full-precision meshes; compress when it is loaded.
+    m_compressMeshes = false;
+  }
   if (!cubemap_file.empty()) {
     smartLoadCubemap(cubemap_file);
   }
@@ -67,35 +98,108 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
 
 int CommandLineUI::run() {
   assert(raytracer != 0);
+  int status = toneMapOnly ? regrade() : render();
+  if (traceName) {
+    try {
+      Timeline::write(traceName);
+    } catch (std::string &error) {
+      alert(error);
+      return 1;
+    }
+  }
+  return status;
+}
+
+int CommandLineUI::render() {
   raytracer->loadScene(rayName);
 
+  if (compileOnly && raytracer->sceneLoaded()) {
+    try {
+      BinaryScene::write(raytracer->getScene(), imgName);
+    } catch (ParserException &pe) {
+      alert(pe.message());
+      return 1;
+    }
+    return 0;
+  }
+
   if (raytracer->sceneLoaded()) {
     int width = m_nSize;
     int height = (int)(width / raytracer->aspectRatio() + 0.5);
 
-    raytracer->traceSetup(width, height);
-
-    clock_t start, end;
-    start = clock();
-
-    raytracer->traceImage(width, height);
-    raytracer->waitRender();
-    if (aaSwitch()) {
-      raytracer->aaImage();
+    // Wall time, not clock(): with several render threads CPU time would
+    // add theirs up.
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start, end;
+    start = Clock::now();
+
+    // Formats that can be written a row at a time are encoded while the
+    // rest of the image is still being traced, and never need the whole
+    // frame in memory; anything else goes through the buffer. So do cost
+    // maps, which are per pixel as well.
+    std::unique_ptr<ImageSink> sink;
+    try {
+      if (!costMaps())
+        sink = openImageSink(imgName, width, height);
+    } catch (std::string &error) {
+      alert(error);
+      return 1;
+    }
+    if (sink) {
+      try {
+        raytracer->traceImage(width, height, *sink);
+        TimelineSpan span("finish image", "write");
+        sink->finish();
+      } catch (std::string &error) {
+        alert(error);
+        return 1;
+      }
+      end = Clock::now();
+    } else {
+      raytracer->traceSetup(width, height);
+      raytracer->traceImage(width, height);
       raytracer->waitRender();
+      if (aaSwitch()) {
+        raytracer->aaImage();
+        raytracer->waitRender();
+      }
+
+      end = Clock::now();
+
+      // save image; float formats get the framebuffer as it is, the
+      // others the tone mapped version of it
+      const float *buf;
+
+      raytracer->getHDRBuffer(buf, width, height);
+
+      const float *costs;
+      raytracer->getCostBuffer(costs, width, height);
+
+      try {
+        if (buf)
+          writeHDRImage(imgName, width, height, buf, getToneMap());
+        if (costs)
+          writeCostMaps(imgName, width, height, costs);
+      } catch (std::string &error) {
+        alert(error);
+        return 1;
+      }
     }
 
-    end = clock();
-
-    // save image
-    unsigned char *buf;
-
-    raytracer->getBuffer(buf, width, height);
-
-    if (buf)
-      writeImage(imgName, width, height, buf);
-
-    [[maybe_unused]] double t = (double)(end - start) / CLOCKS_PER_SEC;
+    double t = std::chrono::duration<double>(end - start).count();
+    // Reported in both modes so that compressed and uncompressed runs can
+    // be compared; ray_bench -z does the comparison over a whole corpus.
+    std::cerr << "render time"
+              << (compressMeshes() ? " (compressed meshes)" : "") << " = " << t
+              << " seconds" << std::endl;
+    if (TextureCache::instance().enabled()) {
+      TextureCache::Stats stats = TextureCache::instance().getStats();
+      std::cerr << "texture cache: " << stats.hits << " hits, " << stats.misses
+                << " misses, " << stats.evictions << " evictions, peak "
+                << (stats.peakResident >> 10) << " of "
+                << (TextureCache::instance().getBudget() >> 10) << " KB"
+                << std::endl;
+    }
     //		int totalRays = TraceUI::resetCount();
     //		std::cout << "total time = " << t << " seconds,
     // rays traced = " << totalRays << std::endl;
@@ -106,6 +210,24 @@ int CommandLineUI::run() {
   }
 }
 
+// Resolve an image that was saved as floats again, e.g. with another
+// exposure, instead of rendering the scene a second time.
+int CommandLineUI::regrade() {
+  int width, height;
+  std::vector<float> rgb = readHDRImage(rayName, width, height);
+  if (rgb.empty()) {
+    std::cerr << "Unable to read image file '" << rayName << "'" << std::endl;
+    return 1;
+  }
+  try {
+    writeHDRImage(imgName, width, height, rgb.data(), getToneMap());
+  } catch (std::string &error) {
+    alert(error);
+    return 1;
+  }
+  return 0;
+}
+
 void CommandLineUI::alert(const string &msg) { std::cerr << msg << std::endl; }
 
 void CommandLineUI::usage() {
@@ -118,5 +240,14 @@ void CommandLineUI::usage() {
        << "  -j <FILE>   set parameters from JSON file" << endl
        << "  -c <FILE>   one Cubemap file, the remainings will be "
           "detected automatically"
+       << endl
+       << "  --compile   save the parsed scene to output.rbin instead of "
+          "rendering it; load it back with `" << progName
+       << " output.rbin image.png`" << endl
+       << "  --tonemap   read input.exr (or .pfm) and save it tone mapped "
+          "with the exposure and tone_map of -j, instead of rendering"
+       << endl
+       << "  --trace <FILE>  save a timeline of the run there as Chrome "
+          "trace JSON (open it in chrome://tracing or ui.perfetto.dev)"
        << endl;
 }
@@ -18,7 +18,12 @@ public:
 
 private:
   void usage();
+  int render();
+  int regrade();
 
+  bool compileOnly = false; // --compile: write a .rbin instead of rendering
+  bool toneMapOnly = false; // --tonemap: resolve an HDR image again
+  const char *traceName = nullptr; // --trace FILE: save a timeline there
   char *rayName;
   char *imgName;
   char *progName;
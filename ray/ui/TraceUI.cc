@@ -50,11 +50,21 @@ void TraceUI::loadFromJson(const char *file) {
   load(json, "tree_depth", m_nTreeDepth);
   load(json, "leaf_size", m_nLeafSize);
   load(json, "filter_width", m_nFilterWidth);
+  load(json, "env_samples", m_nEnvSamples);
+  load(json, "texture_filter", m_textureFilter);
   load(json, "anti_alias", m_antiAlias);
   load(json, "kdtree", m_kdTree);
+  load(json, "kd_report", m_kdReport);
+  load(json, "kd_autotune", m_kdAutoTune);
   load(json, "shadows", m_shadows);
   load(json, "smoothshade", m_smoothshade);
   load(json, "backface_culling", m_backface);
+  load(json, "compress_meshes", m_compressMeshes);
+  load(json, "float_textures", m_floatTextures);
+  load(json, "texture_cache_mb", m_textureCacheMB);
+  load(json, "exposure", m_exposure);
+  load(json, "tone_map", m_toneMap);
+  load(json, "cost_maps", m_costMaps);
   /*
    * Note for Students:
    * The following options are legacy from previous semesters.
@@ -145,8 +155,12 @@ void TraceUI::smartLoadCubemap(const string &file) {
       setCubeMap(new CubeMap());
     }
     try {
+      // Decode the six faces in parallel
       for (int i = 0; i < 6; i++)
-        cubemap->setNthMap(i, new TextureMap(pdir + "/" + matched_fn[i]));
+        cubemap->setNthMap(i,
+                           TextureMap::loadAsync(pdir + "/" + matched_fn[i]));
+      for (int i = 0; i < 6; i++)
+        cubemap->getNthMap(i)->wait();
     } catch (TextureMapException &xcpt) {
       cubemap.reset();
       std::cerr << xcpt.message() << std::endl;
@@ -7,6 +7,7 @@
 #ifndef __TraceUI_h__
 #define __TraceUI_h__
 
+#include "../fileio/tonemap.h"
 #include <memory>
 #include <string>
 #define MAX_THREADS 32
@@ -40,12 +41,26 @@ public:
   int getMaxDepth() const { return m_nTreeDepth; }
   int getLeafSize() const { return m_nLeafSize; }
   int getFilterWidth() const { return m_nFilterWidth; }
+  int getEnvSamples() const { return m_nEnvSamples; }
+  int getTextureFilter() const { return m_textureFilter; }
+  int getTextureCacheMB() const { return m_textureCacheMB; }
   int getThreads() const { return m_threads; }
+  ToneMap getToneMap() const {
+    ToneMap tm;
+    tm.exposure = m_exposure;
+    tm.op = ToneMap::Operator(m_toneMap);
+    return tm;
+  }
   bool aaSwitch() const { return m_antiAlias; }
   bool kdSwitch() const { return m_kdTree; }
+  bool kdReport() const { return m_kdReport; }
+  bool kdAutoTune() const { return m_kdAutoTune; }
   bool shadowSw() const { return m_shadows; }
   bool smShadSw() const { return m_smoothshade; }
   bool bkFaceSw() const { return m_backface; }
+  bool compressMeshes() const { return m_compressMeshes; }
+  bool floatTextures() const { return m_floatTextures; }
+  bool costMaps() const { return m_costMaps; }
   bool cubeMap() const { return m_usingCubeMap && cubemap; }
   CubeMap *getCubeMap() const { return cubemap.get(); }
   void setCubeMap(CubeMap *cm);
@@ -61,6 +76,13 @@ public:
     if (ctr >= 0)
       rayCount[ctr]++;
   }
+  // A new ray of the given ray::RayType; copies only go through addRay(ctr).
+  static void addRay(int ctr, int type) {
+    if (ctr >= 0) {
+      rayCount[ctr]++;
+      rayTypeCount[ctr][type]++;
+    }
+  }
   static int getCount(int ctr) { return ctr < 0 ? -1 : rayCount[ctr]; }
   static int getCount() {
     int total = 0;
@@ -83,6 +105,20 @@ public:
     }
     return total;
   }
+  // Rays of one type created on all threads since the last resetTypeCounts.
+  static unsigned long long getTypeCount(int type) {
+    unsigned long long total = 0;
+    for (int i = 0; i < MAX_THREADS; i++)
+      total += rayTypeCount[i][type];
+    return total;
+  }
+  static void resetTypeCounts() {
+    for (int i = 0; i < MAX_THREADS; i++)
+      for (int t = 0; t < RAY_TYPES; t++)
+        rayTypeCount[i][t] = 0;
+  }
+
+  static constexpr int RAY_TYPES = 4; // the values of ray::RayType
 
   static int m_threads; // number of threads to run
   static bool m_debug;
@@ -102,8 +138,14 @@ protected:
   int m_nTreeDepth = 15;    // maximum kdTree depth
   int m_nLeafSize = 10;     // target number of objects per leaf
   int m_nFilterWidth = 1;   // width of cubemap filter
+  int m_nEnvSamples = 0;    // cubemap light samples per hit, 0 for none
+  int m_textureFilter = 1;  // 0 bilinear, 1 trilinear, 2 anisotropic
+  int m_textureCacheMB = 0; // texture memory budget, 0 for no limit
+  double m_exposure = 0;    // stops applied when resolving the framebuffer
+  int m_toneMap = 0;        // 0 clamp, 1 Reinhard
 
   static int rayCount[MAX_THREADS]; // Ray counter
+  static unsigned long long rayTypeCount[MAX_THREADS][RAY_TYPES];
 
   // Determines whether or not to show debugging information
   // for individual rays.  Disabled by default for efficiency
@@ -111,10 +153,15 @@ protected:
   bool m_displayDebuggingInfo = false;
   bool m_antiAlias = false;    // Is antialiasing on?
   bool m_kdTree = true;        // use kd-tree?
+  bool m_kdReport = false;     // print the kd-tree's statistics once built
+  bool m_kdAutoTune = false;   // pick tree_depth and leaf_size per scene
   bool m_shadows = true;       // compute shadows?
   bool m_smoothshade = true;   // turn on/off smoothshading?
   bool m_backface = true;      // cull backfaces?
   bool m_usingCubeMap = false; // render with cubemap
+  bool m_compressMeshes = false; // quantize trimesh geometry after loading
+  bool m_floatTextures = false;  // keep texels as floats instead of bytes
+  bool m_costMaps = false;       // record and save what each pixel cost
   bool m_internalReflection =
       true; // Enable reflection inside a translucent object.
   bool m_backfaceSpecular = false; // Enable specular component even seeing
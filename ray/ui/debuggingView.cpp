@@ -431,10 +431,9 @@ void DebuggingView::drawScene() {
 void DebuggingView::drawRays() {
   glDisable(GL_LIGHTING);
   // Now draw all the rays
-  for (std::vector<std::pair<ray *, isect *>>::const_iterator rayItr =
-           raytracer->getScene().intersectCache.begin();
-       rayItr != raytracer->getScene().intersectCache.end(); ++rayItr) {
-    switch (rayItr->first->type()) {
+  std::vector<IntersectRecord> rays = raytracer->getScene().getIntersectCache();
+  for (const IntersectRecord &rec : rays) {
+    switch (rec.type) {
     case ray::VISIBILITY:
       if (!m_showVisibilityRays)
         continue;
@@ -459,9 +458,9 @@ void DebuggingView::drawRays() {
       glColor4f(0.20f, 0.45f, 0.72f, 1.0f);
       break;
     }
-    glm::dvec3 p = rayItr->first->getPosition();
-    glm::dvec3 d = rayItr->first->getDirection();
-    glm::dvec3 isectPoint = p + rayItr->second->getT() * d;
+    glm::dvec3 p = rec.position;
+    glm::dvec3 d = rec.direction;
+    glm::dvec3 isectPoint = p + rec.t * d;
 
     glEnable(GL_LINE_STIPPLE);
     glLineStipple(1, 0x3333);
@@ -480,7 +479,7 @@ void DebuggingView::drawRays() {
       glBegin(GL_LINES);
       glColor4f(0.5f, 1.0f, 0.5f, 1.0f);
       glVertex3d(0.0, 0.0, 0.0);
-      glVertex3dv(&(rayItr->second->getN()[0]));
+      glVertex3dv(&rec.normal[0]);
       glEnd();
       glPopMatrix();
     }
@@ -346,6 +346,20 @@ void Trimesh::glDrawLocal([[maybe_unused]] int quality, bool actualMaterials,
     glNewList(displayList, GL_COMPILE);
 
     glBegin(GL_TRIANGLES);
+    if (packed) {
+      setGLMaterial(material, this);
+      for (size_t f = 0; f < packed->faceCount(); ++f) {
+        for (int k = 0; k < 3; ++k) {
+          int v = packed->index(f, k);
+          if (packed->hasNormals()) {
+            glm::dvec3 n = packed->normal(v);
+            glNormal3dv(&n[0]);
+          }
+          glm::dvec3 p = packed->position(v);
+          glVertex3dv(&p[0]);
+        }
+      }
+    }
     for (Faces::const_iterator itr = faces.begin(); itr != faces.end(); ++itr) {
       const int vert1 = (*(*itr))[0];
       const int vert2 = (*(*itr))[1];